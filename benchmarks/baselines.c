@@ -0,0 +1,302 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "baselines.h"
+#include "../src/hash.h"
+
+static size_t pow2_at_least(size_t x) {
+    size_t p = 1;
+    while(p < x) p *= 2;
+    return p;
+}
+
+/*
+ * Open addressing with linear probing. A slot holds the key pointer, its
+ * length and the top half of its hash, which is compared before the key.
+ */
+
+typedef struct {
+    const char *key; // NULL when empty
+    uint32_t len;
+    uint32_t tag; // hash >> 32
+} linear_slot_t;
+
+typedef struct {
+    linear_slot_t *slots;
+    size_t mask;
+} linear_table_t;
+
+static void *linear_build(char **keys, size_t n) {
+    linear_table_t *t = malloc(sizeof(linear_table_t));
+    size_t cap = pow2_at_least(n * 10 / 7 + 1);
+    if(!t || !(t->slots = calloc(cap, sizeof(linear_slot_t)))) {
+        free(t);
+        return NULL;
+    }
+    t->mask = cap - 1;
+
+    for(size_t i = 0; i < n; i++) {
+        size_t len = strlen(keys[i]);
+        uint64_t h = ph_key_hash(keys[i], len);
+        size_t pos = (size_t)h & t->mask;
+        while(t->slots[pos].key) pos = (pos + 1) & t->mask;
+        t->slots[pos] = (linear_slot_t){ keys[i], (uint32_t)len, (uint32_t)(h >> 32) };
+    }
+    return t;
+}
+
+static int linear_lookup(const void *table, const char *key) {
+    const linear_table_t *t = table;
+    size_t len = strlen(key);
+    uint64_t h = ph_key_hash(key, len);
+    for(size_t pos = (size_t)h & t->mask; t->slots[pos].key; pos = (pos + 1) & t->mask) {
+        const linear_slot_t *s = &t->slots[pos];
+        if(s->tag == (uint32_t)(h >> 32) && s->len == len && memcmp(s->key, key, len) == 0) return 0;
+    }
+    return -1;
+}
+
+static size_t linear_memory(const void *table) {
+    const linear_table_t *t = table;
+    return sizeof(linear_table_t) + (t->mask + 1) * sizeof(linear_slot_t);
+}
+
+static void linear_destroy(void *table) {
+    linear_table_t *t = table;
+    free(t->slots);
+    free(t);
+}
+
+/*
+ * Swiss table: slots in groups of 16, each group behind 16 control bytes
+ * that hold 7 bits of a slot's key hash (H2) or SWISS_EMPTY. The rest of
+ * the hash (H1) picks the first group. A lookup compares all 16 control
+ * bytes of a group with H2 in one SIMD compare and loads only the keys of
+ * the matching slots. It stops at a group with an empty slot, and probes
+ * groups triangularly, which visits every group of a power of two.
+ */
+
+#define SWISS_GROUP 16
+#define SWISS_EMPTY 0x80
+
+typedef struct {
+    const char *key;
+    size_t len;
+} swiss_slot_t;
+
+typedef struct {
+    uint8_t *ctrl; // num_groups * SWISS_GROUP
+    swiss_slot_t *slots;
+    size_t group_mask; // num_groups - 1
+} swiss_table_t;
+
+/**
+ * @brief Bit i set where ctrl[i] == byte, for the 16 bytes of a group.
+ */
+static inline unsigned int swiss_match(const uint8_t *ctrl, uint8_t byte) {
+#ifdef __SSE2__
+    __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+    return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)byte)));
+#else
+    unsigned int mask = 0;
+    for(int i = 0; i < SWISS_GROUP; i++) mask |= (unsigned int)(ctrl[i] == byte) << i;
+    return mask;
+#endif
+}
+
+static void *swiss_build(char **keys, size_t n) {
+    swiss_table_t *t = malloc(sizeof(swiss_table_t));
+    size_t groups = pow2_at_least((n * 8 / 7 + SWISS_GROUP) / SWISS_GROUP); // leaves an empty slot
+    if(!t) return NULL;
+    t->ctrl = malloc(groups * SWISS_GROUP);
+    t->slots = malloc(groups * SWISS_GROUP * sizeof(swiss_slot_t));
+    if(!t->ctrl || !t->slots) {
+        free(t->ctrl);
+        free(t->slots);
+        free(t);
+        return NULL;
+    }
+    memset(t->ctrl, SWISS_EMPTY, groups * SWISS_GROUP);
+    t->group_mask = groups - 1;
+
+    for(size_t i = 0; i < n; i++) {
+        size_t len = strlen(keys[i]);
+        uint64_t h = ph_key_hash(keys[i], len);
+        size_t g = (size_t)(h >> 7) & t->group_mask;
+        unsigned int empty;
+        for(size_t step = 1; !(empty = swiss_match(t->ctrl + g * SWISS_GROUP, SWISS_EMPTY)); step++) {
+            g = (g + step) & t->group_mask;
+        }
+        size_t slot = g * SWISS_GROUP + (size_t)__builtin_ctz(empty);
+        t->ctrl[slot] = (uint8_t)(h & 0x7f);
+        t->slots[slot] = (swiss_slot_t){ keys[i], len };
+    }
+    return t;
+}
+
+static int swiss_lookup(const void *table, const char *key) {
+    const swiss_table_t *t = table;
+    size_t len = strlen(key);
+    uint64_t h = ph_key_hash(key, len);
+    size_t g = (size_t)(h >> 7) & t->group_mask;
+
+    for(size_t step = 1; ; step++) {
+        const uint8_t *ctrl = t->ctrl + g * SWISS_GROUP;
+        for(unsigned int match = swiss_match(ctrl, (uint8_t)(h & 0x7f)); match; match &= match - 1) {
+            const swiss_slot_t *s = &t->slots[g * SWISS_GROUP + (size_t)__builtin_ctz(match)];
+            if(s->len == len && memcmp(s->key, key, len) == 0) return 0;
+        }
+        if(swiss_match(ctrl, SWISS_EMPTY)) return -1;
+        g = (g + step) & t->group_mask;
+    }
+}
+
+static size_t swiss_memory(const void *table) {
+    const swiss_table_t *t = table;
+    size_t slots = (t->group_mask + 1) * SWISS_GROUP;
+    return sizeof(swiss_table_t) + slots + slots * sizeof(swiss_slot_t);
+}
+
+static void swiss_destroy(void *table) {
+    swiss_table_t *t = table;
+    free(t->ctrl);
+    free(t->slots);
+    free(t);
+}
+
+/*
+ * Sorted array of key pointers, searched with strcmp().
+ */
+
+typedef struct {
+    const char **keys;
+    size_t n;
+} sorted_table_t;
+
+static int compare_keys(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+static void *sorted_build(char **keys, size_t n) {
+    sorted_table_t *t = malloc(sizeof(sorted_table_t));
+    if(!t || !(t->keys = malloc((n ? n : 1) * sizeof(char *)))) {
+        free(t);
+        return NULL;
+    }
+    memcpy(t->keys, keys, n * sizeof(char *));
+    qsort(t->keys, n, sizeof(char *), compare_keys);
+    t->n = n;
+    return t;
+}
+
+static int sorted_lookup(const void *table, const char *key) {
+    const sorted_table_t *t = table;
+    size_t lo = 0, hi = t->n;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(t->keys[mid], key);
+        if(cmp == 0) return 0;
+        if(cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return -1;
+}
+
+static size_t sorted_memory(const void *table) {
+    const sorted_table_t *t = table;
+    return sizeof(sorted_table_t) + t->n * sizeof(char *);
+}
+
+static void sorted_destroy(void *table) {
+    sorted_table_t *t = table;
+    free(t->keys);
+    free(t);
+}
+
+/*
+ * Separate chaining with one heap node per key, as in
+ * std::unordered_map, and a bucket per key.
+ */
+
+typedef struct chain_node {
+    struct chain_node *next;
+    const char *key;
+    uint32_t len;
+    uint32_t tag; // hash >> 32
+} chain_node_t;
+
+typedef struct {
+    chain_node_t **heads;
+    size_t mask;
+    size_t node_bytes; // as the allocator sees them, chunk headers included
+} chained_table_t;
+
+static void chained_destroy(void *table) {
+    chained_table_t *t = table;
+    for(size_t b = 0; b <= t->mask; b++) {
+        for(chain_node_t *node = t->heads[b], *next; node; node = next) {
+            next = node->next;
+            free(node);
+        }
+    }
+    free(t->heads);
+    free(t);
+}
+
+static void *chained_build(char **keys, size_t n) {
+    chained_table_t *t = calloc(1, sizeof(chained_table_t));
+    size_t buckets = pow2_at_least(n ? n : 1);
+    if(!t || !(t->heads = calloc(buckets, sizeof(chain_node_t *)))) {
+        free(t);
+        return NULL;
+    }
+    t->mask = buckets - 1;
+
+    for(size_t i = 0; i < n; i++) {
+        size_t len = strlen(keys[i]);
+        uint64_t h = ph_key_hash(keys[i], len);
+        chain_node_t *node = malloc(sizeof(chain_node_t));
+        if(!node) {
+            chained_destroy(t);
+            return NULL;
+        }
+#ifdef __GLIBC__
+        t->node_bytes += malloc_usable_size(node) + sizeof(size_t);
+#else
+        t->node_bytes += sizeof(chain_node_t);
+#endif
+        size_t b = (size_t)h & t->mask;
+        *node = (chain_node_t){ t->heads[b], keys[i], (uint32_t)len, (uint32_t)(h >> 32) };
+        t->heads[b] = node;
+    }
+    return t;
+}
+
+static int chained_lookup(const void *table, const char *key) {
+    const chained_table_t *t = table;
+    size_t len = strlen(key);
+    uint64_t h = ph_key_hash(key, len);
+    for(const chain_node_t *node = t->heads[(size_t)h & t->mask]; node; node = node->next) {
+        if(node->tag == (uint32_t)(h >> 32) && node->len == len && memcmp(node->key, key, len) == 0) return 0;
+    }
+    return -1;
+}
+
+static size_t chained_memory(const void *table) {
+    const chained_table_t *t = table;
+    return sizeof(chained_table_t) + (t->mask + 1) * sizeof(chain_node_t *) + t->node_bytes;
+}
+
+const baseline_ops_t baselines[NUM_BASELINES] = {
+    [BASELINE_LINEAR] = { "linear probe", linear_build, linear_lookup, linear_memory, linear_destroy },
+    [BASELINE_SWISS] = { "swiss table", swiss_build, swiss_lookup, swiss_memory, swiss_destroy },
+    [BASELINE_SORTED] = { "sorted array", sorted_build, sorted_lookup, sorted_memory, sorted_destroy },
+    [BASELINE_CHAINED] = { "chained", chained_build, chained_lookup, chained_memory, chained_destroy },
+};
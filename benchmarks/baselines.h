@@ -0,0 +1,35 @@
+#ifndef BASELINES_H
+#define BASELINES_H
+
+#include <stddef.h>
+
+/**
+ * The structures a perfect hash table would replace, built over the same
+ * key sets so the benchmark can report them next to ph_*. Like a pointer
+ * mode ph_table they store pointers to the caller's keys, not copies, and
+ * the hash tables hash with ph_key_hash(), so the comparison is between
+ * the structures rather than the hash functions.
+ */
+
+typedef struct {
+    const char *name;
+    // NULL on failure
+    void *(*build)(char **keys, size_t n);
+    // 0 when key is in the set, -1 otherwise (as ph_lookup())
+    int (*lookup)(const void *t, const char *key);
+    // Bytes of the structure, the key strings not included (as calc_mem())
+    size_t (*memory)(const void *t);
+    void (*destroy)(void *t);
+} baseline_ops_t;
+
+enum {
+    BASELINE_LINEAR, // open addressing, linear probing, load <= 0.7
+    BASELINE_SWISS, // 16-slot groups behind SIMD-matched control bytes, load <= 7/8
+    BASELINE_SORTED, // sorted key pointers, binary search
+    BASELINE_CHAINED, // separate chaining, one malloc per key, load <= 1
+    NUM_BASELINES
+};
+
+extern const baseline_ops_t baselines[NUM_BASELINES];
+
+#endif
@@ -1,10 +1,27 @@
+#define _GNU_SOURCE // pthread_setaffinity_np
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <math.h>
+#include <sched.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/resource.h>
+#include <pthread.h>
 #include "../src/ph.h"
+#include "../src/hash.h"
+#include "../src/ph_map.h"
+#include "../src/ph_external.h"
+#include "../src/ph_handle.h"
+#include "../src/ph_u64.h"
+#include "../src/ph_arena.h"
 #include "stats.h"
+#include "datasets.h"
 #include "cache_perf.h"
+#include "results.h"
+#include "baselines.h"
+#include "codegen_keys.h" // generated by ph_codegen from tests/codegen_keys.txt
 
 #define NUM_TRIALS 10
 #define WARMUP_RUNS 3
@@ -14,9 +31,17 @@ typedef struct {
     double lookup_time;
     size_t memory_bytes;
     build_metrics_t build_metrics;
-    cache_metrics_t cache_metrics; 
+    int keys; // after deduplication
+    double hit_ns[3]; // p50, p99 and p99.9 of single lookups that hit
+    double miss_ns[3]; // and of those that missed
+    int failed; // the build returned NULL, nothing else is set
 } trial_result_t;
 
+static const double latency_percentiles[3] = { 50, 99, 99.9 };
+
+// Where benchmark_ph() records its trials when --out is given, else NULL
+static result_file_t *results;
+
 
 
 /**
@@ -55,24 +80,14 @@ void free_keys(char **keys, int n) {
  *          - When two or more identical keys are made purely due to randomness 
  *            in generate_keys(). 
  * 
+ *        Keys are deduplicated through a hash table of the keys kept so 
+ *        far (expected O(n), see dataset_dedupe()); the first occurrence of 
+ *        each key is kept and key order is preserved. 
+ * 
  */
 static char **key_set_cleaner(char **keys, int *n) {
     int old_n = *n;
-    int count = 0;
-
-    for (int i = 0; i < old_n; i++) {
-        int dup = 0;
-        for (int j = 0; j < count; j++) {
-            if (strcmp(keys[i], keys[j]) == 0) {
-                dup = 1;
-                free(keys[i]); 
-                break;
-            }
-        }
-        if (!dup) {
-            keys[count++] = keys[i];
-        }
-    }
+    int count = (int)dataset_dedupe(keys, old_n, 1);
 
     *n = count;
     keys = realloc(keys, count * sizeof(char*));
@@ -96,46 +111,113 @@ double get_time_seconds() {
  * @brief Calculates the amount of memory space used up 
  *        by a hash table. 
  */
-size_t calc_mem(ph_table *t, size_t max_str_len) { 
+size_t calc_mem(ph_table *t) { 
     size_t total = 0; 
 
     // Table 
     total += sizeof(ph_table); 
 
-    // Level 1 bucket 
-    total += t->m * sizeof(ph_bucket_t); 
+    // Bucket params and slots (one block) 
+    total += t->mem_bytes; 
+    return total; 
+}
 
-    // Hash params 
-    total += sizeof(Universal_Hash_Params); 
-    total += max_str_len * sizeof(unsigned int); 
+/** 
+ * @brief Adds every trial's times, latency percentiles, memory and build metrics to results, one 
+ *        record per metric. Lower is better only for the times and memory; 
+ *        the build metrics are recorded for context. 
+ */
+static void record_trials(int hash_type, int n, int key_len, const trial_result_t *trials, int count) { 
+    enum { BUILD, LOOKUP, HIT_P50, HIT_P99, HIT_P999, MISS_P50, MISS_P99, MISS_P999, MEMORY, PER_KEY, KEYS, ATTEMPTS, 
+        MAX_ATTEMPTS, BUCKETS, COLLISIONS, DRAWS, LOOSENED, NUM_METRICS }; 
+    static const struct { const char *name; const char *unit; int lower_is_better; } metrics[NUM_METRICS] = { 
+        [BUILD] = { "build_time", "s", 1 }, 
+        [LOOKUP] = { "lookup_time", "s/key", 1 }, 
+        [HIT_P50] = { "hit_p50", "ns", 1 }, 
+        [HIT_P99] = { "hit_p99", "ns", 1 }, 
+        [HIT_P999] = { "hit_p99.9", "ns", 1 }, 
+        [MISS_P50] = { "miss_p50", "ns", 1 }, 
+        [MISS_P99] = { "miss_p99", "ns", 1 }, 
+        [MISS_P999] = { "miss_p99.9", "ns", 1 }, 
+        [MEMORY] = { "memory_bytes", "bytes", 1 }, 
+        [PER_KEY] = { "bytes_per_key", "bytes", 1 }, 
+        [KEYS] = { "keys", "keys", 0 }, 
+        [ATTEMPTS] = { "total_attempts", "count", 0 }, 
+        [MAX_ATTEMPTS] = { "max_attempts_bucket", "count", 0 }, 
+        [BUCKETS] = { "buckets_processed", "count", 0 }, 
+        [COLLISIONS] = { "total_collisions", "count", 0 }, 
+        [DRAWS] = { "level1_draws", "count", 0 }, 
+        [LOOSENED] = { "loosened_buckets", "count", 0 }, 
+    }; 
 
-    // Level 2 bucket 
-    for(size_t i = 0; i < t->m; i++) { 
-        ph_bucket_t *b = &t->buckets[i]; 
-        if(b->key_count == 0) continue;
-        total += b->table_size * sizeof(char *);
-        if(b->key_count > 1) { 
-            total += sizeof(Universal_Hash_Params); 
-            total += max_str_len * sizeof(unsigned int); 
+    double samples[NUM_METRICS][NUM_TRIALS]; 
+    for(int i = 0; i < count; i++) { 
+        const trial_result_t *t = &trials[i]; 
+        samples[BUILD][i] = t->build_time; 
+        samples[LOOKUP][i] = t->lookup_time; 
+        for(int p = 0; p < 3; p++) { 
+            samples[HIT_P50 + p][i] = t->hit_ns[p]; 
+            samples[MISS_P50 + p][i] = t->miss_ns[p]; 
         }
-    } 
-    return total; 
+        samples[MEMORY][i] = (double)t->memory_bytes; 
+        samples[PER_KEY][i] = (double)t->memory_bytes / t->keys; 
+        samples[KEYS][i] = t->keys; 
+        samples[ATTEMPTS][i] = t->build_metrics.total_attempts; 
+        samples[MAX_ATTEMPTS][i] = t->build_metrics.max_attemps_bucket; 
+        samples[BUCKETS][i] = t->build_metrics.total_buckets_processed; 
+        samples[COLLISIONS][i] = (double)t->build_metrics.total_collisions; 
+        samples[DRAWS][i] = t->build_metrics.level1_draws; 
+        samples[LOOSENED][i] = t->build_metrics.loosened_buckets; 
+    }
+    for(int m = 0; m < NUM_METRICS; m++) { 
+        results_add(results, "ph", hash_type, n, key_len, metrics[m].name, metrics[m].unit, 
+            metrics[m].lower_is_better, samples[m], count); 
+    }
 }
 
-trial_result_t single_trial(int n, int key_len, int hash_type) { 
+/** 
+ * @brief Times each lookup on its own: every key of the set and as many 
+ *        fresh keys, interleaved, into hits or misses by their result. 
+ */
+static void time_single_lookups(ph_table *ht, char **keys, int n, int key_len, histogram_t *hits, histogram_t *misses) { 
+    char **absent = generate_keys(n, key_len); // misses, bar the odd key that is in the set 
+    for(int i = 0; i < 2 * n; i++) { 
+        const char *key = (i & 1) ? absent[i / 2] : keys[i / 2]; 
+        uint64_t start = read_ticks(); 
+        int found = ph_lookup(ht, key); 
+        uint64_t ticks = read_ticks() - start; 
+        hist_record((found == 0) ? hits : misses, ticks); 
+    }
+    free_keys(absent, n); 
+}
+
+/** 
+ * @brief One build and lookup pass over n fresh keys. With prof, the build 
+ *        phases and the lookups are also counted into it. With hits and 
+ *        misses, every single lookup's latency is added to them too. 
+ */
+trial_result_t single_trial(int n, int key_len, int hash_type, perf_profile_t *prof, histogram_t *hits, 
+    histogram_t *misses) { 
     trial_result_t result = {0}; 
 
     char **keys = generate_keys(n, key_len); 
-    int original_n = n; 
     keys = key_set_cleaner(keys, &n); 
+    result.keys = n; 
 
+    ph_build_opts_t opts = { .phase_hook = prof ? perf_phase_hook : NULL, .phase_ctx = prof }; 
     double start = get_time_seconds(); 
-    ph_table *ht = ph_build(keys, n, key_len, hash_type, &result.build_metrics); 
+    ph_table *ht = ph_build_opts(keys, n, hash_type, &opts, &result.build_metrics); 
     double end = get_time_seconds(); 
     result.build_time = end - start; 
+    if(!ht) { 
+        result.failed = 1; 
+        free_keys(keys, n); 
+        return result; 
+    }
 
-    result.memory_bytes = calc_mem(ht, key_len); 
+    result.memory_bytes = calc_mem(ht); 
 
+    if(prof) perf_phase_hook(PERF_PHASE_LOOKUP, 1, prof); 
     start = get_time_seconds(); 
     for(int i = 0; i < n; i++) { 
         int found = ph_lookup(ht, keys[i]); 
@@ -144,8 +226,22 @@ trial_result_t single_trial(int n, int key_len, int hash_type) {
         }
     }
     end = get_time_seconds(); 
+    if(prof) perf_phase_hook(PERF_PHASE_LOOKUP, 0, prof); 
     result.lookup_time = (end - start) / n; //  per key avg 
-    // result.cache_metrics = measure_cache_performance(ht, keys, n); 
+
+    if(hits && misses) { 
+        histogram_t *trial = malloc(2 * sizeof(histogram_t)); 
+        hist_init(&trial[0]); 
+        hist_init(&trial[1]); 
+        time_single_lookups(ht, keys, n, key_len, &trial[0], &trial[1]); 
+        for(int p = 0; p < 3; p++) { 
+            result.hit_ns[p] = hist_percentile(&trial[0], latency_percentiles[p]) / ticks_per_ns(); 
+            result.miss_ns[p] = hist_percentile(&trial[1], latency_percentiles[p]) / ticks_per_ns(); 
+        }
+        hist_merge(hits, &trial[0]); 
+        hist_merge(misses, &trial[1]); 
+        free(trial); 
+    }
 
     ph_free(ht); 
     free_keys(keys, n);
@@ -153,6 +249,27 @@ trial_result_t single_trial(int n, int key_len, int hash_type) {
     return result; 
 }
 
+/** 
+ * @brief Percentiles of single lookups in ns, hits and misses apart. 
+ */
+static void print_latency(const histogram_t *hits, const histogram_t *misses) { 
+    double rate = ticks_per_ns(); 
+    printf("\n--- LOOKUP LATENCY (ns per single lookup, all trials) ---\n"); 
+    printf("  %-7s %10s %8s %8s %8s %10s %8s\n", "", "count", "p50", "p99", "p99.9", "max", "mean"); 
+    const histogram_t *h[2] = { hits, misses }; 
+    for(int i = 0; i < 2; i++) { 
+        printf("  %-7s %10llu", i ? "misses" : "hits", (unsigned long long)h[i]->total); 
+        if(h[i]->total == 0) { 
+            printf("\n"); 
+            continue; 
+        }
+        printf(" %8.1f %8.1f %8.1f %10.1f %8.1f\n", hist_percentile(h[i], 50) / rate, hist_percentile(h[i], 99) / rate, 
+            hist_percentile(h[i], 99.9) / rate, hist_percentile(h[i], 100) / rate, hist_mean(h[i]) / rate); 
+    }
+    printf("  (%.2f timer ticks per ns; each value includes %.1f ns of timer overhead)\n", rate, 
+        timer_overhead_ticks() / rate); 
+}
+
 /** 
  * @brief Note that we use warmup runs to ensure that caches contain information for 
  *        all runs to ensure consistency between multiple trials. I've seen that 
@@ -163,8 +280,10 @@ void benchmark_ph(int n, int key_len, int hash_type) {
     printf("========================================\n");
     if(hash_type == 0) {
         printf("\033[32mHash Type: Regular Perfect Hashing (O(n^2))\033[0m\n");
-    } else {
+    } else if(hash_type == 1) {
         printf("\033[36mHash Type: Minimal Perfect Hashing (O(n))\033[0m\n");
+    } else {
+        printf("\033[35mHash Type: Hash-and-Displace Minimal Perfect Hashing (O(n))\033[0m\n");
     }
     printf("Dataset: %d keys, %d chars per key\n", n, key_len);
     printf("========================================\n");
@@ -172,56 +291,72 @@ void benchmark_ph(int n, int key_len, int hash_type) {
     // Warmup runs 
     printf("Running %d warmup trial runs... \n", WARMUP_RUNS); 
     for(int i = 0; i < WARMUP_RUNS; i++) { 
-        trial_result_t warmup = single_trial(n, key_len, hash_type); 
+        trial_result_t warmup = single_trial(n, key_len, hash_type, NULL, NULL, NULL); 
         (void)warmup; // supress the unused warning
     }
 
     printf("Running %d benchmark trial runs... \n", NUM_TRIALS); 
+    trial_result_t trials[NUM_TRIALS]; 
     double *build_times = malloc(NUM_TRIALS * sizeof(double)); 
     double *lookup_times = malloc(NUM_TRIALS * sizeof(double)); 
     size_t *memory_sizes = malloc(NUM_TRIALS * sizeof(size_t)); 
     int *total_attempts = malloc(NUM_TRIALS * sizeof(int));
     int *max_attempts = malloc(NUM_TRIALS * sizeof(int));
 
-    // long long *cache_refs = malloc(NUM_TRIALS * sizeof(long long)); 
-    // long long *cache_misses = malloc(NUM_TRIALS * sizeof(long long)); 
-    // double *cache_miss_rates = malloc(NUM_TRIALS * sizeof(double)); 
+    // hardware counters per build phase and for the lookups, over every trial
+    perf_profile_t prof; 
+    perf_profile_open(&prof); 
+    double total_keys = 0; 
+
+    // latency of every single lookup, over every trial
+    histogram_t *latency = malloc(2 * sizeof(histogram_t)); 
+    hist_init(&latency[0]); 
+    hist_init(&latency[1]); 
     
+    // failed builds are reported and left out, the stats are over the rest 
+    int done = 0; 
     for(int trial = 0; trial < NUM_TRIALS; trial++) { 
-        trial_result_t result = single_trial(n, key_len, hash_type); 
-        build_times[trial] = result.build_time; 
-        lookup_times[trial] = result.lookup_time; 
-        memory_sizes[trial] = result.memory_bytes; 
-        total_attempts[trial] = result.build_metrics.total_attempts; 
-        max_attempts[trial] = result.build_metrics.max_attemps_bucket; 
-
-        // cache_refs[trial] = result.cache_metrics.cache_references;
-        // cache_misses[trial] = result.cache_metrics.cache_misses;
-        // cache_miss_rates[trial] = result.cache_metrics.cache_miss_rate;
+        trial_result_t result = single_trial(n, key_len, hash_type, &prof, &latency[0], &latency[1]); 
+        if(result.failed) { 
+            printf("Trial %d: build failed, skipped\n", trial + 1); 
+            continue; 
+        }
+        trials[done] = result; 
+        total_keys += result.keys; 
+        build_times[done] = result.build_time; 
+        lookup_times[done] = result.lookup_time; 
+        memory_sizes[done] = result.memory_bytes; 
+        total_attempts[done] = result.build_metrics.total_attempts; 
+        max_attempts[done] = result.build_metrics.max_attemps_bucket; 
+        done++; 
 
-        printf("Trial %d: build=%.6fs, lookup=%.9fs, mem=%zuKB, cache_miss=%.2f%%\n", 
-            trial + 1, result.build_time, result.lookup_time, result.memory_bytes / 1024, result.cache_metrics.cache_miss_rate); 
+        printf("Trial %d: build=%.6fs, lookup=%.9fs, mem=%zuKB\n", 
+            trial + 1, result.build_time, result.lookup_time, result.memory_bytes / 1024); 
+    }
+    if(done == 0) { 
+        printf("Error: every build failed\n"); 
+        free(latency); 
+        perf_profile_close(&prof); 
+        free(build_times); 
+        free(lookup_times); 
+        free(memory_sizes); 
+        free(total_attempts); 
+        free(max_attempts); 
+        return; 
     }
 
-    stats_t build_stats = calc_stats(build_times, NUM_TRIALS); 
-    stats_t lookup_stats = calc_stats(lookup_times, NUM_TRIALS); 
+    stats_t build_stats = calc_stats(build_times, done); 
+    stats_t lookup_stats = calc_stats(lookup_times, done); 
 
     double mem_vals[NUM_TRIALS]; 
     double attempts_vals[NUM_TRIALS];
-    // double cache_ref_vals[NUM_TRIALS];
-    // double cache_miss_vals[NUM_TRIALS];
 
-    for(int i = 0; i < NUM_TRIALS; i++) { 
+    for(int i = 0; i < done; i++) { 
         mem_vals[i] = (double)memory_sizes[i];
         attempts_vals[i] = (double)total_attempts[i]; 
-        // cache_ref_vals[i] = (double)cache_refs[i];
-        // cache_miss_vals[i] = (double)cache_misses[i];
-    }
-    stats_t mem_stats = calc_stats(mem_vals, NUM_TRIALS);   
-    stats_t attempts_stats = calc_stats(attempts_vals, NUM_TRIALS);
-    // stats_t cache_miss_rate_stats = calc_stats(cache_miss_rates, NUM_TRIALS);
-    // stats_t cache_ref_stats = calc_stats(cache_ref_vals, NUM_TRIALS);
-    // stats_t cache_miss_stats = calc_stats(cache_miss_vals, NUM_TRIALS);
+    }
+    stats_t mem_stats = calc_stats(mem_vals, done);   
+    stats_t attempts_stats = calc_stats(attempts_vals, done);
     
     printf("\n--- BUILD TIME (seconds) ---\n");
     printf("  Min:    %.6f\n", build_stats.min);
@@ -232,7 +367,7 @@ void benchmark_ph(int n, int key_len, int hash_type) {
     printf("  Max:    %.6f\n", build_stats.max);
     printf("  StdDev: %.6f\n", build_stats.std_dev);
     
-    printf("\n--- LOOKUP TIME (seconds per key) ---\n");
+    printf("\n--- LOOKUP TIME (seconds per key, over the %d trial means) ---\n", done);
     printf("  Min:    %.9f\n", lookup_stats.min);
     printf("  Median: %.9f\n", lookup_stats.median);
     printf("  Mean:   %.9f\n", lookup_stats.mean);
@@ -241,6 +376,9 @@ void benchmark_ph(int n, int key_len, int hash_type) {
     printf("  Max:    %.9f\n", lookup_stats.max);
     // printf("  StdDev: %.6f\n", lookup_stats.std_dev);
 
+    print_latency(&latency[0], &latency[1]); 
+    free(latency); 
+
     
     printf("\n--- MEMORY USAGE ---\n");
     printf("  Median: %zu bytes (%.2f KB, %.2f MB)\n",
@@ -253,14 +391,10 @@ void benchmark_ph(int n, int key_len, int hash_type) {
     printf("  Avg total attempts: %.1f\n", attempts_stats.mean);
     printf("  Max attempts (worst bucket): %d\n", max_attempts[0]);
 
-    // printf("\n--- CACHE PERFORMANCE ---\n");
-    // printf("  Median cache references: %.0f\n", cache_ref_stats.median);
-    // printf("  Median cache misses: %.0f\n", cache_miss_stats.median);
-    // printf("  Mean cache miss rate: %.2f%%\n", cache_miss_rate_stats.mean);
-    // printf("  Median cache miss rate: %.2f%%\n", cache_miss_rate_stats.median);
-    // printf("  P95 cache miss rate: %.2f%%\n", cache_miss_rate_stats.p95);
-    // printf("  Avg cache refs per lookup: %.2f\n", cache_ref_stats.mean / n);
-    // printf("  Avg cache misses per lookup: %.2f\n", cache_miss_stats.mean / n);
+    print_perf_profile(&prof, total_keys); 
+    perf_profile_close(&prof); 
+
+    if(results) record_trials(hash_type, n, key_len, trials, done); 
     
     // Cleanup
     free(build_times);
@@ -268,23 +402,1400 @@ void benchmark_ph(int n, int key_len, int hash_type) {
     free(memory_sizes);
     free(total_attempts);
     free(max_attempts);
-    // free(cache_refs);
-    // free(cache_misses);
-    // free(cache_miss_rates);
 }
 
 
 
+/** 
+ * @brief Build time of ph_build_parallel() for 1, 2, 4, ... max_threads threads 
+ *        on one key set, reported as the median over NUM_TRIALS builds along 
+ *        with the speedup and parallel efficiency relative to one thread. 
+ */
+void benchmark_build_scaling(int n, int key_len, int hash_type, int max_threads) { 
+    printf("========================================\n");
+    printf("Build scaling: hash type %d, %d keys, %d chars per key\n", hash_type, n, key_len);
+    printf("========================================\n");
+
+    char **keys = generate_keys(n, key_len); 
+    keys = key_set_cleaner(keys, &n); 
+
+    double base = 0; 
+    double times[NUM_TRIALS]; 
+    printf("%8s %12s %10s %11s\n", "threads", "median (s)", "speedup", "efficiency"); 
+
+    // 1, 2, 4, ... and always max_threads itself 
+    for(int threads = 1; threads <= max_threads; 
+        threads = (threads < max_threads && threads * 2 > max_threads) ? max_threads : threads * 2) { 
+        for(int i = 0; i < WARMUP_RUNS; i++) { 
+            ph_free(ph_build_parallel(keys, n, key_len, hash_type, threads, NULL)); 
+        }
+        for(int trial = 0; trial < NUM_TRIALS; trial++) { 
+            double start = get_time_seconds(); 
+            ph_table *ht = ph_build_parallel(keys, n, key_len, hash_type, threads, NULL); 
+            times[trial] = get_time_seconds() - start; 
+            if(!ht) { 
+                printf("Error: build failed\n"); 
+                free_keys(keys, n); 
+                return; 
+            }
+            ph_free(ht); 
+        }
+
+        double median = calc_median(times, NUM_TRIALS); 
+        if(threads == 1) base = median; 
+        printf("%8d %12.6f %9.2fx %10.1f%%\n", threads, median, base / median, 
+            100.0 * base / (median * threads)); 
+    }
+
+    free_keys(keys, n); 
+}
+
+#define LOOKUP_BATCH_SIZE 256 // keys per ph_lookup_batch call, one request's worth
+
+/** 
+ * @brief ns/key of a scalar ph_lookup loop next to ph_lookup_batch over the 
+ *        same table and keys, each the median over NUM_TRIALS passes. 
+ */
+void benchmark_batch_lookup(int n, int key_len, int hash_type) { 
+    printf("========================================\n");
+    printf("Batch lookup: hash type %d, %d keys, %d chars per key\n", hash_type, n, key_len);
+    printf("========================================\n");
+
+    char **keys = generate_keys(n, key_len); 
+    keys = key_set_cleaner(keys, &n); 
+    ph_table *ht = ph_build(keys, n, key_len, hash_type, NULL); 
+    if(!ht) { 
+        printf("Error: build failed\n"); 
+        free_keys(keys, n); 
+        return; 
+    }
+    int *results = malloc(n * sizeof(int)); 
+
+    double scalar[NUM_TRIALS], batch[NUM_TRIALS]; 
+    for(int trial = -WARMUP_RUNS; trial < NUM_TRIALS; trial++) { 
+        int misses = 0; 
+        double start = get_time_seconds(); 
+        for(int i = 0; i < n; i++) { 
+            misses += ph_lookup(ht, keys[i]) != 0; 
+        }
+        double scalar_time = get_time_seconds() - start; 
+
+        start = get_time_seconds(); 
+        for(int base = 0; base < n; base += LOOKUP_BATCH_SIZE) { 
+            int count = (n - base < LOOKUP_BATCH_SIZE) ? n - base : LOOKUP_BATCH_SIZE; 
+            ph_lookup_batch(ht, keys + base, count, results + base); 
+        }
+        double batch_time = get_time_seconds() - start; 
+
+        for(int i = 0; i < n; i++) misses += results[i] != 0; 
+        if(misses) printf("Error: %d keys not found\n", misses); 
+        if(trial < 0) continue; 
+
+        scalar[trial] = scalar_time / n * 1e9; 
+        batch[trial] = batch_time / n * 1e9; 
+    }
+
+    double scalar_ns = calc_median(scalar, NUM_TRIALS); 
+    double batch_ns = calc_median(batch, NUM_TRIALS); 
+    printf("  Scalar ph_lookup:       %.2f ns/key\n", scalar_ns); 
+    printf("  ph_lookup_batch (%d):  %.2f ns/key\n", LOOKUP_BATCH_SIZE, batch_ns); 
+    printf("  Speedup:                %.2fx\n", scalar_ns / batch_ns); 
+
+    free(results); 
+    ph_free(ht); 
+    free_keys(keys, n); 
+}
+
+/** 
+ * @brief ns/key and GB/s of every key hash kernel the CPU supports, hashing 
+ *        the same keys, each the median over NUM_TRIALS passes. 
+ */
+void benchmark_hash_kernels(int n, int key_len) { 
+    printf("========================================\n");
+    printf("Key hash kernels: %d keys, %d chars per key\n", n, key_len);
+    printf("========================================\n");
+
+    char **keys = generate_keys(n, key_len); 
+    size_t len = key_len - 1; 
+    uint64_t sink = 0; 
+
+    for(int kernel = 0; kernel < PH_KERNEL_COUNT; kernel++) { 
+        if(!ph_key_hash_kernel_supported(kernel)) { 
+            printf("  %-8s not supported\n", ph_key_hash_kernel_name(kernel)); 
+            continue; 
+        }
+        double ns[NUM_TRIALS]; 
+        for(int trial = -WARMUP_RUNS; trial < NUM_TRIALS; trial++) { 
+            double start = get_time_seconds(); 
+            for(int i = 0; i < n; i++) sink += ph_key_hash_with(kernel, keys[i], len); 
+            double elapsed = get_time_seconds() - start; 
+            if(trial >= 0) ns[trial] = elapsed / n * 1e9; 
+        }
+        double median = calc_median(ns, NUM_TRIALS); 
+        printf("  %-8s %.2f ns/key  %.2f GB/s\n", ph_key_hash_kernel_name(kernel), median, len / median); 
+    }
+    if(sink == 42) printf(" "); // keep the hashes alive
+
+    free_keys(keys, n); 
+}
+
+/** 
+ * @brief 64-bit IDs through ph_build_u64 / ph_lookup_u64 against the same 
+ *        IDs printed as decimal strings through ph_build / ph_lookup: build 
+ *        time, memory and the median lookup ns/key over random probes, half 
+ *        of them misses. 
+ */
+void benchmark_u64(int n) { 
+    printf("========================================\n");
+    printf("u64 keys: %d IDs, integer table vs decimal strings\n", n);
+    printf("========================================\n");
+
+    uint64_t salt = (uint64_t)rand(); 
+    uint64_t *ids = malloc(n * sizeof(uint64_t)); 
+    uint64_t *probes = malloc(n * sizeof(uint64_t)); 
+    char **strings = malloc(n * sizeof(char *)); 
+    char **string_probes = malloc(n * sizeof(char *)); 
+    for(int i = 0; i < n; i++) { 
+        ids[i] = ph_fmix64(i + salt) & ~(uint64_t)1; // odd IDs are never keys 
+        strings[i] = malloc(24); 
+        snprintf(strings[i], 24, "%llu", (unsigned long long)ids[i]); 
+    }
+    for(int i = 0; i < n; i++) { 
+        probes[i] = ids[rand() % n] | (uint64_t)(rand() & 1); 
+        string_probes[i] = malloc(24); 
+        snprintf(string_probes[i], 24, "%llu", (unsigned long long)probes[i]); 
+    }
+
+    double start = get_time_seconds(); 
+    ph_u64_table *t = ph_build_u64(ids, n, 0, NULL); 
+    double u64_build = get_time_seconds() - start; 
+    start = get_time_seconds(); 
+    ph_table *st = ph_build(strings, n, 24, 0, NULL); 
+    double string_build = get_time_seconds() - start; 
+    if(!t || !st) { 
+        printf("Error: build failed\n"); 
+        ph_free_u64(t); 
+        ph_free(st); 
+        free(ids); 
+        free(probes); 
+        free_keys(strings, n); 
+        free_keys(string_probes, n); 
+        return; 
+    }
+
+    double u64_ns[NUM_TRIALS], string_ns[NUM_TRIALS]; 
+    long hits = 0; 
+    for(int trial = -WARMUP_RUNS; trial < NUM_TRIALS; trial++) { 
+        start = get_time_seconds(); 
+        for(int i = 0; i < n; i++) hits += ph_lookup_u64(t, probes[i]) == 0; 
+        double u64_time = get_time_seconds() - start; 
+        start = get_time_seconds(); 
+        for(int i = 0; i < n; i++) hits += ph_lookup(st, string_probes[i]) == 0; 
+        double string_time = get_time_seconds() - start; 
+        if(trial < 0) continue; 
+        u64_ns[trial] = u64_time / n * 1e9; 
+        string_ns[trial] = string_time / n * 1e9; 
+    }
+    if(hits == 42) printf(" "); // keep the lookups alive
+
+    printf("  %-16s build %8.2f ms  %6.1f bytes/key  lookup %6.2f ns/key\n", "ph_lookup_u64:", 
+        u64_build * 1e3, (double)t->mem_bytes / n, calc_median(u64_ns, NUM_TRIALS)); 
+    printf("  %-16s build %8.2f ms  %6.1f bytes/key  lookup %6.2f ns/key (+ the key strings)\n", "ph_lookup:", 
+        string_build * 1e3, (double)st->mem_bytes / n, calc_median(string_ns, NUM_TRIALS)); 
+
+    ph_free_u64(t); 
+    ph_free(st); 
+    free(ids); 
+    free(probes); 
+    free_keys(strings, n); 
+    free_keys(string_probes, n); 
+}
+
+/** 
+ * @brief ns/key of the lookup ph_codegen generated for tests/codegen_keys.txt 
+ *        against runtime tables over the same keys, on n probes of which 
+ *        miss_ratio are random key_len strings. Each is the median over 
+ *        NUM_TRIALS passes. 
+ */
+void benchmark_codegen(int n, int key_len, double miss_ratio) { 
+    printf("========================================\n");
+    printf("Generated lookup: %d compiled-in keys, %d probes, %.0f%% misses\n", 
+        CODEGEN_KEYS_NUM_KEYS, n, miss_ratio * 100);
+    printf("========================================\n");
+
+    // few distinct misses, so that probes stay cached like the keys do 
+    int num_misses = 1024; 
+    char **misses = generate_keys(num_misses, key_len); 
+    const char **probes = malloc(n * sizeof(char *)); 
+    size_t *lens = malloc(n * sizeof(size_t)); 
+    for(int i = 0; i < n; i++) { 
+        int miss = (double)rand() / RAND_MAX < miss_ratio; 
+        probes[i] = miss ? misses[rand() % num_misses] : codegen_keys_keys[rand() % CODEGEN_KEYS_NUM_KEYS]; 
+        lens[i] = strlen(probes[i]); 
+    }
+
+    long sink = 0; 
+    for(int hash_type = 0; hash_type <= 2; hash_type++) { 
+        ph_table *t = ph_build((char **)codegen_keys_keys, CODEGEN_KEYS_NUM_KEYS, 0, hash_type, NULL); 
+        if(!t) { 
+            printf("  ph_lookup, hash type %d:      build failed\n", hash_type); 
+            continue; 
+        }
+        double ns[NUM_TRIALS]; 
+        for(int trial = -WARMUP_RUNS; trial < NUM_TRIALS; trial++) { 
+            double start = get_time_seconds(); 
+            for(int i = 0; i < n; i++) sink += ph_lookup(t, probes[i]); 
+            if(trial >= 0) ns[trial] = (get_time_seconds() - start) / n * 1e9; 
+        }
+        printf("  ph_lookup, hash type %d:      %6.2f ns/key\n", hash_type, calc_median(ns, NUM_TRIALS)); 
+        ph_free(t); 
+    }
+
+    for(int known_len = 0; known_len <= 1; known_len++) { 
+        double ns[NUM_TRIALS]; 
+        for(int trial = -WARMUP_RUNS; trial < NUM_TRIALS; trial++) { 
+            double start = get_time_seconds(); 
+            for(int i = 0; i < n; i++) { 
+                sink += codegen_keys_lookup(probes[i], known_len ? lens[i] : strlen(probes[i])); 
+            }
+            if(trial >= 0) ns[trial] = (get_time_seconds() - start) / n * 1e9; 
+        }
+        printf("  Generated, %-18s %6.2f ns/key\n", known_len ? "length known:" : "with strlen:", 
+            calc_median(ns, NUM_TRIALS)); 
+    }
+    if(sink == 42) printf(" "); // keep the lookups alive
+
+    free(probes); 
+    free(lens); 
+    free_keys(misses, num_misses); 
+}
+
+/** 
+ * @brief ns/key of ph_map_get next to a plain ph_lookup over the same keys, 
+ *        with one 8-byte value per key, and the memory the values add. 
+ */
+void benchmark_map(int n, int key_len, int hash_type) { 
+    printf("========================================\n");
+    printf("Map: hash type %d, %d keys, %d chars per key, 8-byte values\n", hash_type, n, key_len);
+    printf("========================================\n");
+
+    char **keys = generate_keys(n, key_len); 
+    keys = key_set_cleaner(keys, &n); 
+    uint64_t *values = malloc(n * sizeof(uint64_t)); 
+    for(int i = 0; i < n; i++) values[i] = i; 
+
+    ph_map *map = ph_map_build(keys, n, values, sizeof(uint64_t), hash_type); 
+    if(!map) { 
+        printf("Error: build failed\n"); 
+        free(values); 
+        free_keys(keys, n); 
+        return; 
+    }
+    double lookup[NUM_TRIALS], get[NUM_TRIALS]; 
+    uint64_t sum = 0; 
+    for(int trial = -WARMUP_RUNS; trial < NUM_TRIALS; trial++) { 
+        double start = get_time_seconds(); 
+        for(int i = 0; i < n; i++) sum += ph_lookup(map->index, keys[i]); 
+        double lookup_time = get_time_seconds() - start; 
+
+        start = get_time_seconds(); 
+        for(int i = 0; i < n; i++) sum += *(const uint64_t *)ph_map_get(map, keys[i], NULL); 
+        double get_time = get_time_seconds() - start; 
+
+        if(trial < 0) continue; 
+        lookup[trial] = lookup_time / n * 1e9; 
+        get[trial] = get_time / n * 1e9; 
+    }
+    if(sum != (uint64_t)NUM_TRIALS * n * (n - 1) / 2 + (uint64_t)WARMUP_RUNS * n * (n - 1) / 2) { 
+        printf("Error: values do not match\n"); 
+    }
+
+    printf("  ph_lookup:    %.2f ns/key\n", calc_median(lookup, NUM_TRIALS)); 
+    printf("  ph_map_get:   %.2f ns/key\n", calc_median(get, NUM_TRIALS)); 
+    printf("  Index:        %.2f MB\n", calc_mem(map->index) / (1024.0 * 1024.0)); 
+    printf("  Values:       %.2f MB (%zu slots)\n", 
+        map->index->num_slots * sizeof(uint64_t) / (1024.0 * 1024.0), map->index->num_slots); 
+
+    ph_map_free(map); 
+    free(values); 
+    free_keys(keys, n); 
+}
+
+/** 
+ * @brief Median ns/lookup over probes of a scalar ph_lookup loop and of 
+ *        ph_lookup_batch, LOOKUP_BATCH_SIZE keys per call. 
+ * 
+ * @return Number of probes found 
+ */
+static int time_lookups(ph_table *ht, char **probes, int n, double *scalar_ns, double *batch_ns) { 
+    double scalar[NUM_TRIALS], batch[NUM_TRIALS]; 
+    int *results = malloc(n * sizeof(int)); 
+    int hits = 0; 
+
+    for(int trial = -WARMUP_RUNS; trial < NUM_TRIALS; trial++) { 
+        hits = 0; 
+        double start = get_time_seconds(); 
+        for(int i = 0; i < n; i++) hits += ph_lookup(ht, probes[i]) == 0; 
+        double scalar_time = get_time_seconds() - start; 
+
+        start = get_time_seconds(); 
+        for(int base = 0; base < n; base += LOOKUP_BATCH_SIZE) { 
+            int count = (n - base < LOOKUP_BATCH_SIZE) ? n - base : LOOKUP_BATCH_SIZE; 
+            ph_lookup_batch(ht, probes + base, count, results + base); 
+        }
+        double batch_time = get_time_seconds() - start; 
+
+        if(trial < 0) continue; 
+        scalar[trial] = scalar_time / n * 1e9; 
+        batch[trial] = batch_time / n * 1e9; 
+    }
+
+    *scalar_ns = calc_median(scalar, NUM_TRIALS); 
+    *batch_ns = calc_median(batch, NUM_TRIALS); 
+    free(results); 
+    return hits; 
+}
+
+/** 
+ * @brief ns/lookup with no, 8-bit and 16-bit fingerprints when a share 
+ *        miss_ratio of the probes are keys that are not in the table. 
+ */
+void benchmark_fingerprints(int n, int key_len, int hash_type, double miss_ratio) { 
+    printf("========================================\n");
+    printf("Fingerprints: hash type %d, %d keys, %d chars per key, %.0f%% misses\n", 
+        hash_type, n, key_len, miss_ratio * 100);
+    printf("========================================\n");
+
+    char **keys = generate_keys(n, key_len); 
+    keys = key_set_cleaner(keys, &n); 
+    char **absent = generate_keys(n, key_len); // random keys, a hit among them is vanishingly rare
+    char **probes = malloc(n * sizeof(char *)); 
+    for(int i = 0; i < n; i++) { 
+        probes[i] = ((double)rand() / RAND_MAX < miss_ratio) ? absent[i] : keys[rand() % n]; 
+    }
+
+    for(int bits = 0; bits <= 16; bits += 8) { 
+        ph_build_opts_t opts = { .fingerprint_bits = bits }; 
+        ph_table *ht = ph_build_opts(keys, n, hash_type, &opts, NULL); 
+        if(!ht) { 
+            printf("  %2d-bit: build failed\n", bits); 
+            continue; 
+        }
+
+        double scalar_ns, batch_ns; 
+        int hits = time_lookups(ht, probes, n, &scalar_ns, &batch_ns); 
+        printf("  %2d-bit: ph_lookup %6.2f ns  batch %6.2f ns  (%d hits, %.2f MB)\n", bits, 
+            scalar_ns, batch_ns, hits, calc_mem(ht) / (1024.0 * 1024.0)); 
+        ph_free(ht); 
+    }
+
+    free(probes); 
+    free_keys(absent, n); 
+    free_keys(keys, n); 
+}
+
+/** 
+ * @brief ns/lookup of a table pointing at the caller's keys next to one that 
+ *        owns a copy of them (inline short keys, pool in slot order). The 
+ *        probes are separate copies, so neither table shares their memory. 
+ */
+void benchmark_owned_keys(int n, int key_len, int hash_type) { 
+    printf("========================================\n");
+    printf("Owned keys: hash type %d, %d keys, %d chars per key\n", hash_type, n, key_len);
+    printf("========================================\n");
+
+    char **keys = generate_keys(n, key_len); 
+    keys = key_set_cleaner(keys, &n); 
+    char **probes = malloc(n * sizeof(char *)); 
+    for(int i = 0; i < n; i++) probes[i] = strdup(keys[rand() % n]); 
+
+    for(int own = 0; own <= 1; own++) { 
+        ph_build_opts_t opts = { .own_keys = own }; 
+        ph_table *ht = ph_build_opts(keys, n, hash_type, &opts, NULL); 
+        if(!ht) { 
+            printf("  %-8s build failed\n", own ? "owned:" : "pointer:"); 
+            continue; 
+        }
+
+        double scalar_ns, batch_ns; 
+        time_lookups(ht, probes, n, &scalar_ns, &batch_ns); 
+        printf("  %-8s ph_lookup %6.2f ns  batch %6.2f ns  (table %.2f MB)\n", own ? "owned:" : "pointer:", 
+            scalar_ns, batch_ns, calc_mem(ht) / (1024.0 * 1024.0)); 
+        ph_free(ht); 
+    }
+
+    free_keys(probes, n); 
+    free_keys(keys, n); 
+}
+
+/** 
+ * @brief ph_lookup, which measures every probe with strlen, against 
+ *        ph_lookup_n given the probe lengths, on n probes of which half are 
+ *        misses. Each is the median ns/key over NUM_TRIALS passes. 
+ */
+void benchmark_key_lengths(int n, int key_len, int hash_type) { 
+    printf("========================================\n");
+    printf("Key lengths: hash type %d, %d keys, %d chars per key\n", hash_type, n, key_len);
+    printf("========================================\n");
+
+    char **keys = generate_keys(n, key_len); 
+    keys = key_set_cleaner(keys, &n); 
+    char **misses = generate_keys(n, key_len); 
+    char **probes = malloc(n * sizeof(char *)); 
+    size_t *lens = malloc(n * sizeof(size_t)); 
+    for(int i = 0; i < n; i++) { 
+        probes[i] = (rand() & 1) ? keys[rand() % n] : misses[i]; 
+        lens[i] = strlen(probes[i]); 
+    }
+
+    ph_table *ht = ph_build(keys, n, key_len, hash_type, NULL); 
+    if(!ht) { 
+        printf("Error: build failed\n"); 
+        free(probes); 
+        free(lens); 
+        free_keys(misses, n); 
+        free_keys(keys, n); 
+        return; 
+    }
+    double strlen_ns[NUM_TRIALS], len_ns[NUM_TRIALS]; 
+    long hits = 0; 
+    for(int trial = -WARMUP_RUNS; trial < NUM_TRIALS; trial++) { 
+        double start = get_time_seconds(); 
+        for(int i = 0; i < n; i++) hits += ph_lookup(ht, probes[i]) == 0; 
+        double strlen_time = get_time_seconds() - start; 
+        start = get_time_seconds(); 
+        for(int i = 0; i < n; i++) hits += ph_lookup_n(ht, probes[i], lens[i]) == 0; 
+        double len_time = get_time_seconds() - start; 
+        if(trial < 0) continue; 
+        strlen_ns[trial] = strlen_time / n * 1e9; 
+        len_ns[trial] = len_time / n * 1e9; 
+    }
+    if(hits == 42) printf(" "); // keep the lookups alive
+
+    printf("  ph_lookup   %6.2f ns/key\n", calc_median(strlen_ns, NUM_TRIALS)); 
+    printf("  ph_lookup_n %6.2f ns/key\n", calc_median(len_ns, NUM_TRIALS)); 
+
+    ph_free(ht); 
+    free(probes); 
+    free(lens); 
+    free_keys(misses, n); 
+    free_keys(keys, n); 
+}
+
+/** 
+ * @brief Cold start: ph_build against ph_open_mmap of the same table saved 
+ *        with ph_save, then ns/lookup on the built and on the mapped table. 
+ */
+void benchmark_cold_start(int n, int key_len, int hash_type) { 
+    printf("========================================\n");
+    printf("Cold start: hash type %d, %d keys, %d chars per key\n", hash_type, n, key_len);
+    printf("========================================\n");
+
+    char **keys = generate_keys(n, key_len); 
+    keys = key_set_cleaner(keys, &n); 
+    const char *path = "ph_benchmark_table.phm"; 
+
+    double start = get_time_seconds(); 
+    ph_table *built = ph_build(keys, n, key_len, hash_type, NULL); 
+    double build_time = get_time_seconds() - start; 
+    if(!built) { 
+        printf("Error: build failed\n"); 
+        free_keys(keys, n); 
+        return; 
+    }
+
+    start = get_time_seconds(); 
+    int saved = ph_save(built, path); 
+    double save_time = get_time_seconds() - start; 
+
+    start = get_time_seconds(); 
+    ph_table *mapped = (saved == 0) ? ph_open_mmap(path) : NULL; 
+    double open_time = get_time_seconds() - start; 
+    if(!mapped) { 
+        printf("Error: could not save or map %s\n", path); 
+        ph_free(built); 
+        free_keys(keys, n); 
+        return; 
+    }
+
+    // probe with copies, so the built table's compares don't hit its own keys
+    char **probes = malloc(n * sizeof(char *)); 
+    for(int i = 0; i < n; i++) probes[i] = strdup(keys[rand() % n]); 
+
+    double built_ns, mapped_ns, batch_ns; 
+    time_lookups(built, probes, n, &built_ns, &batch_ns); 
+    int hits = time_lookups(mapped, probes, n, &mapped_ns, &batch_ns); 
+    if(hits != n) printf("Error: %d keys not found in the mapped table\n", n - hits); 
+    free_keys(probes, n); 
+
+    printf("  ph_build:      %10.3f ms\n", build_time * 1e3); 
+    printf("  ph_save:       %10.3f ms  (%.2f MB file)\n", save_time * 1e3, mapped->map_bytes / (1024.0 * 1024.0)); 
+    printf("  ph_open_mmap:  %10.3f ms  (%.0fx faster than building)\n", open_time * 1e3, build_time / open_time); 
+    printf("  Lookup built:  %10.2f ns/key\n", built_ns); 
+    printf("  Lookup mapped: %10.2f ns/key\n", mapped_ns); 
+
+    ph_free(mapped); 
+    ph_free(built); 
+    remove(path); 
+    free_keys(keys, n); 
+}
+
+/**
+ * @brief Peak resident set size of this process so far, in MB.
+ */
+static double peak_rss_mb(void) { 
+    struct rusage ru; 
+    getrusage(RUSAGE_SELF, &ru); 
+    return ru.ru_maxrss / 1024.0; // KB on Linux
+}
+
+void benchmark_external(int n, int key_len, int hash_type, size_t budget_mb) { 
+    printf("========================================\n");
+    printf("External build: hash type %d, %d keys, %d chars per key, %zu MB budget\n", hash_type, n, key_len, budget_mb);
+    printf("========================================\n");
+
+    // keys go straight to the file, only a sample is kept in memory to probe with
+    const char *keys_path = "ph_benchmark_keys.txt"; 
+    const char *out_path = "ph_benchmark_table.phs"; 
+    int num_probes = (n < 1000000) ? n : 1000000; 
+    char **probes = malloc(num_probes * sizeof(char *)); 
+    char *key = malloc(key_len); 
+    FILE *f = fopen(keys_path, "w"); 
+    if(!f) { 
+        printf("Error: could not write %s\n", keys_path); 
+        free(key); 
+        free(probes); 
+        return; 
+    }
+    for(int i = 0; i < n; i++) { 
+        for(int j = 0; j < key_len - 1; j++) key[j] = 'a' + rand() % 26; 
+        key[key_len - 1] = '\0'; 
+        fprintf(f, "%s\n", key); 
+        if(i < num_probes) probes[i] = strdup(key); 
+    }
+    fclose(f); 
+    free(key); 
+
+    double rss_before = peak_rss_mb(); 
+    ph_external_opts_t opts = { .memory_budget = budget_mb << 20, .hash_type = hash_type }; 
+    ph_external_stats_t stats; 
+    double start = get_time_seconds(); 
+    int rc = ph_build_external_file(keys_path, out_path, &opts, &stats); 
+    double build_time = get_time_seconds() - start; 
+    double rss_after = peak_rss_mb(); 
+    remove(keys_path); 
+
+    start = get_time_seconds(); 
+    ph_sharded_table *st = (rc == 0) ? ph_open_sharded(out_path) : NULL; 
+    double open_time = get_time_seconds() - start; 
+    if(!st) { 
+        printf("Error: external build or open of %s failed\n", out_path); 
+        free_keys(probes, num_probes); 
+        return; 
+    }
+
+    // one pass to fault the mapping in, then the timed pass
+    int hits = 0; 
+    for(int i = 0; i < num_probes; i++) ph_sharded_lookup(st, probes[i]); 
+    start = get_time_seconds(); 
+    for(int i = 0; i < num_probes; i++) hits += (ph_sharded_lookup(st, probes[(size_t)i * 7919 % num_probes]) == 0); 
+    double lookup_ns = (get_time_seconds() - start) * 1e9 / num_probes; 
+    if(hits != num_probes) printf("Error: %d probes not found\n", num_probes - hits); 
+
+    printf("  Build:         %10.3f s  (%zu keys, %zu duplicates dropped)\n", build_time, stats.keys_read, stats.duplicates); 
+    printf("  Shards:        %10zu    (directory depth %d, largest %zu keys)\n", stats.num_shards, stats.depth, stats.max_shard_keys); 
+    printf("  Peak RSS:      %10.1f MB before, %.1f MB after the build\n", rss_before, rss_after); 
+    printf("  File:          %10.2f MB\n", st->map_bytes / (1024.0 * 1024.0)); 
+    printf("  Open:          %10.3f ms\n", open_time * 1e3); 
+    printf("  Lookup:        %10.2f ns/key\n", lookup_ns); 
+
+    ph_sharded_free(st); 
+    remove(out_path); 
+    free_keys(probes, num_probes); 
+}
+
+void benchmark_dynamic(int n, int key_len, int hash_type) { 
+    printf("========================================\n");
+    printf("Dynamic updates: hash type %d, %d keys, %d chars per key\n", hash_type, n, key_len);
+    printf("========================================\n");
+
+    // the first n keys are built, the next n are inserted one at a time
+    int total = 2 * n; 
+    char **keys = generate_keys(total, key_len); 
+    keys = key_set_cleaner(keys, &total); 
+    int extra = total - n; 
+
+    double start = get_time_seconds(); 
+    ph_table *ht = ph_build(keys, n, key_len, hash_type, NULL); 
+    double build_time = get_time_seconds() - start; 
+    if(!ht) { 
+        printf("Error: build failed\n"); 
+        free_keys(keys, total); 
+        return; 
+    }
+
+    double before_ns, after_ns, batch_ns; 
+    time_lookups(ht, keys, n, &before_ns, &batch_ns); 
+
+    start = get_time_seconds(); 
+    for(int i = n; i < total; i++) { 
+        if(ph_insert(ht, keys[i]) != 0) printf("Error: insert of key %d failed\n", i); 
+    }
+    double insert_ns = (get_time_seconds() - start) * 1e9 / extra; 
+
+    int hits = time_lookups(ht, keys + n, extra, &after_ns, &batch_ns); 
+    if(hits != extra) printf("Error: %d inserted keys not found\n", extra - hits); 
+
+    start = get_time_seconds(); 
+    for(int i = 0; i < n; i++) { 
+        if(ph_delete(ht, keys[i]) != 0) printf("Error: delete of key %d failed\n", i); 
+    }
+    double delete_ns = (get_time_seconds() - start) * 1e9 / n; 
+
+    printf("  Full ph_build:  %10.3f ms  (cost of one update without ph_insert)\n", build_time * 1e3); 
+    printf("  ph_insert:      %10.2f ns/key (amortized over %d inserts)\n", insert_ns, extra); 
+    printf("  ph_delete:      %10.2f ns/key (amortized over %d deletes)\n", delete_ns, n); 
+    printf("  Lookup:         %10.2f ns/key before, %.2f ns/key after the inserts\n", before_ns, after_ns); 
+
+    ph_free(ht); 
+    free_keys(keys, total); 
+}
+
+typedef struct { 
+    ph_handle *h; 
+    char **keys; 
+    int n; 
+    int samples; 
+    double *latency_ns; // samples entries
+    unsigned int rng; 
+} swap_reader_arg_t; 
+
+static void *swap_reader_thread(void *arg) { 
+    swap_reader_arg_t *r = arg; 
+    int id = ph_handle_register(r->h); 
+    if(id < 0) return NULL; 
+
+    for(int i = 0; i < r->samples; i++) { 
+        const char *key = r->keys[rand_r(&r->rng) % r->n]; 
+        double start = get_time_seconds(); 
+        ph_handle_lookup(r->h, id, key); 
+        r->latency_ns[i] = (get_time_seconds() - start) * 1e9; 
+    }
+    ph_handle_unregister(r->h, id); 
+    return NULL; 
+}
+
+typedef struct { 
+    ph_handle *h; 
+    char **keys; 
+    int n; 
+    int key_len; 
+    int hash_type; 
+    atomic_int stop; 
+    int swaps; 
+} swap_writer_arg_t; 
+
+static void *swap_writer_thread(void *arg) { 
+    swap_writer_arg_t *w = arg; 
+    while(!atomic_load(&w->stop)) { 
+        ph_table *fresh = ph_build(w->keys, w->n, w->key_len, w->hash_type, NULL); 
+        if(!fresh) break; 
+        ph_handle_swap(w->h, fresh); 
+        w->swaps++; 
+    }
+    return NULL; 
+}
+
+/**
+ * @brief Runs num_readers threads of samples timed lookups each, with a
+ *        writer rebuilding and swapping the table throughout when
+ *        with_writer is set, and prints the latency percentiles.
+ */
+static void run_swap_phase(ph_handle *h, char **keys, int n, int key_len, int hash_type, int num_readers,
+    int samples, int with_writer) { 
+
+    pthread_t readers[64], writer; 
+    swap_reader_arg_t args[64]; 
+    swap_writer_arg_t w = { h, keys, n, key_len, hash_type, 0, 0 }; 
+    double *latency = malloc(sizeof(double) * (size_t)samples * num_readers); 
+    if(!latency) { 
+        printf("Error: out of memory\n"); 
+        return; 
+    }
+
+    int writing = with_writer && pthread_create(&writer, NULL, swap_writer_thread, &w) == 0; 
+    int started = 0; 
+    while(writing == with_writer && started < num_readers) { 
+        args[started] = (swap_reader_arg_t){ h, keys, n, samples, latency + (size_t)started * samples, 1234u + started }; 
+        if(pthread_create(&readers[started], NULL, swap_reader_thread, &args[started]) != 0) break; 
+        started++; 
+    }
+    for(int r = 0; r < started; r++) pthread_join(readers[r], NULL); 
+    if(writing) { 
+        atomic_store(&w.stop, 1); 
+        pthread_join(writer, NULL); 
+    }
+    if(writing != with_writer || started < num_readers) { 
+        printf("Error: could not start the %s thread\n", (writing != with_writer) ? "writer" : "reader"); 
+        free(latency); 
+        return; 
+    }
+
+    size_t total = (size_t)samples * num_readers; 
+    printf("  %-14s p50 %7.1f ns  p99 %7.1f ns  max %10.1f ns", 
+        with_writer ? "During swaps:" : "No writer:", 
+        calc_percentile(latency, total, 50), calc_percentile(latency, total, 99), calc_max(latency, total)); 
+    if(with_writer) printf("  (%d swaps)", w.swaps); 
+    printf("\n"); 
+    free(latency); 
+}
+
+void benchmark_swap(int n, int key_len, int hash_type, int num_readers) { 
+    printf("========================================\n");
+    printf("Handle swap: hash type %d, %d keys, %d chars per key, %d readers\n", hash_type, n, key_len, num_readers);
+    printf("========================================\n");
+
+    if(num_readers < 1 || num_readers > 64) num_readers = 2; 
+    char **keys = generate_keys(n, key_len); 
+    keys = key_set_cleaner(keys, &n); 
+    ph_table *ht = ph_build(keys, n, key_len, hash_type, NULL); 
+    ph_handle *h = ht ? ph_handle_create(ht, num_readers) : NULL; 
+    if(!h) { 
+        printf("Error: could not build the table\n"); 
+        ph_free(ht); 
+        free_keys(keys, n); 
+        return; 
+    }
+
+    int samples = 2000000; 
+    run_swap_phase(h, keys, n, key_len, hash_type, num_readers, samples, 0); 
+    run_swap_phase(h, keys, n, key_len, hash_type, num_readers, samples, 1); 
+
+    ph_handle_free(h); 
+    free_keys(keys, n); 
+}
+
+#define THROUGHPUT_PROBES (1 << 18) // probe indices per thread, replayed in a loop
+#define THROUGHPUT_CHUNK 1024 // lookups between checks of the stop flag
+
+/**
+ * @brief Draws count key indices in [0, n): uniformly when cdf is NULL,
+ *        else by inverting cdf (the Zipf distribution over ranks) and
+ *        mapping rank r to key rank_to_key[r], so the hot keys are spread
+ *        over the table instead of being its first slots.
+ */
+static void draw_probes(uint32_t *probes, size_t count, int n, const double *cdf, const uint32_t *rank_to_key,
+    unsigned int seed) {
+
+    for(size_t i = 0; i < count; i++) { 
+        if(!cdf) { 
+            probes[i] = (uint32_t)(rand_r(&seed) % n); 
+            continue; 
+        }
+        double u = (double)rand_r(&seed) / ((double)RAND_MAX + 1.0); 
+        size_t lo = 0, hi = (size_t)n - 1; 
+        while(lo < hi) { 
+            size_t mid = lo + (hi - lo) / 2; 
+            if(cdf[mid] < u) lo = mid + 1; 
+            else hi = mid; 
+        }
+        probes[i] = rank_to_key[lo]; 
+    }
+}
+
+typedef struct { 
+    ph_table *ht; 
+    char **keys; 
+    const uint32_t *probes; // THROUGHPUT_PROBES entries
+    int cpu; // pinned to this CPU, -1 for none
+    pthread_barrier_t *start; 
+    atomic_int *stop; 
+    unsigned long long lookups; 
+    double seconds; 
+    long hits; 
+} throughput_arg_t; 
+
+static void *throughput_thread(void *arg) { 
+    throughput_arg_t *a = arg; 
+#ifdef __linux__
+    if(a->cpu >= 0) { 
+        cpu_set_t set; 
+        CPU_ZERO(&set); 
+        CPU_SET(a->cpu, &set); 
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set); 
+    }
+#endif
+    pthread_barrier_wait(a->start); 
+
+    // counted in locals: the args sit side by side, so writing them per 
+    // lookup would bounce one cache line between the threads 
+    double start = get_time_seconds(); 
+    size_t next = 0; 
+    unsigned long long lookups = 0; 
+    long hits = 0; 
+    while(!atomic_load_explicit(a->stop, memory_order_relaxed)) { 
+        for(int i = 0; i < THROUGHPUT_CHUNK; i++) { 
+            hits += ph_lookup(a->ht, a->keys[a->probes[next]]) == 0; 
+            next = (next + 1) & (THROUGHPUT_PROBES - 1); 
+        }
+        lookups += THROUGHPUT_CHUNK; 
+    }
+    a->seconds = get_time_seconds() - start; 
+    a->lookups = lookups; 
+    a->hits = hits; 
+    return NULL; 
+}
+
+/**
+ * @brief Runs num_threads lookup threads over ht for seconds and prints the
+ *        aggregate and per-thread Mops/s, and the scaling efficiency against
+ *        single_mops (the 1 thread rate; 0 when this is that run).
+ *
+ * @return The aggregate Mops/s
+ */
+static double run_throughput(ph_table *ht, char **keys, uint32_t **probes, int num_threads, double seconds,
+    int num_cpus, double single_mops) { 
+
+    pthread_t *threads = malloc(num_threads * sizeof(pthread_t)); 
+    throughput_arg_t *args = calloc(num_threads, sizeof(throughput_arg_t)); 
+    double *rates = malloc(num_threads * sizeof(double)); 
+    pthread_barrier_t start; 
+    atomic_int stop = 0; 
+    pthread_barrier_init(&start, NULL, num_threads + 1); 
+
+    for(int t = 0; t < num_threads; t++) { 
+        args[t] = (throughput_arg_t){ .ht = ht, .keys = keys, .probes = probes[t], 
+            .cpu = num_cpus > 0 ? t % num_cpus : -1, .start = &start, .stop = &stop }; 
+        pthread_create(&threads[t], NULL, throughput_thread, &args[t]); 
+    }
+    pthread_barrier_wait(&start); 
+    struct timespec duration = { (time_t)seconds, (long)((seconds - (time_t)seconds) * 1e9) }; 
+    nanosleep(&duration, NULL); 
+    atomic_store(&stop, 1); 
+
+    double total = 0; 
+    long hits = 0; 
+    for(int t = 0; t < num_threads; t++) { 
+        pthread_join(threads[t], NULL); 
+        rates[t] = args[t].lookups / args[t].seconds / 1e6; 
+        total += rates[t]; 
+        hits += args[t].hits; 
+    }
+    if(hits == 42) printf(" "); // keep the lookups alive
+
+    double efficiency = single_mops > 0 ? total / (num_threads * single_mops) : 1.0; 
+    printf("  %3d threads  %9.2f Mops/s  per thread min %7.2f  median %7.2f  max %7.2f  efficiency %5.1f%%\n", 
+        num_threads, total, calc_min(rates, num_threads), calc_median(rates, num_threads), 
+        calc_max(rates, num_threads), 100.0 * efficiency); 
+
+    pthread_barrier_destroy(&start); 
+    free(threads); 
+    free(args); 
+    free(rates); 
+    return total; 
+}
+
+/**
+ * @brief The thread count after threads: doubled, capped at max_threads.
+ */
+static int next_thread_count(int threads, int max_threads) { 
+    if(threads == max_threads) return max_threads + 1; 
+    return (threads * 2 > max_threads) ? max_threads : threads * 2; 
+}
+
+/**
+ * @brief Lookup throughput of one table from 1, 2, 4, ... max_threads
+ *        threads, each pinned to its own CPU (wrapping when there are more
+ *        threads than CPUs), for seconds per run. Probes are drawn
+ *        uniformly and then from a Zipf distribution with exponent zipf_s
+ *        over a random ranking of the keys. Every probe is a hit.
+ */
+void benchmark_throughput(int n, int key_len, int hash_type, int max_threads, double seconds, double zipf_s) { 
+    printf("========================================\n");
+    printf("Throughput: hash type %d, %d keys, %d chars per key, up to %d threads, %.1f s per run\n", 
+        hash_type, n, key_len, max_threads, seconds);
+    printf("========================================\n");
+
+    if(max_threads < 1) max_threads = 1; 
+    char **keys = generate_keys(n, key_len); 
+    keys = key_set_cleaner(keys, &n); 
+    ph_table *ht = ph_build(keys, n, key_len, hash_type, NULL); 
+    if(!ht) { 
+        printf("Error: build failed\n"); 
+        free_keys(keys, n); 
+        return; 
+    }
+
+    int num_cpus = -1; 
+#ifdef __linux__
+    num_cpus = (int)sysconf(_SC_NPROCESSORS_ONLN); 
+#endif
+    if(num_cpus > 0) printf("  %d CPUs online, thread t pinned to CPU t %% %d\n", num_cpus, num_cpus); 
+    else printf("  threads are not pinned on this platform\n"); 
+
+    // Zipf over ranks: P(rank r) proportional to 1 / (r + 1)^s
+    double *cdf = malloc(n * sizeof(double)); 
+    uint32_t *rank_to_key = malloc(n * sizeof(uint32_t)); 
+    double sum = 0; 
+    for(int r = 0; r < n; r++) { 
+        sum += 1.0 / pow(r + 1, zipf_s); 
+        cdf[r] = sum; 
+        rank_to_key[r] = (uint32_t)r; 
+    }
+    for(int r = 0; r < n; r++) cdf[r] /= sum; 
+    for(int r = n - 1; r > 0; r--) { 
+        int j = rand() % (r + 1); 
+        uint32_t tmp = rank_to_key[r]; 
+        rank_to_key[r] = rank_to_key[j]; 
+        rank_to_key[j] = tmp; 
+    }
+
+    uint32_t **probes = malloc(max_threads * sizeof(uint32_t *)); 
+    for(int t = 0; t < max_threads; t++) probes[t] = malloc(THROUGHPUT_PROBES * sizeof(uint32_t)); 
+
+    for(int zipf = 0; zipf <= 1; zipf++) { 
+        if(zipf) printf("  Zipf access, s = %.2f:\n", zipf_s); 
+        else printf("  Uniform access:\n"); 
+        for(int t = 0; t < max_threads; t++) { 
+            draw_probes(probes[t], THROUGHPUT_PROBES, n, zipf ? cdf : NULL, rank_to_key, 1234u + t); 
+        }
+
+        double single = 0; 
+        for(int threads = 1; threads <= max_threads; threads = next_thread_count(threads, max_threads)) { 
+            double mops = run_throughput(ht, keys, probes, threads, seconds, num_cpus, single); 
+            if(threads == 1) single = mops; 
+        }
+    }
+
+    for(int t = 0; t < max_threads; t++) free(probes[t]); 
+    free(probes); 
+    free(cdf); 
+    free(rank_to_key); 
+    ph_free(ht); 
+    free_keys(keys, n); 
+}
+
+#define SWEEP_PROBES 1000000 // random hits timed at every size
+
+/** 
+ * @brief Sweeps one dataset from 1k keys up to all of it in steps of about 
+ *        sqrt(10): at each size a table over the first n keys is built and 
+ *        timed, and SWEEP_PROBES random keys among them are looked up 
+ *        (scalar and batched median ns/key). As the table outgrows each 
+ *        cache level and the TLB reach, ns/key steps up. 
+ * 
+ * @param source A generator name (see dataset_kind()) or a file of keys 
+ */
+void benchmark_sweep(int max_n, int key_len, const char *source, int hash_type) { 
+    int kind = dataset_kind(source); 
+    double start = get_time_seconds(); 
+    dataset_t *d = (kind >= 0) ? dataset_generate(kind, max_n, key_len, (uint64_t)rand() + 1) : dataset_load(source); 
+    double load_time = get_time_seconds() - start; 
+    if(!d || d->n == 0) { 
+        printf("Error: no keys from '%s'\n", source); 
+        dataset_free(d); 
+        return; 
+    }
+    if(kind < 0 && d->n > (size_t)max_n) d->n = max_n; 
+    size_t chars = 0; 
+    for(size_t i = 0; i < d->n; i++) chars += strlen(d->keys[i]); 
+
+    printf("========================================\n");
+    printf("Sweep: hash type %d, %s keys, up to %zu keys (%.1f chars on average)\n", hash_type, 
+        kind >= 0 ? dataset_name(kind) : source, d->n, (double)chars / d->n);
+    printf("========================================\n");
+    printf("  dataset ready in %.2f s (deduplicated)\n", load_time); 
+    printf("  %12s %14s %10s %12s %12s\n", "keys", "build ns/key", "bytes/key", "lookup ns", "batch ns"); 
+
+    char **probes = malloc(SWEEP_PROBES * sizeof(char *)); 
+    for(double step = 1000; ; step *= 3.1622776601683795) { 
+        size_t n = (size_t)(step + 0.5); 
+        if(n > d->n) n = d->n; 
+
+        start = get_time_seconds(); 
+        ph_table *ht = ph_build(d->keys, n, key_len, hash_type, NULL); 
+        double build_time = get_time_seconds() - start; 
+        if(!ht) { 
+            printf("  %12zu build failed\n", n); 
+            break; 
+        }
+        for(int i = 0; i < SWEEP_PROBES; i++) probes[i] = d->keys[(size_t)rand() % n]; 
+
+        double scalar_ns, batch_ns; 
+        int hits = time_lookups(ht, probes, SWEEP_PROBES, &scalar_ns, &batch_ns); 
+        if(hits != SWEEP_PROBES) printf("Error: %d keys not found\n", SWEEP_PROBES - hits); 
+        printf("  %12zu %14.1f %10.1f %12.2f %12.2f\n", n, build_time * 1e9 / n, (double)calc_mem(ht) / n, 
+            scalar_ns, batch_ns); 
+        ph_free(ht); 
+        if(n == d->n) break; 
+    }
+
+    free(probes); 
+    dataset_free(d); 
+}
+
+/**
+ * @brief Build time percentiles over repeated builds of one key set, with 
+ *        the default FKS build and with a tight attempt cap plus a bits per 
+ *        key budget. 
+ */
+void benchmark_build_bounds(int n, int key_len, int hash_type, double bits_per_key) { 
+    printf("========================================\n");
+    printf("Build bounds: hash type %d, %d keys, %d chars per key\n", hash_type, n, key_len);
+    printf("========================================\n");
+
+    char **keys = generate_keys(n, key_len); 
+    keys = key_set_cleaner(keys, &n); 
+
+    int builds = 30; 
+    double *times = malloc(sizeof(double) * builds); 
+    ph_build_opts_t configs[2] = { 
+        { 0 }, 
+        { .max_bucket_attempts = 64, .bits_per_key = bits_per_key }, 
+    };
+    const char *names[2] = { "Default:", "Bounded:" }; 
+
+    for(int c = 0; c < 2; c++) { 
+        double bits = 0; 
+        int draws = 0, loosened = 0, failed = 0; 
+        for(int i = 0; i < builds; i++) { 
+            build_metrics_t metrics; 
+            double start = get_time_seconds(); 
+            ph_table *t = ph_build_opts(keys, n, hash_type, &configs[c], &metrics); 
+            times[i] = (get_time_seconds() - start) * 1e3; 
+            if(!t) { 
+                failed++; 
+                continue; 
+            }
+            bits += 8.0 * (t->mem_bytes) / n; 
+            draws += metrics.level1_draws; 
+            loosened += metrics.loosened_buckets; 
+            ph_free(t); 
+        }
+        int built = builds - failed; 
+        printf("  %-9s p50 %8.2f ms  p99 %8.2f ms  max %8.2f ms  %6.1f bits/key  %.2f level 1 draws  %.1f loosened buckets", 
+            names[c], calc_percentile(times, builds, 50), calc_percentile(times, builds, 99), calc_max(times, builds), 
+            built ? bits / built : 0, built ? (double)draws / built : 0, built ? (double)loosened / built : 0); 
+        if(failed) printf("  (%d over budget)", failed); 
+        printf("\n"); 
+    }
+
+    free(times); 
+    free_keys(keys, n); 
+}
+
+#define NUM_PH_ROWS 3 // hash types 0-2, then the baselines
+
+/**
+ * @brief Builds row's structure: a ph_table of hash type row, or baseline 
+ *        row - NUM_PH_ROWS. 
+ */
+static void *build_row(int row, char **keys, int n, int key_len) { 
+    if(row < NUM_PH_ROWS) return ph_build(keys, n, key_len, row, NULL); 
+    return baselines[row - NUM_PH_ROWS].build(keys, (size_t)n); 
+}
+
+/**
+ * @brief Seconds per lookup of the n probes in row's structure t, and how many hit. 
+ */
+static double time_row_lookups(int row, const void *t, char **probes, int n, int *hits) { 
+    *hits = 0; 
+    double start = get_time_seconds(); 
+    if(row < NUM_PH_ROWS) { 
+        for(int i = 0; i < n; i++) *hits += ph_lookup((ph_table *)t, probes[i]) == 0; 
+    } else { 
+        int (*lookup)(const void *, const char *) = baselines[row - NUM_PH_ROWS].lookup; 
+        for(int i = 0; i < n; i++) *hits += lookup(t, probes[i]) == 0; 
+    }
+    return (get_time_seconds() - start) / n; 
+}
+
+/** 
+ * @brief ph_* next to the structures it would replace: a linear probe table, 
+ *        a Swiss table, a sorted array and a chained table. Every structure 
+ *        is built over the same key set in each trial and probed with the 
+ *        keys (hits) and as many fresh keys (misses); the report gives the 
+ *        medians over NUM_TRIALS trials. 
+ */
+void benchmark_baselines(int n, int key_len) { 
+    enum { NUM_ROWS = NUM_PH_ROWS + NUM_BASELINES }; 
+    static const char *ph_names[NUM_PH_ROWS] = { "PH (n^2)", "MPH (FKS)", "MPH (displace)" }; 
+    printf("========================================\n");
+    printf("Baselines: %d keys, %d chars per key\n", n, key_len);
+    printf("========================================\n");
+
+    double *build = malloc(sizeof(double) * NUM_ROWS * NUM_TRIALS); 
+    double *hit = malloc(sizeof(double) * NUM_ROWS * NUM_TRIALS); 
+    double *miss = malloc(sizeof(double) * NUM_ROWS * NUM_TRIALS); 
+    double *bytes = malloc(sizeof(double) * NUM_ROWS * NUM_TRIALS); 
+
+    for(int trial = -WARMUP_RUNS; trial < NUM_TRIALS; trial++) { 
+        int count = n; 
+        char **keys = key_set_cleaner(generate_keys(n, key_len), &count); 
+        char **absent = generate_keys(count, key_len); 
+
+        for(int row = 0; row < NUM_ROWS; row++) { 
+            double start = get_time_seconds(); 
+            void *t = build_row(row, keys, count, key_len); 
+            double build_time = get_time_seconds() - start; 
+            if(!t) { 
+                printf("Error: could not build row %d\n", row); 
+                continue; 
+            }
+
+            int hits, false_hits; 
+            double hit_time = time_row_lookups(row, t, keys, count, &hits); 
+            double miss_time = time_row_lookups(row, t, absent, count, &false_hits); 
+            if(hits != count) printf("Error: %d of %d keys not found in row %d\n", count - hits, count, row); 
+            size_t mem = (row < NUM_PH_ROWS) ? calc_mem(t) : baselines[row - NUM_PH_ROWS].memory(t); 
+
+            if(row < NUM_PH_ROWS) ph_free(t); 
+            else baselines[row - NUM_PH_ROWS].destroy(t); 
+            if(trial < 0) continue; 
+            size_t at = (size_t)row * NUM_TRIALS + trial; 
+            build[at] = build_time * 1e3; 
+            hit[at] = hit_time * 1e9; 
+            miss[at] = miss_time * 1e9; 
+            bytes[at] = (double)mem / count; 
+        }
+        free_keys(absent, count); 
+        free_keys(keys, count); 
+    }
+
+    printf("  %-15s %10s %10s %10s %10s\n", "structure", "build ms", "hit ns", "miss ns", "bytes/key"); 
+    for(int row = 0; row < NUM_ROWS; row++) { 
+        size_t at = (size_t)row * NUM_TRIALS; 
+        printf("  %-15s %10.2f %10.1f %10.1f %10.1f\n", 
+            (row < NUM_PH_ROWS) ? ph_names[row] : baselines[row - NUM_PH_ROWS].name, 
+            calc_median(build + at, NUM_TRIALS), calc_median(hit + at, NUM_TRIALS), 
+            calc_median(miss + at, NUM_TRIALS), calc_median(bytes + at, NUM_TRIALS)); 
+    }
+
+    free(build); 
+    free(hit); 
+    free(miss); 
+    free(bytes); 
+}
+
+/** 
+ * @brief Lookups on one key set's table with its storage in malloc() memory 
+ *        and in arenas of 4 KB pages, transparent huge pages and MAP_HUGETLB 
+ *        pages. Keys are owned, so the key pool is in the table's storage 
+ *        too. Reports how much of each table huge pages back, scalar and 
+ *        batched ns/key, single lookup percentiles and dTLB misses per lookup. 
+ */
+void benchmark_huge_pages(int n, int key_len, int hash_type) { 
+    static const char *names[4] = { "malloc", "arena 4K", "arena THP", "arena hugetlb" }; 
+    static const int backings[4] = { -1, PH_ARENA_PAGES, PH_ARENA_THP, PH_ARENA_HUGETLB }; 
+    printf("========================================\n");
+    printf("Table storage: hash type %d, %d keys, %d chars per key, owned keys\n", hash_type, n, key_len);
+    printf("========================================\n");
+
+    char **keys = generate_keys(n, key_len); 
+    keys = key_set_cleaner(keys, &n); 
+    printf("  %-14s %9s %9s %9s %9s %9s %9s %10s\n", "storage", "table MB", "huge MB", "ns/key", "batch", 
+        "p50 ns", "p99 ns", "dTLB/key"); 
+
+    int fell_back = 0; 
+    for(int v = 0; v < 4; v++) { 
+        ph_arena_t *arena = (backings[v] >= 0) ? ph_arena_create(backings[v], 0) : NULL; 
+        ph_allocator_t alloc = arena ? ph_arena_allocator(arena) : (ph_allocator_t){ 0 }; 
+        ph_build_opts_t opts = { .own_keys = 1, .seed = 42, .allocator = arena ? &alloc : NULL }; 
+        ph_table *ht = ph_build_opts(keys, n, hash_type, &opts, NULL); 
+        if(!ht) { 
+            printf("  %-14s build failed\n", names[v]); 
+            ph_arena_destroy(arena); 
+            continue; 
+        }
+
+        double scalar_ns, batch_ns; 
+        time_lookups(ht, keys, n, &scalar_ns, &batch_ns); 
+
+        histogram_t *latency = malloc(2 * sizeof(histogram_t)); 
+        hist_init(&latency[0]); 
+        hist_init(&latency[1]); 
+        time_single_lookups(ht, keys, n, key_len, &latency[0], &latency[1]); 
+
+        // dTLB misses of one scalar pass over the keys 
+        perf_group_t group; 
+        perf_counts_t before, after; 
+        perf_group_open(&group); 
+        perf_group_read(&group, &before); 
+        int hits = 0; 
+        for(int i = 0; i < n; i++) hits += ph_lookup(ht, keys[i]) == 0; 
+        perf_group_read(&group, &after); 
+        perf_group_close(&group); 
+        if(hits != n) printf("Error: %d of %d keys not found\n", n - hits, n); 
+
+        char huge[32] = "-"; 
+        if(arena) snprintf(huge, sizeof(huge), "%.1f", ph_arena_huge_bytes(arena) / 1048576.0); 
+        if(arena && backings[v] == PH_ARENA_HUGETLB && arena->regions->backing != PH_ARENA_HUGETLB) fell_back = 1; 
+        printf("  %-14s %9.1f %9s %9.1f %9.1f %9.1f %9.1f", names[v], ht->mem_bytes / 1048576.0, huge, 
+            scalar_ns, batch_ns, hist_percentile(&latency[0], 50) / ticks_per_ns(), 
+            hist_percentile(&latency[0], 99) / ticks_per_ns()); 
+        if(before.counts[PERF_DTLB_MISSES] >= 0 && after.counts[PERF_DTLB_MISSES] >= 0) { 
+            printf(" %10.3f\n", (after.counts[PERF_DTLB_MISSES] - before.counts[PERF_DTLB_MISSES]) / n); 
+        } else { 
+            printf(" %10s\n", "n/a"); 
+        }
+
+        free(latency); 
+        ph_free(ht); 
+        ph_arena_destroy(arena); 
+    }
+    if(fell_back) printf("  (no reserved huge pages for MAP_HUGETLB, the hugetlb arena used THP; see vm.nr_hugepages)\n"); 
+    free_keys(keys, n); 
+}
+
+static void usage(const char *prog) { 
+    printf("Usage: %s [num_keys] [key_len] [mode] [mode args] [--out results.json|results.csv]\n", prog); 
+    printf("Modes:\n"); 
+    printf("  (none)                    benchmark every hash type; --out also writes every trial as JSON or CSV\n"); 
+    printf("  build-threads [max]       build time vs thread count (default max 8)\n"); 
+    printf("  batch                     scalar vs batched lookup ns/key (use 1M+ keys)\n"); 
+    printf("  hash                      ns/key of each key hash kernel\n"); 
+    printf("  map                       ph_map_get vs ph_lookup ns/key\n"); 
+    printf("  fingerprint [miss_ratio]  lookups with 0/8/16-bit fingerprints (default 0.9 misses)\n"); 
+    printf("  owned                     lookups against caller keys vs an owned key pool\n"); 
+    printf("  lengths                   ph_lookup (strlen) vs ph_lookup_n with known lengths\n"); 
+    printf("  mmap                      ph_build vs ph_save + ph_open_mmap cold start\n"); 
+    printf("  throughput [threads] [s] [zipf]  Mops/s from 1..threads pinned threads, uniform and Zipf (default 8, 1 s, 0.99)\n"); 
+    printf("  swap [readers]            lookup latency percentiles while a writer swaps rebuilt tables\n"); 
+    printf("  dynamic                   ph_insert / ph_delete ns/key vs a full rebuild\n"); 
+    printf("  external [budget_mb]      streaming sharded build from a keys file (default 64 MB)\n"); 
+    printf("  u64                       ph_lookup_u64 on 64-bit IDs vs ph_lookup on them as strings\n"); 
+    printf("  codegen [miss_ratio]      generated lookup vs ph_lookup on the compiled-in key set (default 0.5 misses)\n"); 
+    printf("  sweep [dataset] [type]    build and lookup from 1k keys up to num_keys, dataset random/url/uuid/varlen/prefix or a file\n"); 
+    printf("  baselines                 ph_* vs linear probe, Swiss, sorted array and chained tables on the same keys\n"); 
+    printf("  hugepages [type]          lookups with table storage in malloc, 4K, THP and hugetlb arenas (default type 1)\n"); 
+    printf("  bounds [bits_per_key]     build time percentiles, default vs bounded FKS builds (default 0, no budget)\n"); 
+}
+
 int main(int argc, char *argv[]) { 
-    if(argc != 3) { 
-        printf("Invalid num of args"); 
+    // --out path may come anywhere after the key length, and is taken out of argv
+    const char *out_path = NULL; 
+    for(int i = 3; i < argc; i++) { 
+        if(strcmp(argv[i], "--out") != 0) continue; 
+        if(i + 1 >= argc) { 
+            usage(argv[0]); 
+            return 1; 
+        }
+        out_path = argv[i + 1]; 
+        for(int j = i; j + 2 < argc; j++) argv[j] = argv[j + 2]; 
+        argc -= 2; 
+        break; 
+    }
+    if(argc < 3) { 
+        usage(argv[0]); 
         return 0; 
     }
     srand(time(NULL)); 
     int n = atoi(argv[1]); 
     int key_len = atoi(argv[2]); 
 
+    if(argc >= 4) { 
+        if(out_path) fprintf(stderr, "Note: --out records the default mode only, %s is not written\n", out_path); 
+        if(strcmp(argv[3], "build-threads") == 0) { 
+            int max_threads = (argc >= 5) ? atoi(argv[4]) : 8; 
+            benchmark_build_scaling(n, key_len, 0, max_threads); 
+            benchmark_build_scaling(n, key_len, 1, max_threads); 
+            return 0; 
+        }
+        if(strcmp(argv[3], "batch") == 0) { 
+            for(int hash_type = 0; hash_type <= 2; hash_type++) benchmark_batch_lookup(n, key_len, hash_type); 
+            return 0; 
+        }
+        if(strcmp(argv[3], "map") == 0) { 
+            for(int hash_type = 0; hash_type <= 2; hash_type++) benchmark_map(n, key_len, hash_type); 
+            return 0; 
+        }
+        if(strcmp(argv[3], "fingerprint") == 0) { 
+            double miss_ratio = (argc >= 5) ? atof(argv[4]) : 0.9; 
+            for(int hash_type = 0; hash_type <= 2; hash_type++) { 
+                benchmark_fingerprints(n, key_len, hash_type, miss_ratio); 
+            }
+            return 0; 
+        }
+        if(strcmp(argv[3], "owned") == 0) { 
+            for(int hash_type = 0; hash_type <= 2; hash_type++) benchmark_owned_keys(n, key_len, hash_type); 
+            return 0; 
+        }
+        if(strcmp(argv[3], "lengths") == 0) { 
+            for(int hash_type = 0; hash_type <= 2; hash_type++) benchmark_key_lengths(n, key_len, hash_type); 
+            return 0; 
+        }
+        if(strcmp(argv[3], "mmap") == 0) { 
+            for(int hash_type = 0; hash_type <= 2; hash_type++) benchmark_cold_start(n, key_len, hash_type); 
+            return 0; 
+        }
+        if(strcmp(argv[3], "throughput") == 0) { 
+            int max_threads = (argc > 4) ? atoi(argv[4]) : 8; 
+            double seconds = (argc > 5) ? atof(argv[5]) : 1.0; 
+            double zipf_s = (argc > 6) ? atof(argv[6]) : 0.99; 
+            benchmark_throughput(n, key_len, 0, max_threads, seconds, zipf_s); 
+            return 0; 
+        }
+        if(strcmp(argv[3], "swap") == 0) { 
+            int num_readers = (argc > 4) ? atoi(argv[4]) : 2; 
+            benchmark_swap(n, key_len, 0, num_readers); 
+            return 0; 
+        }
+        if(strcmp(argv[3], "dynamic") == 0) { 
+            for(int hash_type = 0; hash_type <= 1; hash_type++) benchmark_dynamic(n, key_len, hash_type); 
+            return 0; 
+        }
+        if(strcmp(argv[3], "external") == 0) { 
+            size_t budget_mb = (argc > 4) ? (size_t)atol(argv[4]) : 64; 
+            benchmark_external(n, key_len, 0, budget_mb); 
+            return 0; 
+        }
+        if(strcmp(argv[3], "u64") == 0) { 
+            benchmark_u64(n); 
+            return 0; 
+        }
+        if(strcmp(argv[3], "codegen") == 0) { 
+            benchmark_codegen(n, key_len, (argc > 4) ? atof(argv[4]) : 0.5); 
+            return 0; 
+        }
+        if(strcmp(argv[3], "bounds") == 0) { 
+            double bits_per_key = (argc > 4) ? atof(argv[4]) : 0; 
+            for(int hash_type = 0; hash_type <= 1; hash_type++) benchmark_build_bounds(n, key_len, hash_type, bits_per_key); 
+            return 0; 
+        }
+        if(strcmp(argv[3], "sweep") == 0) { 
+            benchmark_sweep(n, key_len, (argc > 4) ? argv[4] : "random", (argc > 5) ? atoi(argv[5]) : 0); 
+            return 0; 
+        }
+        if(strcmp(argv[3], "baselines") == 0) { 
+            benchmark_baselines(n, key_len); 
+            return 0; 
+        }
+        if(strcmp(argv[3], "hugepages") == 0) { 
+            benchmark_huge_pages(n, key_len, (argc > 4) ? atoi(argv[4]) : 1); 
+            return 0; 
+        }
+        if(strcmp(argv[3], "hash") == 0) { 
+            benchmark_hash_kernels(n, key_len); 
+            return 0; 
+        }
+        usage(argv[0]); 
+        return 1; 
+    }
+
+    if(out_path) { 
+        results = results_new(); 
+        if(!results) return 1; 
+    }
     benchmark_ph(n, key_len, 0);
     benchmark_ph(n, key_len, 1); 
+    benchmark_ph(n, key_len, 2); 
+
+    if(results) { 
+        int rc = results_write(results, out_path); 
+        if(rc == 0) printf("\nResults written to %s\n", out_path); 
+        else fprintf(stderr, "Can't write %s\n", out_path); 
+        results_free(results); 
+        return rc ? 1 : 0; 
+    }
     return 0; 
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <linux/perf_event.h>
@@ -13,116 +14,157 @@ static long perf_event_open(struct perf_event_attr *hw_event, pid_t pid,
     return syscall(__NR_perf_event_open, hw_event, pid, cpu, group_fd, flags);
 }
 
-// Setup a single perf counter
-static int setup_counter(uint32_t type, uint64_t config) {
+#define HW_CACHE_READ_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+    const char *name;
+} perf_events[PERF_NUM_EVENTS] = {
+    [PERF_CYCLES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles" },
+    [PERF_INSTRUCTIONS] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instr" },
+    [PERF_LLC_MISSES] = { PERF_TYPE_HW_CACHE, HW_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_LL), "LLC miss" },
+    [PERF_L1D_MISSES] = { PERF_TYPE_HW_CACHE, HW_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D), "L1D miss" },
+    [PERF_DTLB_MISSES] = { PERF_TYPE_HW_CACHE, HW_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB), "dTLB miss" },
+    [PERF_BRANCH_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "br miss" },
+};
+
+// Setup a counter of the calling thread, in group_fd's group (-1 to lead one)
+static int setup_counter(uint32_t type, uint64_t config, int group_fd) {
     struct perf_event_attr pe;
     memset(&pe, 0, sizeof(struct perf_event_attr));
-    
+
     pe.type = type;
     pe.size = sizeof(struct perf_event_attr);
     pe.config = config;
-    pe.disabled = 1;
+    pe.disabled = (group_fd == -1); // members follow the leader
     pe.exclude_kernel = 1;
     pe.exclude_hv = 1;
     pe.exclude_idle = 1;
-    
-    int fd = perf_event_open(&pe, 0, -1, -1, 0);
-    if (fd == -1) {
-        perror("perf_event_open");
-        return -1;
+    pe.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return (int)perf_event_open(&pe, 0, -1, group_fd, 0);
+}
+
+/**
+ * @brief Explains once why there are no counters, with the setting that
+ *        usually blocks them.
+ */
+static void warn_unavailable(int err) {
+    static int warned;
+    if(warned) return;
+    warned = 1;
+
+    int paranoid = -100;
+    FILE *f = fopen("/proc/sys/kernel/perf_event_paranoid", "r");
+    if(f) {
+        if(fscanf(f, "%d", &paranoid) != 1) paranoid = -100;
+        fclose(f);
     }
-    
-    return fd;
+    fprintf(stderr, "Warning: hardware counters unavailable (%s", strerror(err));
+    if(paranoid != -100) fprintf(stderr, ", perf_event_paranoid = %d", paranoid);
+    fprintf(stderr, "), hardware counts are skipped\n");
+    if(paranoid > 2) fprintf(stderr, "Try: sudo sysctl kernel.perf_event_paranoid=2\n");
 }
 
-cache_metrics_t measure_cache_performance(ph_table *ht, char **keys, int n) {
-    cache_metrics_t metrics = {0};
-    
-    // Setup counters
-    int fd_cache_ref = setup_counter(PERF_TYPE_HARDWARE, 
-                                      PERF_COUNT_HW_CACHE_REFERENCES);
-    int fd_cache_miss = setup_counter(PERF_TYPE_HARDWARE, 
-                                       PERF_COUNT_HW_CACHE_MISSES);
-    
-    // L1 data cache - this is more complex, using cache event encoding
-    // PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | 
-    // (PERF_COUNT_HW_CACHE_RESULT_ACCESS << 16)
-    int fd_l1_loads = setup_counter(PERF_TYPE_HW_CACHE, 
-                                     0x0 | (0x0 << 8) | (0x0 << 16));
-    int fd_l1_misses = setup_counter(PERF_TYPE_HW_CACHE, 
-                                      0x0 | (0x0 << 8) | (0x1 << 16));
-    
-    if (fd_cache_ref == -1 || fd_cache_miss == -1) {
-        fprintf(stderr, "Warning: Could not setup cache performance counters\n");
-        fprintf(stderr, "Try running with: sudo or setting /proc/sys/kernel/perf_event_paranoid to -1\n");
-        return metrics;
+int perf_group_open(perf_group_t *g) {
+    memset(g, 0, sizeof(*g));
+    g->leader = -1;
+    int err = 0;
+
+    for(int e = 0; e < PERF_NUM_EVENTS; e++) {
+        g->fds[e] = setup_counter(perf_events[e].type, perf_events[e].config, g->leader);
+        if(g->fds[e] == -1) {
+            if(!err) err = errno;
+            continue; // not every CPU (or VM) has every event
+        }
+        if(g->leader == -1) g->leader = g->fds[e];
+        g->order[g->num_open++] = e;
     }
-    
-    // Reset and enable counters
-    ioctl(fd_cache_ref, PERF_EVENT_IOC_RESET, 0);
-    ioctl(fd_cache_miss, PERF_EVENT_IOC_RESET, 0);
-    if (fd_l1_loads != -1) ioctl(fd_l1_loads, PERF_EVENT_IOC_RESET, 0);
-    if (fd_l1_misses != -1) ioctl(fd_l1_misses, PERF_EVENT_IOC_RESET, 0);
-    
-    ioctl(fd_cache_ref, PERF_EVENT_IOC_ENABLE, 0);
-    ioctl(fd_cache_miss, PERF_EVENT_IOC_ENABLE, 0);
-    if (fd_l1_loads != -1) ioctl(fd_l1_loads, PERF_EVENT_IOC_ENABLE, 0);
-    if (fd_l1_misses != -1) ioctl(fd_l1_misses, PERF_EVENT_IOC_ENABLE, 0);
-    
-    // Perform lookups
-    for (int i = 0; i < n; i++) {
-        ph_lookup(ht, keys[i]);
+
+    if(g->leader == -1) {
+        warn_unavailable(err);
+        return 0;
     }
-    
-    // Disable counters
-    ioctl(fd_cache_ref, PERF_EVENT_IOC_DISABLE, 0);
-    ioctl(fd_cache_miss, PERF_EVENT_IOC_DISABLE, 0);
-    if (fd_l1_loads != -1) ioctl(fd_l1_loads, PERF_EVENT_IOC_DISABLE, 0);
-    if (fd_l1_misses != -1) ioctl(fd_l1_misses, PERF_EVENT_IOC_DISABLE, 0);
-    
-    // Read results
-    read(fd_cache_ref, &metrics.cache_references, sizeof(long long));
-    read(fd_cache_miss, &metrics.cache_misses, sizeof(long long));
-    
-    if (fd_l1_loads != -1 && fd_l1_misses != -1) {
-        read(fd_l1_loads, &metrics.l1_dcache_loads, sizeof(long long));
-        read(fd_l1_misses, &metrics.l1_dcache_misses, sizeof(long long));
+    ioctl(g->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(g->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return g->num_open;
+}
+
+void perf_group_read(const perf_group_t *g, perf_counts_t *out) {
+    for(int e = 0; e < PERF_NUM_EVENTS; e++) out->counts[e] = -1;
+    if(g->leader == -1) return;
+
+    uint64_t buf[3 + PERF_NUM_EVENTS]; // nr, time enabled, time running, values
+    ssize_t want = (ssize_t)((3 + g->num_open) * sizeof(uint64_t));
+    if(read(g->leader, buf, sizeof(buf)) < want || buf[2] == 0) return; // never scheduled
+
+    double scale = (double)buf[1] / (double)buf[2]; // multiplexed with other groups
+    for(int i = 0; i < g->num_open; i++) out->counts[g->order[i]] = (double)buf[3 + i] * scale;
+}
+
+void perf_group_close(perf_group_t *g) {
+    for(int e = 0; e < PERF_NUM_EVENTS; e++) {
+        if(g->fds[e] != -1) close(g->fds[e]);
+        g->fds[e] = -1;
     }
-    
-    // Calculate miss rates
-    if (metrics.cache_references > 0) {
-        metrics.cache_miss_rate = (double)metrics.cache_misses / 
-                                   metrics.cache_references * 100.0;
+    g->leader = -1;
+    g->num_open = 0;
+}
+
+int perf_profile_open(perf_profile_t *p) {
+    memset(p, 0, sizeof(*p));
+    int available = perf_group_open(&p->group) > 0;
+    perf_counts_t now;
+    perf_group_read(&p->group, &now);
+    for(int ph = 0; ph < PERF_NUM_PHASES; ph++) {
+        for(int e = 0; e < PERF_NUM_EVENTS; e++) p->phases[ph].counts[e] = (now.counts[e] < 0) ? -1 : 0;
     }
-    
-    if (metrics.l1_dcache_loads > 0) {
-        metrics.l1_miss_rate = (double)metrics.l1_dcache_misses / 
-                                metrics.l1_dcache_loads * 100.0;
+    return available ? 0 : -1;
+}
+
+void perf_phase_hook(int phase, int begin, void *ctx) {
+    perf_profile_t *p = ctx;
+    if(phase < 0 || phase >= PERF_NUM_PHASES || p->group.leader == -1) return;
+    if(begin) {
+        perf_group_read(&p->group, &p->at_begin);
+        return;
+    }
+
+    perf_counts_t now;
+    perf_group_read(&p->group, &now);
+    double *sum = p->phases[phase].counts;
+    for(int e = 0; e < PERF_NUM_EVENTS; e++) {
+        if(sum[e] < 0 || now.counts[e] < 0 || p->at_begin.counts[e] < 0) sum[e] = -1;
+        else sum[e] += now.counts[e] - p->at_begin.counts[e];
     }
-    
-    // Close file descriptors
-    close(fd_cache_ref);
-    close(fd_cache_miss);
-    if (fd_l1_loads != -1) close(fd_l1_loads);
-    if (fd_l1_misses != -1) close(fd_l1_misses);
-    
-    return metrics;
 }
 
-void print_cache_metrics(cache_metrics_t *metrics, int n) {
-    printf("\n--- CACHE PERFORMANCE ---\n");
-    printf("  Cache references:   %lld\n", metrics->cache_references);
-    printf("  Cache misses:       %lld\n", metrics->cache_misses);
-    printf("  Cache miss rate:    %.2f%%\n", metrics->cache_miss_rate);
-    
-    if (metrics->l1_dcache_loads > 0) {
-        printf("  L1 D-cache loads:   %lld\n", metrics->l1_dcache_loads);
-        printf("  L1 D-cache misses:  %lld\n", metrics->l1_dcache_misses);
-        printf("  L1 miss rate:       %.2f%%\n", metrics->l1_miss_rate);
+void print_perf_profile(const perf_profile_t *p, double keys) {
+    static const char *phase_names[PERF_NUM_PHASES] = { "hash", "level 1", "level 2", "finish", "lookup" };
+
+    printf("\n--- HARDWARE COUNTERS (per key) ---\n");
+    if(p->group.leader == -1) {
+        printf("  unavailable (see the warning above)\n");
+        return;
+    }
+    printf("  %-8s", "phase");
+    for(int e = 0; e < PERF_NUM_EVENTS; e++) printf(" %10s", perf_events[e].name);
+    printf(" %6s\n", "IPC");
+
+    for(int ph = 0; ph < PERF_NUM_PHASES; ph++) {
+        const double *c = p->phases[ph].counts;
+        printf("  %-8s", phase_names[ph]);
+        for(int e = 0; e < PERF_NUM_EVENTS; e++) {
+            if(c[e] < 0) printf(" %10s", "n/a");
+            else printf(" %10.2f", c[e] / keys);
+        }
+        if(c[PERF_CYCLES] > 0 && c[PERF_INSTRUCTIONS] >= 0) printf(" %6.2f\n", c[PERF_INSTRUCTIONS] / c[PERF_CYCLES]);
+        else printf(" %6s\n", "n/a");
     }
-    
-    printf("  Avg cache refs per lookup: %.2f\n", 
-           (double)metrics->cache_references / n);
-    printf("  Avg cache misses per lookup: %.2f\n", 
-           (double)metrics->cache_misses / n);
-}
\ No newline at end of file
+}
+
+void perf_profile_close(perf_profile_t *p) {
+    perf_group_close(&p->group);
+}
@@ -1,25 +1,62 @@
 #ifndef CACHE_PERF_H
 #define CACHE_PERF_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include "../src/ph.h"
 
+// Hardware events counted together in one perf_event group
+typedef enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_LLC_MISSES, // last level cache read misses
+    PERF_L1D_MISSES, // L1 data cache read misses
+    PERF_DTLB_MISSES, // data TLB read misses
+    PERF_BRANCH_MISSES,
+    PERF_NUM_EVENTS
+} perf_event_id_t;
+
+typedef struct {
+    double counts[PERF_NUM_EVENTS]; // scaled for multiplexing, < 0 where the event is not counted
+} perf_counts_t;
+
+typedef struct {
+    int fds[PERF_NUM_EVENTS]; // -1 where the event could not be opened
+    int leader; // fd of the group leader, -1 when nothing is counted
+    int order[PERF_NUM_EVENTS]; // event of the i-th value a group read returns
+    int num_open;
+} perf_group_t;
+
+// Opens and starts the group on the calling thread (user space only); returns
+// how many events are counted, 0 when perf_event_open is unavailable or blocked
+int perf_group_open(perf_group_t *g);
+
+// Counts since perf_group_open()
+void perf_group_read(const perf_group_t *g, perf_counts_t *out);
+
+void perf_group_close(perf_group_t *g);
+
+// The build phases of ph.h, then the lookups the benchmark times
+#define PERF_PHASE_LOOKUP PH_NUM_PHASES
+#define PERF_NUM_PHASES (PH_NUM_PHASES + 1)
+
+// Counts accumulated per phase, over as many builds and lookup runs as it sees
 typedef struct {
-    long long cache_references;
-    long long cache_misses;
-    long long l1_dcache_loads;
-    long long l1_dcache_misses;
-    double cache_miss_rate;
-    double l1_miss_rate;
-} cache_metrics_t;
+    perf_group_t group;
+    perf_counts_t at_begin; // counts when the current phase began
+    perf_counts_t phases[PERF_NUM_PHASES];
+} perf_profile_t;
+
+// 0 when counters are available, -1 (and every phase reads as not counted) otherwise
+int perf_profile_open(perf_profile_t *p);
 
-// Initialize cache performance counters
-int init_cache_counters(int *fds, int num_counters);
+// A ph_phase_hook_t over the perf_profile_t in ctx; the benchmark calls it
+// with PERF_PHASE_LOOKUP around its lookups
+void perf_phase_hook(int phase, int begin, void *ctx);
 
-// Measure cache performance during lookups
-cache_metrics_t measure_cache_performance(ph_table *ht, char **keys, int n);
+// Events per key of each phase, phase counts divided by keys
+void print_perf_profile(const perf_profile_t *p, double keys);
 
-// Print cache metrics
-void print_cache_metrics(cache_metrics_t *metrics, int n);
+void perf_profile_close(perf_profile_t *p);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "datasets.h"
+#include "../src/hash.h"
+
+static const char *dataset_names[] = { "random", "url", "uuid", "varlen", "prefix", "file" };
+
+int dataset_kind(const char *name) {
+    for(int kind = DATASET_RANDOM; kind < DATASET_FILE; kind++) {
+        if(strcmp(name, dataset_names[kind]) == 0) return kind;
+    }
+    return -1;
+}
+
+const char *dataset_name(int kind) {
+    return (kind >= DATASET_RANDOM && kind <= DATASET_FILE) ? dataset_names[kind] : "?";
+}
+
+/**
+ * @brief A growing arena the generators append keys to. Keys are recorded
+ *        as offsets while the arena may still move and turned into
+ *        pointers once it is complete.
+ */
+typedef struct {
+    char *buf;
+    size_t used;
+    size_t cap;
+    size_t *offsets;
+    size_t n;
+} arena_t;
+
+static int arena_push(arena_t *a, const char *key, size_t len) {
+    if(a->used + len + 1 > a->cap) {
+        size_t cap = 2 * a->cap + len + 1;
+        char *buf = realloc(a->buf, cap);
+        if(!buf) return -1;
+        a->buf = buf;
+        a->cap = cap;
+    }
+    memcpy(a->buf + a->used, key, len);
+    a->buf[a->used + len] = '\0';
+    a->offsets[a->n++] = a->used;
+    a->used += len + 1;
+    return 0;
+}
+
+/**
+ * @brief Turns a's offsets into a deduplicated dataset, consuming a.
+ */
+static dataset_t *arena_finish(arena_t *a) {
+    dataset_t *d = calloc(1, sizeof(dataset_t));
+    char **keys = malloc(sizeof(char *) * (a->n ? a->n : 1));
+    if(!d || !keys) {
+        free(d);
+        free(keys);
+        free(a->buf);
+        free(a->offsets);
+        return NULL;
+    }
+    for(size_t i = 0; i < a->n; i++) keys[i] = a->buf + a->offsets[i];
+    free(a->offsets);
+
+    d->keys = keys;
+    d->arena = a->buf;
+    d->arena_bytes = a->used;
+    d->n = dataset_dedupe(keys, a->n, 0);
+    return d;
+}
+
+/**
+ * @brief Writes len characters of alphabet drawn from r to out, taking as
+ *        many characters as fit from each 64-bit draw.
+ */
+static void random_chars(ph_rng_t *r, char *out, size_t len, const char *alphabet, unsigned int size) {
+    uint64_t x = 0;
+    int left = 0;
+    for(size_t i = 0; i < len; i++) {
+        if(left == 0) {
+            x = ph_rng_next(r);
+            left = (size == 26) ? 13 : 12; // 26^13 and 36^12 are below 2^64
+        }
+        out[i] = alphabet[x % size];
+        x /= size;
+        left--;
+    }
+}
+
+static const char lower[] = "abcdefghijklmnopqrstuvwxyz";
+static const char lower_digits[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+
+/**
+ * @brief Word i of a fixed vocabulary, 4-11 lowercase letters.
+ */
+static size_t vocabulary_word(uint64_t i, uint64_t salt, char *out) {
+    ph_rng_t r = ph_rng_stream(salt, i);
+    size_t len = 4 + (size_t)(ph_rng_next(&r) % 8);
+    random_chars(&r, out, len, lower, 26);
+    return len;
+}
+
+/**
+ * @brief A URL of one of 4096 hosts, 1-4 path segments of a 256 word
+ *        vocabulary and a numeric id.
+ */
+static size_t url_key(ph_rng_t *r, uint64_t seed, char *out) {
+    static const char *tlds[] = { "com", "org", "net", "io" };
+    uint64_t x = ph_rng_next(r);
+    size_t len = 0;
+
+    memcpy(out, "https://www.", 12);
+    len = 12;
+    len += vocabulary_word(x & 4095, seed, out + len);
+    len += (size_t)sprintf(out + len, ".%s", tlds[(x >> 12) & 3]);
+    int segments = 1 + (int)((x >> 14) & 3);
+    for(int s = 0; s < segments; s++) {
+        out[len++] = '/';
+        len += vocabulary_word(4096 + ((x >> (16 + 8 * s)) & 255), seed, out + len);
+    }
+    len += (size_t)sprintf(out + len, "?id=%llu", (unsigned long long)(ph_rng_next(r) % 1000000000ull));
+    return len;
+}
+
+static size_t uuid_key(ph_rng_t *r, char *out) {
+    uint64_t hi = ph_rng_next(r), lo = ph_rng_next(r);
+    hi = (hi & ~0xf000ull) | 0x4000ull; // version 4
+    lo = (lo & ~(3ull << 62)) | (2ull << 62); // RFC 4122 variant
+    return (size_t)sprintf(out, "%08x-%04x-%04x-%04x-%012llx", (unsigned)(hi >> 32), (unsigned)(hi >> 16) & 0xffff,
+        (unsigned)hi & 0xffff, (unsigned)(lo >> 48), (unsigned long long)(lo & 0xffffffffffffull));
+}
+
+dataset_t *dataset_generate(int kind, size_t n, unsigned int key_len, uint64_t seed) {
+    if(kind < DATASET_RANDOM || kind >= DATASET_FILE || key_len < 2 || key_len > 1024) return NULL;
+
+    arena_t a = { 0 };
+    a.offsets = malloc(sizeof(size_t) * (n ? n : 1));
+    a.cap = n * (kind == DATASET_URL ? 64 : kind == DATASET_UUID ? 37 : key_len) + 1;
+    a.buf = malloc(a.cap);
+    if(!a.offsets || !a.buf) {
+        free(a.offsets);
+        free(a.buf);
+        return NULL;
+    }
+
+    ph_rng_t r = ph_rng_stream(seed, 0);
+    char prefix[1024];
+    size_t prefix_len = (key_len > 12) ? key_len - 12 : 0;
+    ph_rng_t pr = ph_rng_stream(seed, 1);
+    random_chars(&pr, prefix, prefix_len, lower, 26);
+
+    char key[2048];
+    for(size_t i = 0; i < n; i++) {
+        size_t len = 0;
+        switch(kind) {
+        case DATASET_RANDOM:
+            len = key_len - 1;
+            random_chars(&r, key, len, lower, 26);
+            break;
+        case DATASET_URL:
+            len = url_key(&r, seed, key);
+            break;
+        case DATASET_UUID:
+            len = uuid_key(&r, key);
+            break;
+        case DATASET_VARLEN:
+            len = 1 + (size_t)(ph_rng_next(&r) % (2 * key_len - 1));
+            random_chars(&r, key, len, lower_digits, 36);
+            break;
+        case DATASET_PREFIX:
+            memcpy(key, prefix, prefix_len);
+            len = prefix_len + 11;
+            random_chars(&r, key + prefix_len, 11, lower_digits, 36);
+            break;
+        }
+        if(arena_push(&a, key, len) != 0) {
+            free(a.offsets);
+            free(a.buf);
+            return NULL;
+        }
+    }
+    return arena_finish(&a);
+}
+
+dataset_t *dataset_load(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if(!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long bytes = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if(bytes < 0) {
+        fclose(f);
+        return NULL;
+    }
+
+    // the file is read whole into the arena and split in place
+    arena_t a = { 0 };
+    a.buf = malloc((size_t)bytes + 1);
+    if(!a.buf || fread(a.buf, 1, (size_t)bytes, f) != (size_t)bytes) {
+        free(a.buf);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+    a.buf[bytes] = '\n';
+    a.used = a.cap = (size_t)bytes + 1;
+
+    size_t lines = 0;
+    for(long i = 0; i <= bytes; i++) lines += a.buf[i] == '\n';
+    a.offsets = malloc(sizeof(size_t) * (lines ? lines : 1));
+    if(!a.offsets) {
+        free(a.buf);
+        return NULL;
+    }
+
+    size_t start = 0;
+    for(size_t i = 0; i < a.used; i++) {
+        if(a.buf[i] != '\n') continue;
+        size_t end = i;
+        if(end > start && a.buf[end - 1] == '\r') end--;
+        a.buf[end] = '\0';
+        if(end > start) a.offsets[a.n++] = start;
+        start = i + 1;
+    }
+    return arena_finish(&a);
+}
+
+size_t dataset_dedupe(char **keys, size_t n, int free_dups) {
+    size_t cap = 16;
+    while(cap < n + n / 2) cap *= 2;
+    size_t *table = calloc(cap, sizeof(size_t)); // kept index + 1, 0 when empty
+    if(!table) return n;
+
+    size_t count = 0;
+    for(size_t i = 0; i < n; i++) {
+        size_t len = strlen(keys[i]);
+        size_t pos = (size_t)ph_key_hash(keys[i], len) & (cap - 1);
+        int dup = 0;
+        while(table[pos]) {
+            const char *other = keys[table[pos] - 1];
+            if(strcmp(other, keys[i]) == 0) {
+                dup = 1;
+                break;
+            }
+            pos = (pos + 1) & (cap - 1);
+        }
+        if(dup) {
+            if(free_dups) free(keys[i]);
+            continue;
+        }
+        keys[count] = keys[i];
+        table[pos] = ++count;
+    }
+    free(table);
+    return count;
+}
+
+void dataset_free(dataset_t *d) {
+    if(!d) return;
+    free(d->keys);
+    free(d->arena);
+    free(d);
+}
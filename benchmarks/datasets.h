@@ -0,0 +1,50 @@
+#ifndef DATASETS_H
+#define DATASETS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Key sets for the benchmarks. Every key of a dataset lives in one arena,
+ * so 100M keys cost one allocation for the bytes and one for the pointer
+ * array instead of 100M mallocs, and datasets are deduplicated by hashing
+ * in expected O(n).
+ */
+
+typedef enum {
+    DATASET_RANDOM, // key_len - 1 random lowercase letters, as generate_keys()
+    DATASET_URL, // https://host/path/segments?id=..., about 30-90 chars
+    DATASET_UUID, // 36-char version 4 UUIDs
+    DATASET_VARLEN, // random [a-z0-9] keys of 1 .. 2 * key_len - 1 chars
+    DATASET_PREFIX, // one shared key_len - 12 char prefix, then 11 random chars
+    DATASET_FILE // one key per line of a file
+} dataset_kind_t;
+
+typedef struct {
+    char **keys; // n NUL terminated keys, pointing into arena
+    size_t n;
+    char *arena;
+    size_t arena_bytes;
+} dataset_t;
+
+// DATASET_* for a generator name ("random", "url", ...), -1 if there is none
+int dataset_kind(const char *name);
+
+const char *dataset_name(int kind);
+
+// n keys of a generated kind, deduplicated (so possibly fewer), NULL on failure
+dataset_t *dataset_generate(int kind, size_t n, unsigned int key_len, uint64_t seed);
+
+// The lines of path as keys (line breaks and empty lines dropped), deduplicated
+dataset_t *dataset_load(const char *path);
+
+/**
+ * Drops every repeat of an earlier key, keeping the order of the rest, and
+ * returns the new count. When free_dups is set the dropped keys are freed
+ * (keys from malloc, as in key_set_cleaner()); else they belong to an arena.
+ */
+size_t dataset_dedupe(char **keys, size_t n, int free_dups);
+
+void dataset_free(dataset_t *d);
+
+#endif
@@ -0,0 +1,467 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+
+#include "results.h"
+
+#define CSV_COLUMNS "bench,hash_type,n,key_len,metric,unit,lower_is_better,min,max,median,mean,p95,p99,std_dev,samples"
+
+/**
+ * @brief Copies src into dst of size bytes, truncating and always terminating.
+ */
+static void copy_str(char *dst, size_t size, const char *src) {
+    snprintf(dst, size, "%s", src ? src : "");
+}
+
+/**
+ * @brief The "model name" of the first CPU in /proc/cpuinfo.
+ */
+static void read_cpu_model(char *out, size_t size) {
+    copy_str(out, size, "unknown");
+    FILE *f = fopen("/proc/cpuinfo", "r");
+    if(!f) return;
+    char line[512];
+    while(fgets(line, sizeof(line), f)) {
+        char *colon = strchr(line, ':');
+        if(strncmp(line, "model name", 10) != 0 || !colon) continue;
+        colon++;
+        while(*colon == ' ' || *colon == '\t') colon++;
+        colon[strcspn(colon, "\n")] = '\0';
+        copy_str(out, size, colon);
+        break;
+    }
+    fclose(f);
+}
+
+result_file_t *results_new(void) {
+    result_file_t *f = calloc(1, sizeof(result_file_t));
+    if(!f) return NULL;
+
+    host_info_t *h = &f->host;
+    if(gethostname(h->hostname, sizeof(h->hostname)) != 0) copy_str(h->hostname, sizeof(h->hostname), "unknown");
+    h->hostname[sizeof(h->hostname) - 1] = '\0';
+    struct utsname u;
+    if(uname(&u) == 0) snprintf(h->os, sizeof(h->os), "%s %s %s", u.sysname, u.release, u.machine);
+    else copy_str(h->os, sizeof(h->os), "unknown");
+    read_cpu_model(h->cpu, sizeof(h->cpu));
+    h->cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#ifdef __VERSION__
+    copy_str(h->compiler, sizeof(h->compiler), __VERSION__);
+#else
+    copy_str(h->compiler, sizeof(h->compiler), "unknown");
+#endif
+    time_t now = time(NULL);
+    struct tm tm;
+    gmtime_r(&now, &tm);
+    strftime(h->timestamp, sizeof(h->timestamp), "%Y-%m-%dT%H:%M:%SZ", &tm);
+    return f;
+}
+
+/**
+ * @brief Appends an empty record, with its own copy of count samples.
+ */
+static result_record_t *push_record(result_file_t *f, const double *samples, size_t count) {
+    if(f->n == f->cap) {
+        size_t cap = f->cap ? 2 * f->cap : 16;
+        result_record_t *records = realloc(f->records, cap * sizeof(result_record_t));
+        if(!records) return NULL;
+        f->records = records;
+        f->cap = cap;
+    }
+    result_record_t *r = &f->records[f->n];
+    memset(r, 0, sizeof(*r));
+    r->samples = malloc((count ? count : 1) * sizeof(double));
+    if(!r->samples) return NULL;
+    if(samples) memcpy(r->samples, samples, count * sizeof(double));
+    r->num_samples = count;
+    f->n++;
+    return r;
+}
+
+int results_add(result_file_t *f, const char *bench, int hash_type, int n, int key_len, const char *metric,
+    const char *unit, int lower_is_better, const double *samples, size_t count) {
+    if(count == 0) return -1;
+    result_record_t *r = push_record(f, samples, count);
+    if(!r) return -1;
+    copy_str(r->bench, sizeof(r->bench), bench);
+    r->hash_type = hash_type;
+    r->n = n;
+    r->key_len = key_len;
+    copy_str(r->metric, sizeof(r->metric), metric);
+    copy_str(r->unit, sizeof(r->unit), unit);
+    r->lower_is_better = lower_is_better;
+    r->stats = calc_stats(r->samples, count);
+    return 0;
+}
+
+const result_record_t *results_find(const result_file_t *f, const result_record_t *key) {
+    for(size_t i = 0; i < f->n; i++) {
+        const result_record_t *r = &f->records[i];
+        if(r->hash_type == key->hash_type && r->n == key->n && r->key_len == key->key_len &&
+            strcmp(r->bench, key->bench) == 0 && strcmp(r->metric, key->metric) == 0) return r;
+    }
+    return NULL;
+}
+
+static void write_json_str(FILE *out, const char *s) {
+    fputc('"', out);
+    for(; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if(c == '"' || c == '\\') fprintf(out, "\\%c", c);
+        else if(c < 0x20) fprintf(out, "\\u%04x", c);
+        else fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+static void write_json(const result_file_t *f, FILE *out) {
+    const host_info_t *h = &f->host;
+    fprintf(out, "{\n  \"host\": {\"hostname\": ");
+    write_json_str(out, h->hostname);
+    fprintf(out, ", \"os\": ");
+    write_json_str(out, h->os);
+    fprintf(out, ", \"cpu\": ");
+    write_json_str(out, h->cpu);
+    fprintf(out, ", \"cpus\": %d, \"compiler\": ", h->cpus);
+    write_json_str(out, h->compiler);
+    fprintf(out, ", \"timestamp\": ");
+    write_json_str(out, h->timestamp);
+    fprintf(out, "},\n  \"results\": [");
+
+    for(size_t i = 0; i < f->n; i++) {
+        const result_record_t *r = &f->records[i];
+        const stats_t *s = &r->stats;
+        fprintf(out, "%s\n    {\"bench\": ", i ? "," : "");
+        write_json_str(out, r->bench);
+        fprintf(out, ", \"hash_type\": %d, \"n\": %d, \"key_len\": %d, \"metric\": ", r->hash_type, r->n, r->key_len);
+        write_json_str(out, r->metric);
+        fprintf(out, ", \"unit\": ");
+        write_json_str(out, r->unit);
+        fprintf(out, ", \"lower_is_better\": %d,\n     \"stats\": {\"min\": %.17g, \"max\": %.17g, \"median\": %.17g, "
+            "\"mean\": %.17g, \"p95\": %.17g, \"p99\": %.17g, \"std_dev\": %.17g},\n     \"samples\": [",
+            r->lower_is_better, s->min, s->max, s->median, s->mean, s->p95, s->p99, s->std_dev);
+        for(size_t j = 0; j < r->num_samples; j++) fprintf(out, "%s%.17g", j ? ", " : "", r->samples[j]);
+        fprintf(out, "]}");
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+static void write_csv(const result_file_t *f, FILE *out) {
+    const host_info_t *h = &f->host;
+    fprintf(out, "# hostname: %s\n# os: %s\n# cpu: %s\n# cpus: %d\n# compiler: %s\n# timestamp: %s\n",
+        h->hostname, h->os, h->cpu, h->cpus, h->compiler, h->timestamp);
+    fprintf(out, "%s\n", CSV_COLUMNS);
+
+    for(size_t i = 0; i < f->n; i++) {
+        const result_record_t *r = &f->records[i];
+        const stats_t *s = &r->stats;
+        fprintf(out, "%s,%d,%d,%d,%s,%s,%d,%.17g,%.17g,%.17g,%.17g,%.17g,%.17g,%.17g,", r->bench, r->hash_type,
+            r->n, r->key_len, r->metric, r->unit, r->lower_is_better, s->min, s->max, s->median, s->mean,
+            s->p95, s->p99, s->std_dev);
+        for(size_t j = 0; j < r->num_samples; j++) fprintf(out, "%s%.17g", j ? " " : "", r->samples[j]);
+        fputc('\n', out);
+    }
+}
+
+int results_write(const result_file_t *f, const char *path) {
+    FILE *out = fopen(path, "w");
+    if(!out) return -1;
+    size_t len = strlen(path);
+    if(len >= 4 && strcmp(path + len - 4, ".csv") == 0) write_csv(f, out);
+    else write_json(f, out);
+    int err = ferror(out);
+    return (fclose(out) != 0 || err) ? -1 : 0;
+}
+
+/*
+ * Reading. JSON is parsed into a small tree first, then the records are
+ * taken from it; CSV is read line by line.
+ */
+
+typedef enum { JSON_NULL, JSON_BOOL, JSON_NUMBER, JSON_STRING, JSON_ARRAY, JSON_OBJECT } json_type_t;
+
+typedef struct json_value {
+    json_type_t type;
+    double number; // JSON_NUMBER and JSON_BOOL
+    char *string; // JSON_STRING
+    struct json_value *items; // JSON_ARRAY and JSON_OBJECT
+    char **keys; // JSON_OBJECT
+    size_t count;
+} json_value_t;
+
+#define JSON_MAX_DEPTH 16
+
+static void json_free(json_value_t *v) {
+    free(v->string);
+    for(size_t i = 0; i < v->count; i++) {
+        json_free(&v->items[i]);
+        if(v->keys) free(v->keys[i]);
+    }
+    free(v->items);
+    free(v->keys);
+}
+
+static const char *skip_space(const char *p) {
+    while(*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') p++;
+    return p;
+}
+
+/**
+ * @brief Parses the string at *p (after its opening quote) into a new
+ *        heap string. \u escapes outside ASCII become '?'.
+ */
+static char *parse_json_str(const char **p) {
+    const char *s = *p;
+    size_t len = 0;
+    while(s[len] && s[len] != '"') len += (s[len] == '\\' && s[len + 1]) ? 2 : 1;
+    if(s[len] != '"') return NULL;
+
+    char *out = malloc(len + 1), *o = out;
+    if(!out) return NULL;
+    for(size_t i = 0; i < len; i++) {
+        if(s[i] != '\\') {
+            *o++ = s[i];
+            continue;
+        }
+        char c = s[++i];
+        if(c == 'n') *o++ = '\n';
+        else if(c == 't') *o++ = '\t';
+        else if(c == 'r') *o++ = '\r';
+        else if(c == 'b' || c == 'f') *o++ = ' ';
+        else if(c == 'u' && i + 4 < len) {
+            unsigned int code = 0;
+            sscanf(s + i + 1, "%4x", &code);
+            *o++ = (code < 0x80) ? (char)code : '?';
+            i += 4;
+        } else *o++ = c;
+    }
+    *o = '\0';
+    *p = s + len + 1;
+    return out;
+}
+
+static int parse_json(const char **p, json_value_t *v, int depth) {
+    memset(v, 0, sizeof(*v));
+    const char *s = skip_space(*p);
+    if(depth > JSON_MAX_DEPTH) return -1;
+
+    if(*s == '{' || *s == '[') {
+        int object = (*s == '{');
+        char close = object ? '}' : ']';
+        v->type = object ? JSON_OBJECT : JSON_ARRAY;
+        s = skip_space(s + 1);
+        size_t cap = 0;
+        while(*s != close) {
+            if(v->count == cap) {
+                cap = cap ? 2 * cap : 8;
+                json_value_t *items = realloc(v->items, cap * sizeof(json_value_t));
+                char **keys = object ? realloc(v->keys, cap * sizeof(char *)) : NULL;
+                if(items) v->items = items;
+                if(keys) v->keys = keys;
+                if(!items || (object && !keys)) return -1;
+            }
+            if(object) {
+                s = skip_space(s);
+                if(*s != '"') return -1;
+                s++;
+                char *key = parse_json_str(&s);
+                if(!key) return -1;
+                s = skip_space(s);
+                if(*s != ':') {
+                    free(key);
+                    return -1;
+                }
+                s++;
+                v->keys[v->count] = key;
+            }
+            int rc = parse_json(&s, &v->items[v->count], depth + 1);
+            v->count++; // freed by the caller either way
+            if(rc != 0) return -1;
+            s = skip_space(s);
+            if(*s == ',') s = skip_space(s + 1);
+            else if(*s != close) return -1;
+        }
+        *p = s + 1;
+        return 0;
+    }
+    if(*s == '"') {
+        s++;
+        v->type = JSON_STRING;
+        v->string = parse_json_str(&s);
+        *p = s;
+        return v->string ? 0 : -1;
+    }
+    if(strncmp(s, "true", 4) == 0 || strncmp(s, "false", 5) == 0) {
+        v->type = JSON_BOOL;
+        v->number = (*s == 't');
+        *p = s + ((*s == 't') ? 4 : 5);
+        return 0;
+    }
+    if(strncmp(s, "null", 4) == 0) {
+        *p = s + 4;
+        return 0;
+    }
+    char *end;
+    v->type = JSON_NUMBER;
+    v->number = strtod(s, &end);
+    *p = end;
+    return (end == s) ? -1 : 0;
+}
+
+static const json_value_t *json_get(const json_value_t *obj, const char *key) {
+    if(!obj || obj->type != JSON_OBJECT) return NULL;
+    for(size_t i = 0; i < obj->count; i++) {
+        if(strcmp(obj->keys[i], key) == 0) return &obj->items[i];
+    }
+    return NULL;
+}
+
+static const char *json_str(const json_value_t *obj, const char *key) {
+    const json_value_t *v = json_get(obj, key);
+    return (v && v->type == JSON_STRING) ? v->string : "";
+}
+
+static double json_num(const json_value_t *obj, const char *key) {
+    const json_value_t *v = json_get(obj, key);
+    return (v && (v->type == JSON_NUMBER || v->type == JSON_BOOL)) ? v->number : 0;
+}
+
+static int records_from_json(result_file_t *f, const json_value_t *root) {
+    const json_value_t *h = json_get(root, "host");
+    copy_str(f->host.hostname, sizeof(f->host.hostname), json_str(h, "hostname"));
+    copy_str(f->host.os, sizeof(f->host.os), json_str(h, "os"));
+    copy_str(f->host.cpu, sizeof(f->host.cpu), json_str(h, "cpu"));
+    f->host.cpus = (int)json_num(h, "cpus");
+    copy_str(f->host.compiler, sizeof(f->host.compiler), json_str(h, "compiler"));
+    copy_str(f->host.timestamp, sizeof(f->host.timestamp), json_str(h, "timestamp"));
+
+    const json_value_t *results = json_get(root, "results");
+    if(!results || results->type != JSON_ARRAY) return -1;
+    for(size_t i = 0; i < results->count; i++) {
+        const json_value_t *o = &results->items[i];
+        const json_value_t *samples = json_get(o, "samples");
+        if(!samples || samples->type != JSON_ARRAY || samples->count == 0) return -1;
+
+        result_record_t *r = push_record(f, NULL, samples->count);
+        if(!r) return -1;
+        for(size_t j = 0; j < samples->count; j++) r->samples[j] = samples->items[j].number;
+        copy_str(r->bench, sizeof(r->bench), json_str(o, "bench"));
+        r->hash_type = (int)json_num(o, "hash_type");
+        r->n = (int)json_num(o, "n");
+        r->key_len = (int)json_num(o, "key_len");
+        copy_str(r->metric, sizeof(r->metric), json_str(o, "metric"));
+        copy_str(r->unit, sizeof(r->unit), json_str(o, "unit"));
+        r->lower_is_better = (int)json_num(o, "lower_is_better");
+        r->stats = calc_stats(r->samples, r->num_samples);
+    }
+    return 0;
+}
+
+/**
+ * @brief One CSV_COLUMNS row; the stats columns are recomputed from the samples.
+ */
+static int record_from_csv(result_file_t *f, char *line) {
+    char *fields[15];
+    int count = 0;
+    for(char *p = line; count < 15; count++) {
+        fields[count] = p;
+        p = strchr(p, ',');
+        if(!p) {
+            count++;
+            break;
+        }
+        *p++ = '\0';
+    }
+    if(count != 15) return -1;
+
+    size_t num_samples = 0;
+    for(char *p = fields[14]; *p; ) {
+        char *end;
+        strtod(p, &end);
+        if(end == p) break;
+        num_samples++;
+        p = end;
+    }
+    if(num_samples == 0) return -1;
+    result_record_t *r = push_record(f, NULL, num_samples);
+    if(!r) return -1;
+    char *p = fields[14];
+    for(size_t j = 0; j < num_samples; j++) r->samples[j] = strtod(p, &p);
+
+    copy_str(r->bench, sizeof(r->bench), fields[0]);
+    r->hash_type = atoi(fields[1]);
+    r->n = atoi(fields[2]);
+    r->key_len = atoi(fields[3]);
+    copy_str(r->metric, sizeof(r->metric), fields[4]);
+    copy_str(r->unit, sizeof(r->unit), fields[5]);
+    r->lower_is_better = atoi(fields[6]);
+    r->stats = calc_stats(r->samples, r->num_samples);
+    return 0;
+}
+
+static int records_from_csv(result_file_t *f, char *text) {
+    host_info_t *h = &f->host;
+    for(char *line = text; line && *line; ) {
+        char *next = strchr(line, '\n');
+        if(next) *next++ = '\0';
+        line[strcspn(line, "\r")] = '\0';
+
+        if(line[0] == '#') {
+            char *colon = strchr(line, ':');
+            const char *value = colon ? colon + 1 + (colon[1] == ' ') : "";
+            if(strncmp(line, "# hostname:", 11) == 0) copy_str(h->hostname, sizeof(h->hostname), value);
+            else if(strncmp(line, "# os:", 5) == 0) copy_str(h->os, sizeof(h->os), value);
+            else if(strncmp(line, "# cpu:", 6) == 0) copy_str(h->cpu, sizeof(h->cpu), value);
+            else if(strncmp(line, "# cpus:", 7) == 0) h->cpus = atoi(value);
+            else if(strncmp(line, "# compiler:", 11) == 0) copy_str(h->compiler, sizeof(h->compiler), value);
+            else if(strncmp(line, "# timestamp:", 12) == 0) copy_str(h->timestamp, sizeof(h->timestamp), value);
+        } else if(line[0] && strcmp(line, CSV_COLUMNS) != 0) {
+            if(record_from_csv(f, line) != 0) return -1;
+        }
+        line = next;
+    }
+    return 0;
+}
+
+result_file_t *results_read(const char *path) {
+    FILE *in = fopen(path, "rb");
+    if(!in) return NULL;
+    fseek(in, 0, SEEK_END);
+    long bytes = ftell(in);
+    fseek(in, 0, SEEK_SET);
+    char *text = (bytes >= 0) ? malloc((size_t)bytes + 1) : NULL;
+    if(!text || fread(text, 1, (size_t)bytes, in) != (size_t)bytes) {
+        free(text);
+        fclose(in);
+        return NULL;
+    }
+    fclose(in);
+    text[bytes] = '\0';
+
+    result_file_t *f = calloc(1, sizeof(result_file_t));
+    int rc = -1;
+    if(f && *skip_space(text) == '{') {
+        json_value_t root;
+        const char *p = text;
+        if(parse_json(&p, &root, 0) == 0) rc = records_from_json(f, &root);
+        json_free(&root);
+    } else if(f) {
+        rc = records_from_csv(f, text);
+    }
+    free(text);
+    if(rc != 0) {
+        results_free(f);
+        return NULL;
+    }
+    return f;
+}
+
+void results_free(result_file_t *f) {
+    if(!f) return;
+    for(size_t i = 0; i < f->n; i++) free(f->records[i].samples);
+    free(f->records);
+    free(f);
+}
@@ -0,0 +1,61 @@
+#ifndef RESULTS_H
+#define RESULTS_H
+
+#include <stddef.h>
+#include "stats.h"
+
+/**
+ * Machine-readable benchmark results. A result file holds the host it was
+ * measured on and one record per (benchmark, configuration, metric) with
+ * every trial's sample and their stats_t. It is written as JSON, or as CSV
+ * when the path ends in .csv, and read back from either by ph_compare.
+ */
+
+typedef struct {
+    char hostname[64];
+    char os[200]; // sysname release machine
+    char cpu[128]; // model name from /proc/cpuinfo, "unknown" elsewhere
+    int cpus; // online
+    char compiler[64];
+    char timestamp[32]; // UTC, ISO 8601
+} host_info_t;
+
+typedef struct {
+    char bench[32]; // "ph" for benchmark_ph()
+    int hash_type;
+    int n; // keys asked for, before deduplication
+    int key_len;
+    char metric[32];
+    char unit[16];
+    int lower_is_better; // 1 where an increase is a regression, 0 for counts that are only informative
+    stats_t stats;
+    double *samples; // one per trial
+    size_t num_samples;
+} result_record_t;
+
+typedef struct {
+    host_info_t host;
+    result_record_t *records;
+    size_t n;
+    size_t cap;
+} result_file_t;
+
+// An empty result file with the host info of the calling machine, NULL on failure
+result_file_t *results_new(void);
+
+// Appends a record of count samples (copied) and their stats, -1 on failure
+int results_add(result_file_t *f, const char *bench, int hash_type, int n, int key_len, const char *metric,
+    const char *unit, int lower_is_better, const double *samples, size_t count);
+
+// The record of the same benchmark, configuration and metric as key, NULL if there is none
+const result_record_t *results_find(const result_file_t *f, const result_record_t *key);
+
+// Writes CSV when path ends in .csv, else JSON; 0 on success, -1 on failure
+int results_write(const result_file_t *f, const char *path);
+
+// Reads a file written by results_write(), either format, NULL on failure
+result_file_t *results_read(const char *path);
+
+void results_free(result_file_t *f);
+
+#endif
@@ -1,6 +1,7 @@
 #include "stats.h"
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
 
 int compare_doubles(const void *a, const void *b) { 
     double diff = (*(double *)a - *(double *)b); 
@@ -87,8 +88,95 @@ stats_t calc_stats(double *values, size_t n) {
     return stats;  
 }
 
+/**
+ * @brief Bucket of value: exact below 2^HIST_SUB_BITS, else the power of two
+ *        above that and the next HIST_SUB_BITS - 1 bits below the top one.
+ */
+static size_t hist_index(uint64_t value) { 
+    if(value < (1ull << HIST_SUB_BITS)) return (size_t)value; 
+    int shift = 63 - __builtin_clzll(value) - HIST_SUB_BITS + 1; 
+    return ((size_t)shift << (HIST_SUB_BITS - 1)) + (size_t)(value >> shift); 
+}
+
+/**
+ * @brief Highest value that falls in bucket index.
+ */
+static uint64_t hist_bucket_max(size_t index) { 
+    if(index < (1u << HIST_SUB_BITS)) return index; 
+    int shift = (int)(index >> (HIST_SUB_BITS - 1)) - 1; 
+    uint64_t mantissa = index - ((uint64_t)shift << (HIST_SUB_BITS - 1)); 
+    return ((mantissa + 1) << shift) - 1; 
+}
+
+void hist_init(histogram_t *h) { 
+    memset(h, 0, sizeof(*h)); 
+    h->min = UINT64_MAX; 
+}
+
+void hist_record(histogram_t *h, uint64_t value) { 
+    h->counts[hist_index(value)]++; 
+    h->total++; 
+    h->sum += (double)value; 
+    if(value < h->min) h->min = value; 
+    if(value > h->max) h->max = value; 
+}
+
+void hist_merge(histogram_t *dst, const histogram_t *src) { 
+    for(size_t i = 0; i < HIST_BUCKETS; i++) dst->counts[i] += src->counts[i]; 
+    dst->total += src->total; 
+    dst->sum += src->sum; 
+    if(src->min < dst->min) dst->min = src->min; 
+    if(src->max > dst->max) dst->max = src->max; 
+}
 
+uint64_t hist_percentile(const histogram_t *h, double percentile) { 
+    if(h->total == 0) return 0; 
+    if(percentile >= 100) return h->max; 
+
+    // rank of the value, counted from 1, as calc_percentile() picks it 
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)(h->total - 1)) + 1; 
+    uint64_t seen = 0; 
+    for(size_t i = 0; i < HIST_BUCKETS; i++) { 
+        seen += h->counts[i]; 
+        if(seen >= rank) { 
+            uint64_t top = hist_bucket_max(i); 
+            return (top > h->max) ? h->max : (top < h->min) ? h->min : top; 
+        }
+    }
+    return h->max; 
+}
 
+double hist_mean(const histogram_t *h) { 
+    return h->total ? h->sum / (double)h->total : 0; 
+}
 
+static double monotonic_ns(void) { 
+    struct timespec ts; 
+    clock_gettime(CLOCK_MONOTONIC, &ts); 
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec; 
+}
 
+double ticks_per_ns(void) { 
+    static double rate; 
+    if(rate > 0) return rate; 
+#if defined(__x86_64__) || defined(__i386__)
+    // 20 ms of both clocks; the TSC runs at a constant rate on anything recent 
+    double start_ns = monotonic_ns(); 
+    uint64_t start = read_ticks(); 
+    while(monotonic_ns() - start_ns < 2e7) { } 
+    rate = (double)(read_ticks() - start) / (monotonic_ns() - start_ns); 
+#else
+    rate = 1; 
+#endif
+    return rate; 
+}
 
+uint64_t timer_overhead_ticks(void) { 
+    uint64_t best = UINT64_MAX; 
+    for(int i = 0; i < 10000; i++) { 
+        uint64_t start = read_ticks(); 
+        uint64_t ticks = read_ticks() - start; 
+        if(ticks < best) best = ticks; 
+    }
+    return best; 
+}
@@ -2,6 +2,11 @@
 #define STATS_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 typedef struct { 
     double min; 
@@ -22,4 +27,52 @@ double calc_percentile(double *values, size_t n, int percentile);
 double calc_stddev(double *values, size_t n, double mean); 
 stats_t calc_stats(double *values, size_t n); 
 
+/**
+ * HDR-style latency histogram: values below 2^HIST_SUB_BITS are counted
+ * exactly, larger ones in 2^(HIST_SUB_BITS - 1) log-spaced buckets per power
+ * of two, so any recorded value is reported within 1/128 (0.8%) of itself,
+ * from 1 tick up to 2^64, in a fixed 58 KB with no allocation per value.
+ */
+#define HIST_SUB_BITS 8
+#define HIST_BUCKETS ((66 - HIST_SUB_BITS) << (HIST_SUB_BITS - 1))
+
+typedef struct { 
+    uint64_t counts[HIST_BUCKETS]; 
+    uint64_t total; 
+    uint64_t min; 
+    uint64_t max; // min and max are exact
+    double sum; 
+} histogram_t; 
+
+void hist_init(histogram_t *h); 
+void hist_record(histogram_t *h, uint64_t value); 
+void hist_merge(histogram_t *dst, const histogram_t *src); 
+// Highest value of the bucket that holds the percentile-th value (percentile in 0..100, e.g. 99.9), exact max at 100
+uint64_t hist_percentile(const histogram_t *h, double percentile); 
+double hist_mean(const histogram_t *h); 
+
+/**
+ * @brief A timestamp for timing single operations: the TSC on x86, fenced
+ *        so the timed code can't be reordered across it, else
+ *        CLOCK_MONOTONIC in ns.
+ */
+static inline uint64_t read_ticks(void) { 
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_lfence(); 
+    uint64_t t = __rdtsc(); 
+    _mm_lfence(); 
+    return t; 
+#else
+    struct timespec ts; 
+    clock_gettime(CLOCK_MONOTONIC, &ts); 
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec; 
+#endif
+}
+
+// read_ticks() ticks per ns, measured against CLOCK_MONOTONIC on the first call
+double ticks_per_ns(void); 
+
+// Smallest read_ticks() interval around no work, which every timed value includes
+uint64_t timer_overhead_ticks(void); 
+
 #endif
\ No newline at end of file
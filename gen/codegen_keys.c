@@ -0,0 +1,171 @@
+/* Generated by ph_codegen, do not edit. */
+#include <stdint.h>
+#include <string.h>
+
+#include "codegen_keys.h"
+
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "codegen_keys.c was generated for a little endian target"
+#endif
+
+const char *const codegen_keys_keys[CODEGEN_KEYS_NUM_KEYS] = {
+    "GET",
+    "HEAD",
+    "POST",
+    "PUT",
+    "DELETE",
+    "CONNECT",
+    "OPTIONS",
+    "TRACE",
+    "PATCH",
+    "HELO",
+    "EHLO",
+    "MAIL",
+    "RCPT",
+    "DATA",
+    "RSET",
+    "VRFY",
+    "EXPN",
+    "NOOP",
+    "QUIT",
+    "STARTTLS",
+    "AUTH",
+    "LOGIN",
+    "LOGOUT",
+    "SELECT",
+    "EXAMINE",
+    "FETCH",
+    "STORE",
+    "SEARCH",
+    "APPEND",
+    "EXPUNGE",
+    "IDLE",
+    "listen_address",
+    "listen_port",
+    "max_connections",
+    "worker_threads",
+    "read_timeout_ms",
+    "write_timeout_ms",
+    "keepalive_timeout_ms",
+    "tls_certificate_file",
+    "tls_private_key_file",
+    "tls_min_version",
+    "log_level",
+    "log_file",
+    "access_log_format",
+    "upstream_pool_size",
+    "upstream_retry_budget",
+    "cache_size_mb",
+    "cache_eviction_policy",
+    "rate_limit_per_second",
+    "rate_limit_burst",
+    "compression",
+    "compression_min_bytes",
+    "RULE-0001",
+    "RULE-0002",
+    "RULE-0017",
+    "RULE-0042",
+    "RULE-0108",
+    "RULE-0256",
+    "RULE-1024",
+    "RULE-2048",
+    "x",
+    "a \042quoted\042 key\077",
+    "back\134slash",
+};
+
+static const uint8_t codegen_keys_lens[CODEGEN_KEYS_NUM_KEYS] = {
+    3, 4, 4, 3, 6, 7, 7, 5, 5, 4, 4, 4, 4, 4, 4, 4,
+    4, 4, 4, 8, 4, 5, 6, 6, 7, 5, 5, 6, 6, 7, 4, 14,
+    11, 15, 14, 15, 16, 20, 20, 20, 15, 9, 8, 17, 18, 21, 13, 21,
+    21, 16, 11, 21, 9, 9, 9, 9, 9, 9, 9, 9, 1, 15, 10,
+};
+
+/* key index of every slot */
+static const uint8_t codegen_keys_slot_key[CODEGEN_KEYS_NUM_KEYS] = {
+    9, 17, 39, 49, 26, 51, 23, 61, 15, 56, 14, 44, 5, 10, 7, 20,
+    30, 13, 48, 33, 62, 46, 21, 38, 36, 8, 3, 60, 0, 47, 4, 52,
+    59, 32, 31, 18, 11, 27, 25, 57, 22, 24, 54, 19, 53, 34, 37, 50,
+    28, 41, 42, 55, 29, 16, 6, 35, 12, 1, 40, 43, 58, 45, 2,
+};
+
+/* ph_pilot_hash() of every bucket's pilot */
+static const uint64_t codegen_keys_pilot_hash[16] = {
+    0xce11cdfc690a9eb5ull, 0x32da584f11a0db17ull, 0xc800c431cc8306cbull, 0xee2ad63b3d45f454ull,
+    0x23d48f5ae6768bc7ull, 0x32da584f11a0db17ull, 0x9616db2136c4d989ull, 0xb209bb3862b66389ull,
+    0xf3b1fce2e0d8708dull, 0xdec31f5538845876ull, 0x32da584f11a0db17ull, 0x7105521e53e4c741ull,
+    0x32da584f11a0db17ull, 0xee2ad63b3d45f454ull, 0x6d6b9c3f6ea9b5d0ull, 0x6b277c9eded9fb38ull,
+};
+
+/* slot of each position past 63 */
+static const uint8_t codegen_keys_remap[4] = {
+    28, 32, 0, 61,
+};
+
+static inline uint64_t codegen_keys_tail(const unsigned char *s, size_t rem) {
+    if(rem >= 4) {
+        uint32_t lo, hi;
+        memcpy(&lo, s, 4);
+        memcpy(&hi, s + rem - 4, 4);
+        return lo | (uint64_t)hi << (8 * (rem - 4));
+    }
+    return s[0] | (uint64_t)s[rem / 2] << (8 * (rem / 2)) | (uint64_t)s[rem - 1] << (8 * (rem - 1));
+}
+
+static inline uint64_t codegen_keys_hash(const unsigned char *s, size_t len) {
+    uint64_t h = 0x4705999dd5358c31ull ^ ((uint64_t)len * 0xc2b2ae3d27d4eb4full);
+    size_t i = 0;
+    for(; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, s + i, 8);
+        h = (h ^ w) * 0x9e3779b97f4a7c15ull;
+        h ^= h >> 32;
+    }
+    if(i < len) {
+        h = (h ^ codegen_keys_tail(s + i, len - i)) * 0x9e3779b97f4a7c15ull;
+        h ^= h >> 32;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline int codegen_keys_equals(const unsigned char *a, const unsigned char *b, size_t len) {
+    uint64_t diff = 0;
+    size_t i = 0;
+    for(; i + 8 <= len; i += 8) {
+        uint64_t x, y;
+        memcpy(&x, a + i, 8);
+        memcpy(&y, b + i, 8);
+        diff |= x ^ y;
+    }
+    if(i < len) diff |= codegen_keys_tail(a + i, len - i) ^ codegen_keys_tail(b + i, len - i);
+    return diff == 0;
+}
+
+int codegen_keys_lookup(const char *key, size_t len) {
+    if(len < CODEGEN_KEYS_MIN_LEN || len > CODEGEN_KEYS_MAX_LEN) return -1;
+    uint64_t h = codegen_keys_hash((const unsigned char *)key, (CODEGEN_KEYS_MIN_LEN == CODEGEN_KEYS_MAX_LEN) ? CODEGEN_KEYS_MAX_LEN : len);
+
+    uint64_t x = h ^ 0xb1cd3229e4d7f2fbull;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    size_t b = ((uint32_t)(x >> 32) < 2576980378u)
+        ? (size_t)(((uint64_t)(uint32_t)x * 5u) >> 32)
+        : 5u + (size_t)(((uint64_t)(uint32_t)x * 11u) >> 32);
+
+    uint64_t d = (h ^ codegen_keys_pilot_hash[b]) * 0x9e3779b97f4a7c15ull;
+    size_t slot = (size_t)(((unsigned __int128)d * 67u) >> 64);
+    if(slot >= CODEGEN_KEYS_NUM_KEYS) slot = codegen_keys_remap[slot - CODEGEN_KEYS_NUM_KEYS];
+
+    size_t i = codegen_keys_slot_key[slot];
+    if(codegen_keys_lens[i] != len) return -1;
+    if(!codegen_keys_equals((const unsigned char *)codegen_keys_keys[i], (const unsigned char *)key, len)) return -1;
+    return (int)i;
+}
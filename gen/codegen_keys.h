@@ -0,0 +1,20 @@
+/* Generated by ph_codegen, do not edit. */
+#ifndef CODEGEN_KEYS_H
+#define CODEGEN_KEYS_H
+
+#include <stddef.h>
+
+#define CODEGEN_KEYS_NUM_KEYS 63
+#define CODEGEN_KEYS_MIN_LEN 1
+#define CODEGEN_KEYS_MAX_LEN 21
+
+/**
+ * @brief Index of key (len bytes, no terminator needed) in the key list,
+ *        or -1 if it isn't one of the keys.
+ */
+int codegen_keys_lookup(const char *key, size_t len);
+
+/* The keys by index, NUL terminated */
+extern const char *const codegen_keys_keys[CODEGEN_KEYS_NUM_KEYS];
+
+#endif
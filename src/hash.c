@@ -1,135 +1,402 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
 
 #include "ph.h"
 #include "hash.h"
+#include "ph_internal.h"
+
+/**
+ *
+ * @brief The table-wide key hash: ph_key_hash() over the key's bytes, run by
+ *        the widest kernel the CPU supports. The hash itself is described at
+ *        the top of hash_kernels.c. There is no coefficient array, so keys
+ *        can be of any length.
+ *
+ * @param s - The String to hash
+ *
+ * @return 64-bit hash of s
+ *
+ */
+uint64_t first_level_hashing(const char *s) {
+    return ph_key_hash(s, strlen(s));
+}
 
-#define PRIME 2147483647u
+/**
+ * @brief A bucket's hash function: seed remixed into the key hash. Lookups
+ *        and builds call ph_mix() on the cached key hash instead.
+ */
+unsigned int second_level_hashing(const char *s, unsigned int seed) {
+    return ph_mix(first_level_hashing(s), seed);
+}
 
+/**
+ * @brief A table seed for builds that don't pass one: the clock, a process
+ *        wide counter (two builds in the same nanosecond still differ) and
+ *        an address, mixed. Never 0, which means "draw one" in the options.
+ */
+uint64_t fresh_seed(void) {
+    static _Atomic uint64_t builds;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    uint64_t x = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    x ^= (atomic_fetch_add(&builds, 1) + 1) * 0x9e3779b97f4a7c15ull;
+    x = ph_fmix64(x ^ (uint64_t)(uintptr_t)&builds);
+    return x ? x : 1;
+}
 
+static size_t align_up(size_t x, size_t a) { 
+    return (x + a - 1) & ~(a - 1); 
+}
 
+/**
+ * @brief Bytes taken by the slot records every layout ends with: a
+ *        ph_slot_t per slot, or key refs plus the pool when keys are owned.
+ */
+static size_t slot_storage_size(const ph_table *t, size_t num_slots) {
+    if(!t->own_keys) return num_slots * sizeof(ph_slot_t);
+    return num_slots * sizeof(ph_key_ref_t) + t->pool_bytes;
+}
 
+/**
+ * @brief Points t's slot records at t->mem + at (16-byte aligned, so no
+ *        record straddles a cache line). With owned keys, t->slots is a
+ *        scratch array the build places keys into and own_keys() turns into
+ *        key refs once the build is done.
+ *
+ * @return 0 on success, -1 on allocation failure
+ */
+static int carve_slot_storage(ph_table *t, size_t at, size_t num_slots) {
+    char *base = (char *)t->mem + at;
 
-/** 
- * 
- * @brief A randomised algo for constructing hash functions 
- *        such that the prob of collision is ~ 1/M (theoretically). 
- * 
- * @param key - The String to hash 
- * @param rand_coeff - The array of random coefficients (a[i])
- * @param rand_additive_const - The random additive constant (b)
- * @param prime - The chosen (large) prime value to perform mod with 
- * @param table_size - Size of our hash table
- * 
- * @return integer hash value between [0, table_size] 
- * 
+    t->num_slots = num_slots;
+    if(!t->own_keys) {
+        t->slots = (ph_slot_t *)base;
+        return 0;
+    }
+
+    t->keys = (ph_key_ref_t *)base;
+    t->pool = base + num_slots * sizeof(ph_key_ref_t);
+    t->slots = calloc(num_slots ? num_slots : 1, sizeof(ph_slot_t));
+    return t->slots ? 0 : -1;
+}
+
+/**
+ * @brief Frees a layout that will not be used: t->mem and, with owned keys,
+ *        the scratch slot array.
  */
-unsigned int universal_hash(const char* key, Universal_Hash_Params* params) { 
-    
-    unsigned long long hash = params->rand_additive; 
+static void release_layout(ph_table *t) {
+    if(t->own_keys) free(t->slots);
+    t->slots = NULL;
+    free(t->mem);
+    t->mem = NULL;
+}
+
+/**
+ * @brief Fills ref for the len bytes at key (NULL for an empty slot), given
+ *        the pool offset the key would be stored at.
+ *
+ * @return Bytes the key takes in the pool: 0 when it is inlined in ref
+ */
+size_t make_key_ref(ph_key_ref_t *ref, const char *key, size_t len, uint64_t pool_offset) {
+    memset(ref, 0, sizeof(*ref));
+    if(!key) {
+        ref->len = PH_EMPTY_SLOT;
+        return 0;
+    }
 
-    for(int i = 0;  key[i] != '\0'; i++) { 
-        unsigned int temp = (unsigned char) key[i]; 
-        hash += (unsigned long long)temp * params->coeff_array[i]; 
-    
+    ref->len = (uint32_t)len;
+    if(len <= PH_INLINE_KEY_LEN) {
+        memcpy(ref->bytes, key, len);
+        return 0;
     }
-    return (unsigned int)((hash % params->prime) % params->table_size);
+    memcpy(ref->bytes, key, PH_KEY_PREFIX_LEN);
+    memcpy(ref->bytes + PH_KEY_PREFIX_LEN, &pool_offset, sizeof(pool_offset));
+    return len + 1; // NUL kept so C string keys in the pool read as C strings
+}
+
+/**
+ * @brief Copies every placed key into t->keys and the pool, in slot order,
+ *        and drops the scratch array: the table no longer refers to the
+ *        caller's key memory.
+ */
+static void own_keys(ph_table *t) {
+    size_t next = 0;
+    for(size_t slot = 0; slot < t->num_slots; slot++) {
+        const char *key = t->slots[slot].key;
+        size_t bytes = make_key_ref(&t->keys[slot], key, t->slots[slot].len, next);
+        t->keys[slot].fingerprint = t->slots[slot].fingerprint;
+        if(bytes) {
+            memcpy(t->pool + next, key, bytes - 1);
+            t->pool[next + bytes - 1] = '\0';
+        }
+        next += bytes;
+    }
+
+    free(t->slots);
+    t->slots = NULL;
+}
+
+/**
+ * @brief Where p, a pointer into the block at from, lies in the copy at to.
+ */
+static void *rebase(const void *p, const void *from, void *to) {
+    return p ? (char *)to + ((const char *)p - (const char *)from) : NULL;
+}
+
+/**
+ * @brief Moves the finished t->mem into memory from a and points every array
+ *        carved from it at the copy, so the table lives where a puts it.
+ *
+ * @return 0 on success, -1 when a fails (t is untouched)
+ */
+static int move_storage(ph_table *t, const ph_allocator_t *a) {
+    void *mem = a->alloc(t->mem_bytes ? t->mem_bytes : 1, a->ctx);
+    if(!mem) return -1;
+    memcpy(mem, t->mem, t->mem_bytes);
+
+    void *old = t->mem;
+    t->params = rebase(t->params, old, mem);
+    t->slots = rebase(t->slots, old, mem);
+    t->pilots = rebase(t->pilots, old, mem);
+    t->remap = rebase(t->remap, old, mem);
+    t->keys = rebase(t->keys, old, mem);
+    t->pool = rebase(t->pool, old, mem);
+    release_table_mem(t);
+    t->mem = mem;
+    t->allocator = *a;
+    return 0;
+}
+
+void release_table_mem(ph_table *t) {
+    if(t->allocator.alloc) {
+        if(t->allocator.free) t->allocator.free(t->mem, t->mem_bytes ? t->mem_bytes : 1, t->allocator.ctx);
+    } else {
+        free(t->mem);
+    }
+    t->mem = NULL;
+    memset(&t->allocator, 0, sizeof(t->allocator));
 }
 
 /** 
+ * @brief Secondary table size for a bucket holding k keys. 
+ */
+static size_t second_level_size(size_t k, int hash_type) { 
+    if(k <= 1) return k; 
+    return (hash_type == 0) ? k * k : k; 
+}
+
+/** 
+ * @brief Slot count for a bucket of k keys that gave up at size slots: 2k,
+ *        then k^2, then doubling. 0 past 4k^2, where a seed fails with
+ *        probability under 1/8, so a bucket that still gives up holds keys
+ *        whose key hashes are equal.
+ */
+static size_t looser_size(size_t k, size_t size) {
+    size_t next = (size < 2 * k) ? 2 * k : (size < k * k) ? k * k : 2 * size;
+    return (next > 4 * k * k || next > UINT32_MAX) ? 0 : next;
+}
+
+/**
+ * @brief Number of level 1 buckets. The FKS schemes use one bucket per load
+ *        keys (load <= 0 for 1), hash-and-displace packs PH_HD_BUCKET_LOAD
+ *        keys per bucket on average.
+ */
+size_t first_level_size(size_t n, int hash_type, double load) {
+    if(hash_type == PH_HASH_DISPLACE) return (n + PH_HD_BUCKET_LOAD - 1) / PH_HD_BUCKET_LOAD;
+    if(load <= 0) return n;
+
+    double m = (double)n / load;
+    size_t whole = (size_t)m;
+    if(whole < m || (n && !whole)) whole++;
+    return whole;
+}
+
+/**
+ * @brief Hashes every key into one of t->m buckets under a fresh level 1 seed
+ *        (the next draw of rng) and groups the keys (and their key hashes)
+ *        by bucket with a counting sort, so each bucket's keys end up
+ *        contiguous.
  * 
- * @brief Initialises the params for our universal hash function and 
- *        sets key size limits and table size limits. Note that it 
- *        also creates the random coefficient array that is used to 
- *        ensure low prob of collisions (primarily <= 1/table_size). 
- * 
- * @param params Location to store all params 
- * @param table_size size of to be hash table 
- * @param max_str_len max length of future input keys 
+ * @param hashes first_level_hashing() of every key
+ * @param grouped Output: keys reordered so that bucket b's keys start at 
+ *                grouped[key_start[b]] (m + 1 entries in key_start) 
+ * @param grouped_hashes Output: the key hash of each grouped key
  * 
+ * @return 0 on success, -1 on allocation failure 
  */
-void init_universal_hash(Universal_Hash_Params* params, unsigned int table_size, unsigned int max_str_len) { 
-    
-    params->prime = PRIME; 
-    params->table_size = table_size; 
-    params->max_str_len = max_str_len; 
+int build_first_level_bucketing(ph_table *t, char **keys, const uint64_t *hashes, size_t n,
+    ph_rng_t *rng, char ***grouped, uint64_t **grouped_hashes, size_t **key_start) {
 
-    params->coeff_array = malloc(sizeof(unsigned int) * max_str_len); 
+    t->level1_seed = (uint32_t)ph_rng_next(rng);
 
-    params->rand_additive = (unsigned int)(rand() % params->prime); 
+    unsigned int *key_bucket = malloc(sizeof(unsigned int) * n); 
+    size_t *start = calloc(t->m + 1, sizeof(size_t)); 
+    char **by_bucket = malloc(sizeof(char *) * n); 
+    uint64_t *hashes_by_bucket = malloc(sizeof(uint64_t) * n);
+    if((n && (!key_bucket || !by_bucket || !hashes_by_bucket)) || !start) goto fail;
 
-    for(unsigned int i = 0; i < max_str_len; i++) { 
-        unsigned int r = (unsigned int) rand(); 
-        params->coeff_array[i] = (r % (params->prime - 1)) + 1; 
+    for(size_t i = 0; i < n; i++) { 
+        key_bucket[i] = (unsigned int)bucket_of(t, hashes[i]);
+        start[key_bucket[i] + 1]++; 
     }
+    for(size_t b = 0; b < t->m; b++) start[b + 1] += start[b]; 
+
+    // counting sort keys into their buckets
+    for(size_t i = n; i-- > 0;) { 
+        size_t at = --start[key_bucket[i] + 1];
+        by_bucket[at] = keys[i];
+        hashes_by_bucket[at] = hashes[i];
+    }
+    // start[b + 1] now holds bucket b's first key, shift it back into place
+    for(size_t b = 0; b < t->m; b++) start[b] = start[b + 1]; 
+    start[t->m] = n; 
+
+    free(key_bucket); 
+    *grouped = by_bucket; 
+    *grouped_hashes = hashes_by_bucket;
+    *key_start = start; 
+    return 0; 
+
+fail: 
+    free(key_bucket); 
+    free(start); 
+    free(by_bucket); 
+    free(hashes_by_bucket);
+    return -1; 
 }
 
-void free_universal_hash(Universal_Hash_Params* params) { 
-    free(params->coeff_array); 
-    params->coeff_array = NULL; 
+/**
+ * @brief Whether two keys of one bucket share a key hash. Such keys collide
+ *        under every bucket seed and pilot, so no level 1 draw separates
+ *        them (duplicate keys are the common case). Keys with equal hashes
+ *        always share a bucket, so checking within buckets finds every pair.
+ */
+static int has_equal_hashes(const ph_table *t, const uint64_t *grouped_hashes, const size_t *key_start) {
+    for(size_t b = 0; b < t->m; b++) {
+        for(size_t i = key_start[b] + 1; i < key_start[b + 1]; i++) {
+            for(size_t j = key_start[b]; j < i; j++) {
+                if(grouped_hashes[i] == grouped_hashes[j]) return 1;
+            }
+        }
+    }
+    return 0;
 }
 
-void build_first_level_bucketing(ph_table *t, char **keys, size_t n, size_t max_str_len) { 
+/**
+ * @brief Lays out the frozen FKS table with sizes[b] slots for bucket b.
+ *        Bucket sizes are known once the keys are grouped, so the secondary
+ *        table sizes (k^2 or k) are too, which lets params and slots share
+ *        one allocation.
+ *
+ * @return 0 on success, -1 on allocation failure or over 2^32 slots
+ */
+static int layout_two_level(ph_table *t, const uint32_t *sizes) {
+    size_t num_slots = 0;
+    for(size_t b = 0; b < t->m; b++) num_slots += sizes[b];
+    if(num_slots > UINT32_MAX) return -1; // offsets are 32-bit
+
+    size_t slots_at = t->m * sizeof(ph_bucket_params_t);
+    size_t total = slots_at + slot_storage_size(t, num_slots);
+
+    t->mem = calloc(1, total ? total : 1);
+    if(!t->mem) return -1;
+    t->mem_bytes = total;
+    t->params = (ph_bucket_params_t *)t->mem;
+    if(carve_slot_storage(t, slots_at, num_slots) != 0) {
+        release_layout(t);
+        return -1;
+    }
 
-    t->n = n; 
-    // change later for 2nd method 
-    t->m = n; 
-    t->buckets = calloc(t->n, sizeof(ph_bucket_t)); 
-    
-    init_universal_hash(&t->level1_params, t->m, max_str_len); 
+    size_t next_slot = 0;
+    for(size_t b = 0; b < t->m; b++) {
+        t->params[b].offset = (uint32_t)next_slot;
+        t->params[b].table_size = sizes[b];
+        next_slot += sizes[b];
+    }
+    return 0;
+}
 
-    // change later for 2nd method
-    for(size_t i = 0; i < n; i++) { 
-        unsigned int h = universal_hash(keys[i], &t->level1_params) % t->m; 
-        ph_bucket_t *b = &t->buckets[h]; 
-        
-        // expand bucket key list  
-        b->keys = realloc(b->keys, sizeof(char *) * (b->key_count + 1)); 
-        b->keys[b->key_count++] = keys[i]; 
+/**
+ * @brief Moves t to a new layout with sizes[b] slots for bucket b, keeping
+ *        the seed and slots of every bucket that isn't marked in rebuild.
+ *
+ * @return 0 on success, -1 on allocation failure (t is untouched)
+ */
+static int relayout(ph_table *t, const uint32_t *sizes, const unsigned char *rebuild) {
+    ph_table old = *t;
+    if(layout_two_level(t, sizes) != 0) {
+        *t = old;
+        return -1;
     }
+
+    for(size_t b = 0; b < t->m; b++) {
+        if(rebuild[b]) continue;
+        t->params[b].seed = old.params[b].seed;
+        memcpy(&t->slots[t->params[b].offset], &old.slots[old.params[b].offset], sizes[b] * sizeof(ph_slot_t));
+    }
+    release_layout(&old);
+    return 0;
 }
 
 
-void build_second_level_bucketing(ph_bucket_t *b, size_t max_str_len, 
-    int hash_type, build_metrics_t *metrics) { 
+/**
+ * @brief Finds a seed that sends the k keys of bucket b to distinct slots and
+ *        writes them into the bucket's slot range. Retries only remix the
+ *        cached key hashes, nothing is allocated and no string is rehashed.
+ *        Only bucket b's params and slots are written, so distinct buckets
+ *        can be built concurrently as long as each has its own rng (the
+ *        build gives bucket b stream PH_STREAM_BUCKET + b) and metrics.
+ *
+ * @param max_attempts Seeds to try before giving up, <= 0 for no limit
+ *
+ * @return 0 once the bucket is built, 1 if max_attempts seeds all failed
+ */
+int build_second_level_bucketing(ph_table *t, size_t b, char **keys, const uint64_t *hashes,
+    size_t k, ph_rng_t *rng, int max_attempts, build_metrics_t *metrics) {
 
-    size_t k = b->key_count; 
+    ph_bucket_params_t *p = &t->params[b];
+    ph_slot_t *table = &t->slots[p->offset]; 
 
     if(k <= 1) {  // trivial case
-        b->table_size = k; 
-        return; 
+        if(k == 1) table[0].key = keys[0]; 
+        return 0;
     }
 
-    size_t m2 = (hash_type == 0) ? k * k : k; 
-
-    char **table = NULL; 
+    unsigned int m2 = p->table_size;
     int attempt = 0; 
 
     while(1) { 
+        if(max_attempts > 0 && attempt == max_attempts) {
+            if(metrics) {
+                metrics->total_attempts += attempt;
+                if(attempt > metrics->max_attemps_bucket) metrics->max_attemps_bucket = attempt;
+            }
+            return 1;
+        }
         attempt++; 
-        init_universal_hash(&b->params, m2, max_str_len); 
-        table = calloc(m2, sizeof(char *)); 
+        p->seed = (uint32_t)ph_rng_next(rng);
+        memset(table, 0, m2 * sizeof(ph_slot_t)); 
         int collision = 0; 
 
         for(size_t i = 0; i < k; i++) { 
-            unsigned int h = universal_hash(b->keys[i], &b->params);
+            unsigned int h = ph_reduce(ph_mix(hashes[i], p->seed), m2);
             
-            if(table[h] != NULL) { 
+            if(table[h].key != NULL) { 
                 collision = 1; 
                 if(metrics) metrics->total_collisions++; 
                 break; 
             }
 
-            table[h] = b->keys[i]; 
+            table[h].key = keys[i]; 
         }
 
 
         if(!collision) { 
-            free(b->keys); 
-            b->keys = table; 
-            b->table_size = m2; 
-            
             if(metrics) { 
                 metrics->total_attempts += attempt;
                 metrics->total_buckets_processed++; 
@@ -137,55 +404,566 @@ void build_second_level_bucketing(ph_bucket_t *b, size_t max_str_len,
                     metrics->max_attemps_bucket = attempt; 
                 } 
             }
-            return; 
+            return 0;
         }
+    }
+}
 
-        free(table); 
-        attempt++; 
+/**
+ * @brief Bits per key of an FKS layout with num_slots slots: params and
+ *        slots. Key bytes (the pool) don't count.
+ */
+static double layout_bits_per_key(const ph_table *t, size_t num_slots) {
+    size_t bytes = t->m * sizeof(ph_bucket_params_t) + slot_storage_size(t, num_slots);
+    if(t->own_keys) bytes -= t->pool_bytes;
+    return t->n ? 8.0 * (double)bytes / (double)t->n : 0;
+}
+
+static int fits_budget(const ph_table *t, const ph_build_opts_t *opts, size_t num_slots) {
+    return opts->bits_per_key <= 0 || layout_bits_per_key(t, num_slots) <= opts->bits_per_key;
+}
+
+/**
+ * @brief The FKS condition: whether the sum of k^2 over the buckets is
+ *        within PH_FKS_SKEW times its expectation n + n(n - 1) / m. A level
+ *        1 function over it has heavy buckets, which take many seeds (and
+ *        with k^2 slots, much space) to build.
+ */
+static int level1_balanced(const ph_table *t, const size_t *key_start) {
+    double sum = 0;
+    for(size_t b = 0; b < t->m; b++) {
+        double k = (double)(key_start[b + 1] - key_start[b]);
+        sum += k * k;
+    }
+    double n = (double)t->n;
+    return t->m == 0 || sum <= PH_FKS_SKEW * (n + n * (n - 1) / (double)t->m);
+}
+
+/**
+ * @brief Gives every bucket marked in gave_up its looser_size() and builds
+ *        it again, until no bucket gives up.
+ *
+ * @return 0 once every bucket is built, 1 if a bucket can't be loosened
+ *         (past 4k^2 slots or over the budget), -1 on allocation failure
+ */
+static int loosen_buckets(ph_table *t, char **grouped, const uint64_t *grouped_hashes,
+    const size_t *key_start, uint32_t *sizes, unsigned char *gave_up, const ph_build_opts_t *opts,
+    int max_attempts, build_metrics_t *metrics) {
+
+    while(1) {
+        size_t num_slots = t->num_slots;
+        int any = 0;
+        for(size_t b = 0; b < t->m; b++) {
+            if(!gave_up[b]) continue;
+            size_t next = looser_size(key_start[b + 1] - key_start[b], sizes[b]);
+            if(!next) return 1;
+            num_slots += next - sizes[b];
+            sizes[b] = (uint32_t)next;
+            any = 1;
+            if(metrics) metrics->loosened_buckets++;
+        }
+        if(!any) return 0;
+        if(!fits_budget(t, opts, num_slots)) return 1;
+        if(relayout(t, sizes, gave_up) != 0) return -1;
+
+        for(size_t b = 0; b < t->m; b++) {
+            if(!gave_up[b]) continue;
+            ph_rng_t rng = ph_rng_stream(t->seed, PH_STREAM_BUCKET + b);
+            gave_up[b] = (unsigned char)build_second_level_bucketing(t, b, grouped + key_start[b],
+                grouped_hashes + key_start[b], key_start[b + 1] - key_start[b], &rng, max_attempts, metrics);
+        }
+    }
+}
+
+/**
+ * @brief Lays t out with sizes[b] slots for bucket b and builds every
+ *        bucket, loosening the ones that give up after max_attempts seeds.
+ *
+ * @return 0 on success, 1 if level 1 must be redrawn, -1 on allocation
+ *         failure. t is only left with a layout on success.
+ */
+static int build_second_level(ph_table *t, char **grouped, const uint64_t *grouped_hashes, const size_t *key_start,
+    uint32_t *sizes, unsigned char *gave_up, const ph_build_opts_t *opts, int max_attempts, build_metrics_t *metrics) {
+
+    if(layout_two_level(t, sizes) != 0) return -1;
+
+    memset(gave_up, 0, t->m);
+    if(opts->num_threads > 1) {
+        if(build_second_level_parallel(t, grouped, grouped_hashes, key_start, opts->num_threads,
+                max_attempts, gave_up, metrics) != 0) {
+            release_layout(t);
+            return -1;
+        }
+    } else {
+        for(size_t b = 0; b < t->m; b++) {
+            ph_rng_t rng = ph_rng_stream(t->seed, PH_STREAM_BUCKET + b);
+            gave_up[b] = (unsigned char)build_second_level_bucketing(t, b, grouped + key_start[b],
+                grouped_hashes + key_start[b], key_start[b + 1] - key_start[b], &rng, max_attempts, metrics);
+        }
     }
+
+    int loosened = loosen_buckets(t, grouped, grouped_hashes, key_start, sizes, gave_up, opts,
+        max_attempts, metrics);
+    if(loosened != 0) release_layout(t);
+    return loosened;
 }
 
+/**
+ * @brief Builds both levels of an FKS table within the bounds of opts (see
+ *        ph_build_opts_t): level 1 is redrawn until it is balanced and fits
+ *        the budget, buckets that hit the attempt cap are loosened.
+ *
+ * @return 0 on success, -1 on allocation failure, when two keys share a key
+ *         hash, or once PH_FKS_LEVEL1_TRIES level 1 draws have all failed
+ */
+static int build_fks(ph_table *t, char **keys, const uint64_t *hashes, const ph_build_opts_t *opts,
+    build_metrics_t *metrics) {
+
+    int max_attempts = opts->max_bucket_attempts ? opts->max_bucket_attempts : PH_FKS_BUCKET_ATTEMPTS;
+    ph_rng_t level1 = ph_rng_stream(t->seed, PH_STREAM_LEVEL1);
+    char **grouped = NULL;
+    uint64_t *grouped_hashes = NULL;
+    size_t *key_start = NULL;
+    uint32_t *sizes = malloc(sizeof(uint32_t) * (t->m ? t->m : 1));
+    unsigned char *gave_up = malloc(t->m ? t->m : 1);
+
+    int rc = -1, checked = 0;
+    for(int draw = 0; sizes && gave_up && draw < PH_FKS_LEVEL1_TRIES; draw++) {
+        free(grouped);
+        free(grouped_hashes);
+        free(key_start);
+        grouped = NULL;
+        grouped_hashes = NULL;
+        key_start = NULL;
+        if(metrics) metrics->level1_draws++;
+        ph_phase(opts, PH_PHASE_LEVEL1, 1);
+        int grouped_ok = build_first_level_bucketing(t, keys, hashes, t->n, &level1, &grouped, &grouped_hashes,
+            &key_start) == 0;
+        size_t num_slots = 0;
+        for(size_t b = 0; grouped_ok && b < t->m; b++) {
+            sizes[b] = (uint32_t)second_level_size(key_start[b + 1] - key_start[b], t->hash_type);
+            num_slots += sizes[b];
+        }
+        ph_phase(opts, PH_PHASE_LEVEL1, 0);
+        if(!grouped_ok) break;
+
+        // the last draw is taken unbalanced, the budget is never waived
+        int last = (draw + 1 == PH_FKS_LEVEL1_TRIES);
+        if((!last && !level1_balanced(t, key_start)) || !fits_budget(t, opts, num_slots)) continue;
+        // key hashes don't depend on the draw, so the first one to get here checks them
+        if(!checked && has_equal_hashes(t, grouped_hashes, key_start)) break;
+        checked = 1;
+
+        ph_phase(opts, PH_PHASE_LEVEL2, 1);
+        int built = build_second_level(t, grouped, grouped_hashes, key_start, sizes, gave_up, opts, max_attempts,
+            metrics);
+        ph_phase(opts, PH_PHASE_LEVEL2, 0);
+        if(built == 0) rc = 0;
+        if(built <= 0) break;
+    }
+
+    free(grouped);
+    free(grouped_hashes);
+    free(key_start);
+    free(sizes);
+    free(gave_up);
+    return rc;
+}
+
+/**
+ * @brief Searches a pilot for every bucket, largest bucket first, such that
+ *        the bucket's keys land on free, distinct positions of one global
+ *        array of pilot_range = n / PH_HD_LOAD_FACTOR positions. Positions
+ *        past n are then folded into the holes below n through t->remap,
+ *        which keeps the slot array minimal.
+ *
+ * @param rng Level 1 stream, drawn from again by every retry
+ *
+ * @return 0 on success, 1 if some bucket ran out of pilots (the caller
+ *         reseeds level 1 and tries again, up to PH_HD_LEVEL1_TRIES draws),
+ *         -1 on allocation failure or when two keys share a key hash
+ */
+int build_hash_displace(ph_table *t, char **keys, const uint64_t *hashes, ph_rng_t *rng,
+    const ph_build_opts_t *opts, build_metrics_t *metrics) {
+
+    size_t n = t->n;
+    char **grouped = NULL;
+    uint64_t *grouped_hashes = NULL;
+    size_t *key_start = NULL;
+    ph_phase(opts, PH_PHASE_LEVEL1, 1);
+    int grouped_ok = build_first_level_bucketing(t, keys, hashes, n, rng, &grouped, &grouped_hashes, &key_start) == 0;
+    ph_phase(opts, PH_PHASE_LEVEL1, 0);
+    if(!grouped_ok) return -1;
+    if(has_equal_hashes(t, grouped_hashes, key_start)) {
+        free(grouped);
+        free(grouped_hashes);
+        free(key_start);
+        return -1;
+    }
+    ph_phase(opts, PH_PHASE_LEVEL2, 1);
+
+    size_t range = (size_t)(n / PH_HD_LOAD_FACTOR) + 1;
+    size_t remap_at = align_up(t->m * sizeof(uint16_t), sizeof(uint32_t));
+    size_t slots_at = align_up(remap_at + (range - n) * sizeof(uint32_t), sizeof(ph_slot_t));
+    size_t total = slots_at + slot_storage_size(t, n);
+
+    int rc = -1;
+    size_t *order = malloc(sizeof(size_t) * (t->m ? t->m : 1));
+    size_t *by_size = NULL;
+    unsigned char *taken = calloc((range + 7) / 8, 1);
+    size_t *pos = NULL;
+    const char **placed = calloc(range, sizeof(char *));
+    t->mem = calloc(1, total);
+    if(!order || !taken || !placed || !t->mem) goto done;
+
+    // bucket sort the buckets by size, largest first
+    size_t max_k = 0;
+    for(size_t b = 0; b < t->m; b++) {
+        size_t k = key_start[b + 1] - key_start[b];
+        if(k > max_k) max_k = k;
+    }
+    by_size = calloc(max_k + 2, sizeof(size_t));
+    pos = malloc(sizeof(size_t) * (max_k + 1));
+    if(!by_size || !pos) goto done;
+    for(size_t b = 0; b < t->m; b++) by_size[max_k - (key_start[b + 1] - key_start[b]) + 1]++;
+    for(size_t i = 0; i <= max_k; i++) by_size[i + 1] += by_size[i];
+    for(size_t b = 0; b < t->m; b++) order[by_size[max_k - (key_start[b + 1] - key_start[b])]++] = b;
+
+    t->mem_bytes = total;
+    t->pilot_range = range;
+    t->pilots = (uint16_t *)t->mem;
+    t->remap = (uint32_t *)((char *)t->mem + remap_at);
+    if(carve_slot_storage(t, slots_at, n) != 0) goto done;
+
+    for(size_t o = 0; o < t->m; o++) {
+        size_t b = order[o];
+        size_t k = key_start[b + 1] - key_start[b];
+        if(k == 0) break; // sorted, only empty buckets remain
+
+        const uint64_t *kh = grouped_hashes + key_start[b];
+        int attempt = 0;
+        unsigned int pilot = 0;
+
+        for(;; pilot++) {
+            attempt++;
+            if(pilot > UINT16_MAX) {
+                rc = 1;
+                goto done;
+            }
+
+            uint64_t ph = ph_pilot_hash(pilot, t->level1_seed);
+            size_t i = 0;
+            for(; i < k; i++) {
+                pos[i] = ph_displace(kh[i], ph, range);
+                if(taken[pos[i] >> 3] & (1u << (pos[i] & 7))) break;
+                size_t j = 0;
+                while(j < i && pos[j] != pos[i]) j++;
+                if(j < i) break;
+            }
+            if(i == k) break;
+            if(metrics) metrics->total_collisions++;
+        }
+
+        t->pilots[b] = (uint16_t)pilot;
+        for(size_t i = 0; i < k; i++) {
+            taken[pos[i] >> 3] |= (unsigned char)(1u << (pos[i] & 7));
+            placed[pos[i]] = grouped[key_start[b] + i];
+        }
+
+        if(metrics) {
+            metrics->total_attempts += attempt;
+            metrics->total_buckets_processed++;
+            if(attempt > metrics->max_attemps_bucket) {
+                metrics->max_attemps_bucket = attempt;
+            }
+        }
+    }
+
+    // every key sitting past n moves into a hole below n
+    size_t hole = 0;
+    for(size_t p = 0; p < n; p++) t->slots[p].key = placed[p];
+    for(size_t p = n; p < range; p++) {
+        if(!placed[p]) continue;
+        while(t->slots[hole].key) hole++;
+        t->slots[hole].key = placed[p];
+        t->remap[p - n] = (uint32_t)hole;
+    }
+    rc = 0;
+
+done:
+    free(order);
+    free(by_size);
+    free(taken);
+    free(pos);
+    free(placed);
+    free(grouped);
+    free(grouped_hashes);
+    free(key_start);
+    if(rc != 0) release_layout(t);
+    ph_phase(opts, PH_PHASE_LEVEL2, 0);
+    return rc;
+}
+
+
+/**
+ * @brief Stores the length and fingerprint of every key at its slot, once
+ *        every bucket's function is final.
+ */
+static void fill_slot_metadata(ph_table *t, const size_t *lens, const uint64_t *hashes) {
+    for(size_t i = 0; i < t->n; i++) {
+        size_t slot = slot_in_bucket(t, hashes[i], bucket_of(t, hashes[i]));
+        t->slots[slot].len = (uint32_t)lens[i];
+        t->slots[slot].fingerprint = table_fingerprint(t, hashes[i]);
+    }
+}
 
 ph_table *ph_build(char **keys, size_t n, size_t max_str_len, int hash_type, build_metrics_t *metrics) { 
+    (void)max_str_len; // keys are no longer bounded by it, kept for callers
+    return ph_build_opts(keys, n, hash_type, NULL, metrics);
+}
+
+ph_table *ph_build_parallel(char **keys, size_t n, size_t max_str_len, int hash_type,
+    int num_threads, build_metrics_t *metrics) {
+    (void)max_str_len;
+    ph_build_opts_t opts = { .num_threads = num_threads };
+    return ph_build_opts(keys, n, hash_type, &opts, metrics);
+}
+
+ph_table *ph_build_opts(char **keys, size_t n, int hash_type, const ph_build_opts_t *opts,
+    build_metrics_t *metrics) {
+
+    size_t *lens = malloc(sizeof(size_t) * (n ? n : 1));
+    if(!lens) return NULL;
+    for(size_t i = 0; i < n; i++) lens[i] = strlen(keys[i]);
+
+    ph_table *t = ph_build_n(keys, lens, n, hash_type, opts, metrics);
+    free(lens);
+    return t;
+}
+
+ph_table *ph_build_n(char **keys, const size_t *lens, size_t n, int hash_type, const ph_build_opts_t *opts,
+    build_metrics_t *metrics) {
+
+    ph_build_opts_t defaults = { 0 };
+    if(!opts) opts = &defaults;
+
+    uint64_t *hashes = calloc(n ? n : 1, sizeof(uint64_t));
+    if(!hashes) return NULL;
+    ph_phase(opts, PH_PHASE_HASH, 1);
+    int rc = 0;
+    if(opts->num_threads > 1) {
+        rc = hash_keys_parallel(keys, lens, n, hashes, opts->num_threads);
+    } else {
+        for(size_t i = 0; i < n; i++) hashes[i] = ph_key_hash(keys[i], lens[i]);
+    }
+    ph_phase(opts, PH_PHASE_HASH, 0);
+    if(rc != 0) {
+        free(hashes);
+        return NULL;
+    }
+
+    ph_table *t = build_hashed(keys, lens, hashes, n, hash_type, opts, metrics);
+    free(hashes);
+    return t;
+}
+
+/**
+ * @brief ph_build_n() over key hashes the caller computed, which must be
+ *        distinct. The table only finds keys whose lookup hashes them the
+ *        same way, so it is for callers that bring their own lookup (the
+ *        code generator) rather than ph_lookup().
+ *
+ * @param opts Build settings, not NULL
+ */
+ph_table *build_hashed(char **keys, const size_t *lens, const uint64_t *hashes, size_t n, int hash_type,
+    const ph_build_opts_t *opts, build_metrics_t *metrics) {
+
+    if(opts->fingerprint_bits != 0 && opts->fingerprint_bits != 8 && opts->fingerprint_bits != 16) return NULL;
+    if(opts->level1_load < 0 || opts->bits_per_key < 0) return NULL;
+
     ph_table *t = calloc(1, sizeof(ph_table));  
+    if(!t) return NULL; 
 
     if(metrics) { 
         metrics->total_attempts = 0; 
         metrics->max_attemps_bucket = 0; 
         metrics->total_buckets_processed = 0; 
         metrics->total_collisions = 0; 
+        metrics->level1_draws = 0;
+        metrics->loosened_buckets = 0;
     }
 
-    build_first_level_bucketing(t, keys, n, max_str_len); 
-    for(size_t i = 0; i < t->m; i++) { 
-        build_second_level_bucketing(&t->buckets[i], max_str_len, hash_type, metrics);
+    t->n = n;
+    t->m = first_level_size(n, hash_type, opts->level1_load);
+    if(t->m > UINT32_MAX) goto fail; // buckets are reduced 32-bit
+    t->hash_type = hash_type;
+    t->seed = opts->seed ? opts->seed : fresh_seed();
+    t->fingerprint_bits = opts->fingerprint_bits;
+    t->own_keys = opts->own_keys;
+    t->num_threads = opts->num_threads;
+    t->level1_load = opts->level1_load;
+    t->max_bucket_attempts = opts->max_bucket_attempts;
+    t->bits_per_key = opts->bits_per_key;
+    for(size_t i = 0; i < n; i++) {
+        if(lens[i] > UINT32_MAX - 1) goto fail; // slots keep 32-bit lengths
+        if(t->own_keys && lens[i] > PH_INLINE_KEY_LEN) t->pool_bytes += lens[i] + 1;
     }
+
+    int rc;
+    if(hash_type == PH_HASH_DISPLACE) {
+        // pilots are placed into one shared slot array, so this stays serial
+        ph_rng_t level1 = ph_rng_stream(t->seed, PH_STREAM_LEVEL1);
+        int draw = 0;
+        do {
+            if(metrics) metrics->level1_draws++;
+            rc = build_hash_displace(t, keys, hashes, &level1, opts, metrics);
+        } while(rc == 1 && ++draw < PH_HD_LEVEL1_TRIES);
+    } else {
+        rc = build_fks(t, keys, hashes, opts, metrics);
+    }
+    if(rc != 0) goto fail;
+
+    ph_phase(opts, PH_PHASE_FINISH, 1);
+    fill_slot_metadata(t, lens, hashes);
+    if(t->own_keys) own_keys(t);
+    if(opts->allocator && move_storage(t, opts->allocator) != 0) {
+        ph_free(t);
+        return NULL; 
+    }
+    ph_phase(opts, PH_PHASE_FINISH, 0);
     return t; 
+
+fail:
+    free(t);
+    return NULL;
+}
+
+/**
+ * @brief The stored key bytes of slot that key must be compared against:
+ *        the caller's key, or with owned keys the key ref itself (short
+ *        keys) or the pool. NULL when the slot is empty or the stored length
+ *        (or, with owned keys, prefix) already tells the keys apart.
+ */
+static inline const char *slot_key(const ph_table *t, size_t slot, const char *key, size_t len) {
+    if(!t->own_keys) return (t->slots[slot].len == len) ? t->slots[slot].key : NULL;
+
+    const ph_key_ref_t *ref = &t->keys[slot];
+    if(ref->len != len) return NULL; // also rejects PH_EMPTY_SLOT
+    if(len <= PH_INLINE_KEY_LEN) return ref->bytes;
+    if(memcmp(ref->bytes, key, PH_KEY_PREFIX_LEN) != 0) return NULL;
+
+    uint64_t offset;
+    memcpy(&offset, ref->bytes + PH_KEY_PREFIX_LEN, sizeof(offset));
+    return t->pool + offset;
+}
+
+static inline int slot_key_equals(const char *stored, const char *key, size_t len) {
+    return stored && memcmp(stored, key, len) == 0; // lengths already match
+}
+
+/**
+ * @brief ph_lookup_slot() for a key whose length and key hash are known.
+ */
+size_t lookup_slot_hashed(ph_table *t, const char *key, size_t len, uint64_t kh) {
+    if(t->m == 0) return PH_NO_SLOT;
+
+    size_t slot = slot_in_bucket(t, kh, bucket_of(t, kh));
+    if(slot == PH_NO_SLOT || !fingerprint_matches(t, slot, kh)) return PH_NO_SLOT;
+
+    return slot_key_equals(slot_key(t, slot, key, len), key, len) ? slot : PH_NO_SLOT;
+}
+
+size_t ph_lookup_slot_n(ph_table *t, const char *key, size_t len) {
+    return lookup_slot_hashed(t, key, len, ph_key_hash(key, len));
+}
+
+int ph_lookup_n(ph_table *t, const char *key, size_t len) {
+    return (ph_lookup_slot_n(t, key, len) == PH_NO_SLOT) ? -1 : 0;
+}
+
+size_t ph_lookup_slot(ph_table *t, const char *key) {
+    return ph_lookup_slot_n(t, key, strlen(key));
 }
 
 int ph_lookup(ph_table *t, const char *key) { 
-    
-    unsigned int h1 = universal_hash(key, &t->level1_params) % t->m; 
-    ph_bucket_t *b = &t->buckets[h1]; 
+    return ph_lookup_n(t, key, strlen(key));
+}
 
-    if(b->key_count == 0) return -1; 
-    if(b->key_count == 1) { 
-         return strcmp(b->keys[0], key) == 0 ? 0 : -1; 
+static inline void prefetch_slot(const ph_table *t, size_t slot) {
+    if(t->own_keys) __builtin_prefetch(&t->keys[slot]);
+    else __builtin_prefetch(&t->slots[slot]);
+}
+
+/**
+ * @brief Looks up a whole batch, PH_BATCH_GROUP keys at a time. Each group
+ *        goes through the lookup in stages, and every stage prefetches what
+ *        the next one will read for all keys of the group: hash the keys and
+ *        prefetch their bucket metadata, resolve the slots and prefetch them,
+ *        load the candidate pointers and prefetch the key bytes, compare. The
+ *        loads of one key are then in flight while the others are hashed.
+ *        PH_HASH_DISPLACE keys that land past n take one more stage, which
+ *        prefetches their remap entry before it is read.
+ */
+void ph_lookup_batch(ph_table *t, char **keys, size_t n, int *results) {
+    uint64_t kh[PH_BATCH_GROUP];
+    size_t len[PH_BATCH_GROUP];
+    size_t bucket[PH_BATCH_GROUP];
+    size_t slot[PH_BATCH_GROUP];
+    const char *cand[PH_BATCH_GROUP];
+
+    if(t->m == 0) {
+        for(size_t i = 0; i < n; i++) results[i] = -1;
+        return;
     }
 
-    unsigned int h2 = universal_hash(key, &b->params) % b->table_size; 
-    return (b->keys[h2] && strcmp(b->keys[h2], key) == 0) ? 0 : -1; 
+    for(size_t base = 0; base < n; base += PH_BATCH_GROUP) {
+        size_t g = (n - base < PH_BATCH_GROUP) ? n - base : PH_BATCH_GROUP;
+        char **k = keys + base;
+
+        for(size_t i = 0; i < g; i++) {
+            len[i] = strlen(k[i]);
+            kh[i] = ph_key_hash(k[i], len[i]);
+            bucket[i] = bucket_of(t, kh[i]);
+            if(t->hash_type == PH_HASH_DISPLACE) __builtin_prefetch(&t->pilots[bucket[i]]);
+            else __builtin_prefetch(&t->params[bucket[i]]);
+        }
+
+        if(t->hash_type == PH_HASH_DISPLACE) {
+            for(size_t i = 0; i < g; i++) {
+                slot[i] = displaced_position(t, kh[i], bucket[i]);
+                if(slot[i] >= t->n) __builtin_prefetch(&t->remap[slot[i] - t->n]);
+                else prefetch_slot(t, slot[i]);
+            }
+            for(size_t i = 0; i < g; i++) {
+                if(slot[i] < t->n) continue;
+                slot[i] = t->remap[slot[i] - t->n];
+                prefetch_slot(t, slot[i]);
+            }
+        } else {
+            for(size_t i = 0; i < g; i++) {
+                slot[i] = slot_in_bucket(t, kh[i], bucket[i]);
+                if(slot[i] != PH_NO_SLOT) prefetch_slot(t, slot[i]);
+            }
+        }
+
+        // a fingerprint mismatch settles the miss before the key is touched
+        for(size_t i = 0; i < g; i++) {
+            int live = slot[i] != PH_NO_SLOT && fingerprint_matches(t, slot[i], kh[i]);
+            cand[i] = live ? slot_key(t, slot[i], k[i], len[i]) : NULL;
+            if(cand[i]) __builtin_prefetch(cand[i]);
+        }
+
+        for(size_t i = 0; i < g; i++) {
+            results[base + i] = slot_key_equals(cand[i], k[i], len[i]) ? 0 : -1;
+        }
+    }
 }
 
 void ph_free(ph_table *t) { 
     if(!t) return; 
 
-    free_universal_hash(&t->level1_params); 
-    for(size_t i = 0; i < t->m; i++) { 
-        ph_bucket_t *b =  &t->buckets[i]; 
-        free_universal_hash(&b->params); 
-        free(b->keys); 
-    }
-    free(t->buckets); 
+    if(t->map) munmap(t->map, t->map_bytes);
+    if(t->dyn) release_dynamic(t);
+    release_table_mem(t);
     free(t); 
 }
@@ -1,11 +1,148 @@
 #ifndef HASH_H
-#define HASh_H
+#define HASH_H
 
 #include <stddef.h>
+#include <stdint.h>
 
+/**
+ * Every key is hashed exactly once, by first_level_hashing(), into a 64-bit
+ * key hash that is shared by the whole table. Both levels are derived from
+ * it: a bucket's function is nothing more than a 32-bit seed remixed into
+ * the key hash, so building or retrying a bucket never touches the string
+ * again.
+ */
 
-
-unsigned int first_level_hashing(const char *s); 
+uint64_t first_level_hashing(const char *s);
 unsigned int second_level_hashing(const char *s, unsigned int seed);
 
+/**
+ * Key hash kernels (hash_kernels.c). They all compute the same function,
+ * bit for bit; ph_key_hash() uses the widest one the CPU supports, chosen
+ * once at load time.
+ */
+#define PH_KERNEL_SCALAR 0
+#define PH_KERNEL_SSE2 1
+#define PH_KERNEL_AVX2 2
+#define PH_KERNEL_COUNT 3
+
+uint64_t ph_key_hash(const void *s, size_t len);
+uint64_t ph_key_hash_with(int kernel, const void *s, size_t len);
+int ph_key_hash_kernel_supported(int kernel);
+const char *ph_key_hash_kernel_name(int kernel);
+
+/**
+ * @brief murmur3's 64-bit finaliser.
+ */
+static inline uint64_t ph_fmix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+/**
+ * Seeded generator for everything a build draws (level 1 seeds, bucket
+ * seeds): splitmix64, one 64-bit add and a finaliser per draw. A table's
+ * seed is split into independent streams with ph_rng_stream(): stream 0
+ * for level 1 and bucket b's own stream PH_STREAM_BUCKET + b, so buckets
+ * never share generator state and the table depends only on the seed and
+ * the keys, not on how buckets are spread over threads.
+ */
+typedef struct {
+    uint64_t state;
+} ph_rng_t;
+
+#define PH_STREAM_LEVEL1 0
+#define PH_STREAM_UPDATES 1 // ph_insert() / ph_delete()
+#define PH_STREAM_BUCKET 2
+
+static inline uint64_t ph_rng_next(ph_rng_t *r) {
+    uint64_t z = (r->state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static inline ph_rng_t ph_rng_stream(uint64_t seed, uint64_t stream) {
+    ph_rng_t r = { ph_fmix64(seed ^ ph_fmix64((stream + 1) * 0x9e3779b97f4a7c15ull)) };
+    return r;
+}
+
+/**
+ * @brief second_level_hashing() for a key whose first level hash is already
+ *        known.
+ */
+static inline unsigned int ph_mix(uint64_t key_hash, unsigned int seed) {
+    return (unsigned int)ph_fmix64(key_hash ^ ((uint64_t)seed * 0x9e3779b97f4a7c15ull));
+}
+
+/**
+ * @brief 16-bit fingerprint of a key hash (its top byte is the 8-bit one).
+ *        A multiplicative hash of the key hash, so it is unrelated to the
+ *        bucket and slot a key is sent to.
+ */
+static inline uint16_t ph_fingerprint(uint64_t key_hash) {
+    return (uint16_t)((key_hash * 0xd6e8feb86659fd93ull) >> 48);
+}
+
+/**
+ * @brief Hash that picks a key's shard in an external build (ph_external.c):
+ *        its top bits index the shard directory. Salted so it is unrelated
+ *        to the bucket the key gets inside its shard.
+ */
+static inline uint64_t ph_shard_hash(uint64_t key_hash) {
+    return ph_fmix64(key_hash ^ 0x2545f4914f6cdd1dull);
+}
+
+/**
+ * @brief Multiply-shift hash of a 64-bit key onto [0, range): a * x mod 2^64
+ *        with a odd, of which the high bits are kept by scaling with range.
+ *        Universal over the odd multipliers, and a multiply plus a multiply
+ *        high per key.
+ */
+static inline size_t ph_mulshift(uint64_t x, uint64_t a, uint64_t range) {
+    return (size_t)(((unsigned __int128)(a * x) * range) >> 64);
+}
+
+/**
+ * @brief Maps a 32-bit hash onto [0, range) with a multiply instead of a mod.
+ */
+static inline unsigned int ph_reduce(unsigned int h, unsigned int range) {
+    return (unsigned int)(((uint64_t)h * range) >> 32);
+}
+
+/**
+ * @brief Slot position of a key in a PH_HASH_DISPLACE table: the key hash is
+ *        displaced by a hash of its bucket's pilot and mapped onto [0, range).
+ *        The pilot hash is shared by the whole bucket, so the pilot search
+ *        pays one finaliser per attempt rather than one per key.
+ */
+static inline uint64_t ph_pilot_hash(unsigned int pilot, unsigned int seed) {
+    return ph_fmix64(((uint64_t)seed << 32 | pilot) * 0x9e3779b97f4a7c15ull);
+}
+
+static inline size_t ph_displace(uint64_t key_hash, uint64_t pilot_hash, size_t range) {
+    // the multiply carries every bit of the xor into the high bits that
+    // survive the range reduction, otherwise a small range would only ever
+    // see the key hash's top bits and no pilot could move the key
+    uint64_t x = (key_hash ^ pilot_hash) * 0x9e3779b97f4a7c15ull;
+    return (size_t)(((unsigned __int128)x * range) >> 64);
+}
+
+/**
+ * @brief Level 1 bucket for PH_HASH_DISPLACE tables. Buckets are skewed so that
+ *        60% of the keys land in the first 30% of the buckets: those dense
+ *        buckets are placed first while the slot array is still mostly empty,
+ *        leaving the small buckets to fill the last gaps cheaply.
+ */
+static inline unsigned int ph_skew_bucket(uint64_t key_hash, unsigned int seed, unsigned int m) {
+    uint64_t x = ph_fmix64(key_hash ^ ((uint64_t)seed * 0x9e3779b97f4a7c15ull));
+    unsigned int dense = (unsigned int)(m * 3 / 10) + 1;
+    if(dense >= m) return ph_reduce((unsigned int)x, m);
+    if((unsigned int)(x >> 32) < 2576980378u) return ph_reduce((unsigned int)x, dense);
+    return dense + ph_reduce((unsigned int)x, m - dense);
+}
+
 #endif
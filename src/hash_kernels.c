@@ -0,0 +1,242 @@
+#include <string.h>
+
+#include "hash.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define PH_HAVE_X86_KERNELS 1
+#endif
+
+/**
+ * The key hash is a polynomial hash over the key's 16-bit chunks, modulo
+ * the Mersenne prime p = 2^31 - 1. Chunk c of the key goes to lane c % 8,
+ * and every lane runs Horner's rule for two polynomials (bases Q0 and Q1):
+ *
+ *      acc = fold(acc * Q + chunk)
+ *
+ * fold(x) = (x & p) + (x >> 31) is the divide-free reduction x mod p allows
+ * because 2^31 = 1 (mod p). One fold is enough per step: with Q < 2^29 the
+ * accumulator stays below 2^32, so the next multiply is a 32 x 32 -> 64 bit
+ * product. That is exactly what _mm_mul_epu32/_mm256_mul_epu32 compute, so
+ * the SSE2 and AVX2 kernels run the same steps on 2 or 4 lanes at a time and
+ * give bit-identical results to the scalar kernel. Eight lanes (16-byte
+ * blocks) give even the AVX2 kernel four independent multiply chains.
+ *
+ * The last block is zero padded. At the end every accumulator is fully
+ * reduced and the two of a lane are packed into one 64-bit word. The words
+ * are combined pairwise with a 64 x 64 -> 128 bit multiply whose halves are
+ * xored (finish()), the products are summed with the length, and the sum
+ * goes through ph_fmix64(). The combine has to be nonlinear: a weighted sum
+ * of the lanes would make a short key's hash a small knapsack of its
+ * chunks, and distinct keys would share a key hash that no build seed can
+ * separate. The vector kernels store their accumulators and share finish()
+ * with the scalar kernel.
+ */
+
+#define PRIME31 0x7fffffffull
+#define Q0 0x1c6b1a5dull
+#define Q1 0x0d2f8e37ull
+#define LANES 8
+#define BLOCK (2 * LANES) // bytes consumed per step
+#define LEN_WEIGHT 0xff51afd7ed558ccdull
+
+// A packed lane is below 2^63, so with bit 63 set in every salt no
+// multiplicand is ever 0
+static const uint64_t lane_salts[LANES] = {
+    0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6e3ull, 0xd6e8feb86659fd93ull,
+    0x9e3779b97f4a7c15ull, 0xbf58476d1ce4e5b9ull, 0x94d049bb133111ebull, 0xc2b2ae3d27d4eb4full,
+};
+
+static inline uint64_t fold(uint64_t x) {
+    return (x & PRIME31) + (x >> 31);
+}
+
+static inline uint64_t chunk_at(const unsigned char *s, int c) {
+    return (uint64_t)s[2 * c] | ((uint64_t)s[2 * c + 1] << 8);
+}
+
+/**
+ * @brief Hash of the fully reduced accumulators (Q0 lanes, then Q1 lanes)
+ *        of a key of len bytes.
+ */
+static uint64_t finish(const uint64_t acc[2 * LANES], size_t len) {
+    uint64_t h = (uint64_t)len * LEN_WEIGHT;
+    for(int l = 0; l < LANES; l += 2) {
+        uint64_t a = (acc[l] << 32 | acc[l + LANES]) ^ lane_salts[l];
+        uint64_t b = (acc[l + 1] << 32 | acc[l + 1 + LANES]) ^ lane_salts[l + 1];
+        unsigned __int128 m = (unsigned __int128)a * b;
+        h += (uint64_t)m ^ (uint64_t)(m >> 64);
+    }
+    return ph_fmix64(h);
+}
+
+static uint64_t key_hash_scalar(const unsigned char *s, size_t len) {
+    uint64_t acc[2 * LANES] = { 0 };
+    unsigned char tail[BLOCK] = { 0 };
+
+    for(size_t i = 0; i < len; i += BLOCK) {
+        const unsigned char *block = s + i;
+        if(i + BLOCK > len) { // zero padded last block
+            memcpy(tail, s + i, len - i);
+            block = tail;
+        }
+        for(int l = 0; l < LANES; l++) {
+            acc[l] = fold(acc[l] * Q0 + chunk_at(block, l));
+            acc[l + LANES] = fold(acc[l + LANES] * Q1 + chunk_at(block, l));
+        }
+    }
+
+    for(int l = 0; l < 2 * LANES; l++) {
+        acc[l] = fold(acc[l]);
+        if(acc[l] >= PRIME31) acc[l] -= PRIME31;
+    }
+    return finish(acc, len);
+}
+
+#ifdef PH_HAVE_X86_KERNELS
+
+/**
+ * The vector kernels load the partial last block whole and clear the bytes
+ * past the key with a mask, as long as the load can't cross into the next
+ * page; otherwise they copy it out like the scalar kernel. That load reads
+ * past the end of the key on purpose, so it is hidden from ASan and TSan.
+ */
+static const unsigned char tail_mask[2 * BLOCK] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
+__attribute__((target("sse2"), no_sanitize("address", "thread")))
+static inline __m128i load_block(const unsigned char *s, size_t rem) {
+    if(rem >= BLOCK) return _mm_loadu_si128((const __m128i *)s);
+    if(((uintptr_t)s & 4095) <= 4096 - BLOCK) {
+        __m128i mask = _mm_loadu_si128((const __m128i *)(tail_mask + BLOCK - rem));
+        return _mm_and_si128(_mm_loadu_si128((const __m128i *)s), mask);
+    }
+    unsigned char tail[BLOCK] = { 0 };
+    memcpy(tail, s, rem);
+    return _mm_loadu_si128((const __m128i *)tail);
+}
+
+/*
+ * Accumulators are below 2^32, so one fold leaves r in [0, p + 1]. Folding
+ * r + 1 once more and taking the 1 back off maps p and p + 1 onto 0 and 1
+ * without a 64-bit compare, which SSE2 lacks.
+ */
+#define STEP_SSE2(a, q, c) \
+    a = _mm_add_epi64(_mm_mul_epu32(a, q), c); \
+    a = _mm_add_epi64(_mm_and_si128(a, p), _mm_srli_epi64(a, 31))
+#define REDUCE_SSE2(a) \
+    a = _mm_add_epi64(_mm_and_si128(a, p), _mm_srli_epi64(a, 31)); \
+    a = _mm_add_epi64(a, one); \
+    a = _mm_sub_epi64(_mm_add_epi64(_mm_and_si128(a, p), _mm_srli_epi64(a, 31)), one)
+
+__attribute__((target("sse2")))
+static uint64_t key_hash_sse2(const unsigned char *s, size_t len) {
+    const __m128i q0 = _mm_set1_epi64x(Q0), q1 = _mm_set1_epi64x(Q1);
+    const __m128i p = _mm_set1_epi64x(PRIME31), one = _mm_set1_epi64x(1);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i a[8] = { zero, zero, zero, zero, zero, zero, zero, zero }; // Q0 lanes, then Q1
+
+    for(size_t i = 0; i < len; i += BLOCK) {
+        __m128i x = load_block(s + i, len - i);
+        __m128i lo = _mm_unpacklo_epi16(x, zero); // chunks 0..3 as 32-bit
+        __m128i hi = _mm_unpackhi_epi16(x, zero); // chunks 4..7
+        __m128i c[4] = {
+            _mm_unpacklo_epi32(lo, zero), _mm_unpackhi_epi32(lo, zero),
+            _mm_unpacklo_epi32(hi, zero), _mm_unpackhi_epi32(hi, zero),
+        };
+        for(int v = 0; v < 4; v++) {
+            STEP_SSE2(a[v], q0, c[v]);
+            STEP_SSE2(a[v + 4], q1, c[v]);
+        }
+    }
+
+    uint64_t acc[2 * LANES];
+    for(int v = 0; v < 8; v++) {
+        REDUCE_SSE2(a[v]);
+        _mm_storeu_si128((__m128i *)(acc + 2 * v), a[v]);
+    }
+    return finish(acc, len);
+}
+
+#define STEP_AVX2(a, q, c) \
+    a = _mm256_add_epi64(_mm256_mul_epu32(a, q), c); \
+    a = _mm256_add_epi64(_mm256_and_si256(a, p), _mm256_srli_epi64(a, 31))
+#define REDUCE_AVX2(a) \
+    a = _mm256_add_epi64(_mm256_and_si256(a, p), _mm256_srli_epi64(a, 31)); \
+    a = _mm256_add_epi64(a, one); \
+    a = _mm256_sub_epi64(_mm256_add_epi64(_mm256_and_si256(a, p), _mm256_srli_epi64(a, 31)), one)
+
+__attribute__((target("avx2")))
+static uint64_t key_hash_avx2(const unsigned char *s, size_t len) {
+    const __m256i q0 = _mm256_set1_epi64x(Q0), q1 = _mm256_set1_epi64x(Q1);
+    const __m256i p = _mm256_set1_epi64x(PRIME31), one = _mm256_set1_epi64x(1);
+    __m256i a[4] = { _mm256_setzero_si256(), _mm256_setzero_si256(),
+                     _mm256_setzero_si256(), _mm256_setzero_si256() }; // Q0 lo/hi, Q1 lo/hi
+
+    for(size_t i = 0; i < len; i += BLOCK) {
+        __m128i x = load_block(s + i, len - i);
+        __m256i c_lo = _mm256_cvtepu16_epi64(x);                    // chunks 0..3
+        __m256i c_hi = _mm256_cvtepu16_epi64(_mm_srli_si128(x, 8)); // chunks 4..7
+
+        STEP_AVX2(a[0], q0, c_lo);
+        STEP_AVX2(a[1], q0, c_hi);
+        STEP_AVX2(a[2], q1, c_lo);
+        STEP_AVX2(a[3], q1, c_hi);
+    }
+
+    uint64_t acc[2 * LANES];
+    for(int v = 0; v < 4; v++) {
+        REDUCE_AVX2(a[v]);
+        _mm256_storeu_si256((__m256i *)(acc + 4 * v), a[v]);
+    }
+    return finish(acc, len);
+}
+
+#endif
+
+typedef uint64_t (*key_hash_fn)(const unsigned char *, size_t);
+
+static key_hash_fn key_hash_kernel = key_hash_scalar;
+
+/**
+ * @brief Picks the widest kernel the CPU supports once, at load time.
+ */
+__attribute__((constructor))
+static void select_key_hash_kernel(void) {
+    for(int k = PH_KERNEL_COUNT - 1; k > PH_KERNEL_SCALAR; k--) {
+        if(!ph_key_hash_kernel_supported(k)) continue;
+#ifdef PH_HAVE_X86_KERNELS
+        key_hash_kernel = (k == PH_KERNEL_AVX2) ? key_hash_avx2 : key_hash_sse2;
+#endif
+        return;
+    }
+}
+
+int ph_key_hash_kernel_supported(int kernel) {
+    if(kernel == PH_KERNEL_SCALAR) return 1;
+#ifdef PH_HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if(kernel == PH_KERNEL_SSE2) return __builtin_cpu_supports("sse2");
+    if(kernel == PH_KERNEL_AVX2) return __builtin_cpu_supports("avx2");
+#endif
+    return 0;
+}
+
+const char *ph_key_hash_kernel_name(int kernel) {
+    static const char *names[PH_KERNEL_COUNT] = { "scalar", "sse2", "avx2" };
+    return (kernel >= 0 && kernel < PH_KERNEL_COUNT) ? names[kernel] : "unknown";
+}
+
+uint64_t ph_key_hash(const void *s, size_t len) {
+    return key_hash_kernel((const unsigned char *)s, len);
+}
+
+uint64_t ph_key_hash_with(int kernel, const void *s, size_t len) {
+#ifdef PH_HAVE_X86_KERNELS
+    if(kernel == PH_KERNEL_AVX2) return key_hash_avx2((const unsigned char *)s, len);
+    if(kernel == PH_KERNEL_SSE2) return key_hash_sse2((const unsigned char *)s, len);
+#endif
+    (void)kernel;
+    return key_hash_scalar((const unsigned char *)s, len);
+}
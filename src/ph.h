@@ -2,39 +2,155 @@
 #define PH_H
 
 #include <stddef.h> 
+#include <stdint.h>
 
 /**
- * Note that this version of perfect hashing is static meaning the input 
- * keys are static throughout the use of the hash table. Performing insertion
- * and deletion operations will require us to rebuild the entire table to 
- * accommodate for the changes. -> 
- *      - O(L) Amortized Lookup, 
+ * Tables are built from a static key set. FKS tables can then be updated in
+ * place with ph_insert() and ph_delete() (see ph_dynamic.c), which rebuild
+ * only the affected second level bucket and rebuild the whole table only
+ * once enough updates have accumulated. ->
+ *      - O(L) Worst Case Lookup, 
  *      - O(nL) Expected Build 
+ *      - O(L) Amortized Expected Insert / Delete
  * 
  * n: Number of keys 
  * L: Max string length 
  */
 
-typedef struct { 
-    unsigned int prime; 
-    unsigned int table_size; 
-    unsigned int rand_additive; 
-    unsigned int max_str_len; 
-    unsigned int* coeff_array; 
-} Universal_Hash_Params; 
+/**
+ * Values for ph_build's hash_type:
+ *      - PH_FKS_QUADRATIC: FKS with k^2 slots per bucket of k keys (O(n^2) worst case)
+ *      - PH_FKS_MINIMAL:   FKS with k slots per bucket (minimal, retry heavy)
+ *      - PH_HASH_DISPLACE: hash-and-displace MPHF, n / PH_HD_BUCKET_LOAD buckets
+ *                          that each store a 16-bit pilot instead of a table
+ */
+#define PH_FKS_QUADRATIC 0
+#define PH_FKS_MINIMAL 1
+#define PH_HASH_DISPLACE 2
+
+#define PH_HD_BUCKET_LOAD 4 // avg keys per bucket for PH_HASH_DISPLACE
+#define PH_HD_LOAD_FACTOR 0.95 // n / pilot_range for PH_HASH_DISPLACE
+#define PH_HD_LEVEL1_TRIES 16 // level 1 draws before a PH_HASH_DISPLACE build gives up
+
+#define PH_FKS_BUCKET_ATTEMPTS 1024 // default seeds a bucket tries before its table is loosened
+#define PH_FKS_LEVEL1_TRIES 16 // level 1 draws before an FKS build gives up
+#define PH_FKS_SKEW 2.0 // sum of k^2 over buckets tolerated, relative to its expectation
+
+/**
+ * A bucket's second level hash function is a seed on top of the table-wide
+ * key hash (see hash.h); table_size is the number of slots the bucket owns,
+ * starting at slot offset. The record is padded to 16 bytes so that it
+ * never straddles two cache lines.
+ */
+typedef struct {
+    uint32_t seed;
+    uint32_t table_size;
+    uint32_t offset;
+    uint32_t unused;
+} ph_bucket_params_t;
+
+/**
+ * A slot of a table that points at its caller's keys: the key (NULL when
+ * the slot is empty), its length and the fingerprint of its key hash (see
+ * ph_build_opts_t.fingerprint_bits), in 16 bytes.
+ */
+typedef struct {
+    const char *key;
+    uint32_t len;
+    uint16_t fingerprint;
+    uint16_t unused;
+} ph_slot_t;
+
+#define PH_INLINE_KEY_LEN 10 // owned keys up to this length live in their slot
+#define PH_KEY_PREFIX_LEN 2 // bytes of a longer owned key kept in its slot
+#define PH_EMPTY_SLOT UINT32_MAX // ph_key_ref_t.len of a slot without a key
 
+/**
+ * An owned key's slot: its length and fingerprint, then either the key
+ * itself (len <= PH_INLINE_KEY_LEN) or its first PH_KEY_PREFIX_LEN bytes
+ * followed by the 64-bit offset of the whole key in the table's pool.
+ * Lookups compare the length and prefix before touching the pool.
+ */
+typedef struct {
+    uint32_t len;
+    uint16_t fingerprint;
+    char bytes[PH_INLINE_KEY_LEN];
+} ph_key_ref_t;
+
+/**
+ * Source of a table's storage. alloc returns bytes of memory, aligned to at
+ * least 64 bytes and not necessarily zeroed, or NULL. free gets back what
+ * alloc returned, with the same size, when the table is freed or its
+ * storage moves; it may be NULL when the memory is released all at once
+ * (as an arena's is).
+ */
 typedef struct { 
-    char **keys; 
-    size_t key_count; 
-    size_t table_size; 
-    Universal_Hash_Params params; 
-} ph_bucket_t; 
+    void *(*alloc)(size_t bytes, void *ctx); 
+    void (*free)(void *p, size_t bytes, void *ctx); 
+    void *ctx; 
+} ph_allocator_t; 
 
+/**
+ * The table is frozen once built and lives in a single allocation (mem) that
+ * is carved into two arrays of 16-byte records:
+ *      - params[b]: bucket b's second level seed, slot count and first slot
+ *      - slots:     every bucket's secondary table, back to back
+ *
+ * A lookup reads params[h1] and then goes straight to the slot holding the
+ * candidate key; there are no per-bucket pointers to chase. Every record
+ * sits in one cache line, so a lookup reaches its final key compare after
+ * two of them.
+ *
+ * PH_HASH_DISPLACE tables carve mem into pilots, remap and slots instead:
+ * the key's slot is mix(key hash, pilots[h1]) over pilot_range positions,
+ * and the few positions past n are folded back below n through remap.
+ *
+ * Keys are byte strings of known length (see ph_build_n()), so a slot
+ * (ph_slot_t) holds the key's length next to its pointer. A lookup compares
+ * it before the key bytes, which are then compared with memcmp(). With
+ * fingerprints enabled, the slot also holds an 8 or 16-bit fingerprint of
+ * the key hash, checked first, so most misses never touch key memory.
+ *
+ * With owned keys, slots is replaced by keys (one ph_key_ref_t per slot,
+ * fingerprint included) and mem ends in the pool: every key too long to be
+ * inlined, in slot order and NUL terminated. The caller's key array can
+ * then be freed.
+ *
+ * The first ph_insert() or ph_delete() moves slots out of mem into an
+ * array that can grow (see ph_dynamic.c); mem then holds params only.
+ *
+ * With ph_build_opts_t.allocator, the finished mem is moved into memory from
+ * that allocator (see ph_arena.h for one backed by huge pages), and so are
+ * the arrays of an updated table.
+ */
 typedef struct { 
     size_t n; // num of keys in total
     size_t m; // num of total buckets
-    ph_bucket_t *buckets; // array of buckets 
-    Universal_Hash_Params level1_params;
+    size_t num_slots; // num of second level slots across all buckets
+    ph_bucket_params_t *params;
+    ph_slot_t *slots; // NULL with owned keys
+    void *mem; // backs params and slots
+    size_t mem_bytes;
+    uint32_t level1_seed;
+    uint64_t seed; // the build's seed: ph_build_opts_t.seed rebuilds the same table
+    int hash_type;
+    size_t pilot_range; // PH_HASH_DISPLACE only
+    uint16_t *pilots; // PH_HASH_DISPLACE only, m entries
+    uint32_t *remap; // PH_HASH_DISPLACE only, pilot_range - n entries
+    int fingerprint_bits; // 0, 8 or 16 bits of every slot's fingerprint field
+    int own_keys;
+    ph_key_ref_t *keys; // own_keys only, replaces slots
+    char *pool; // own_keys only
+    size_t pool_bytes;
+    void *map; // file mapping of a table from ph_open_mmap(), NULL otherwise
+    size_t map_bytes;
+    struct ph_dynamic *dyn; // update state, set by the first ph_insert() / ph_delete()
+    // the build's settings, which global rebuilds by ph_insert() / ph_delete() keep
+    int num_threads;
+    double level1_load;
+    int max_bucket_attempts;
+    double bits_per_key;
+    ph_allocator_t allocator; // where mem came from, all zero for malloc()
 } ph_table; 
 
 typedef struct { 
@@ -42,6 +158,8 @@ typedef struct {
     int max_attemps_bucket; 
     int total_buckets_processed; 
     size_t total_collisions;  
+    int level1_draws; // level 1 functions drawn, rejected ones included
+    int loosened_buckets; // FKS: times a bucket hit its attempt cap and was given more slots
 } build_metrics_t;
 
 /**
@@ -50,11 +168,167 @@ typedef struct {
  * */
 ph_table *ph_build(char **keys, size_t n, size_t max_str_len, int hash_type, build_metrics_t *metrics);
 
+/**
+ * @brief ph_build() with the key hashing and the second level spread over
+ *        num_threads threads (work stealing, largest buckets first). The
+ *        pilot search of PH_HASH_DISPLACE places keys into one shared slot
+ *        array and stays serial. num_threads <= 1 is the same as ph_build().
+ */
+ph_table *ph_build_parallel(char **keys, size_t n, size_t max_str_len, int hash_type,
+    int num_threads, build_metrics_t *metrics);
+
+/**
+ * Build phases reported to ph_build_opts_t.phase_hook: hashing the keys,
+ * level 1 (grouping the keys into buckets), level 2 (bucket seeds or
+ * pilots, loosened buckets included) and finishing (slot lengths,
+ * fingerprints and owned keys). A redrawn level 1 runs levels 1 and 2
+ * again, and each run is reported.
+ */
+enum { PH_PHASE_HASH, PH_PHASE_LEVEL1, PH_PHASE_LEVEL2, PH_PHASE_FINISH, PH_NUM_PHASES };
+
+/**
+ * Called on the building thread as phase begins (begin = 1) and ends
+ * (begin = 0), with ph_build_opts_t.phase_ctx. Work done on other threads
+ * of a parallel build happens between the two calls.
+ */
+typedef void (*ph_phase_hook_t)(int phase, int begin, void *ctx);
+
+/**
+ * Optional build settings for ph_build_opts(); zero initialise it (or pass
+ * NULL) for ph_build()'s behaviour.
+ *
+ * The last three bound an FKS build. Level 1 is redrawn while the sum of
+ * k^2 over its buckets is over PH_FKS_SKEW times its expectation, or while
+ * its layout is over the space budget. A bucket that fails max_bucket_attempts
+ * seeds is given a looser table (2k, then k^2 slots, then doubling) and
+ * built again. If a bucket can't be loosened within 4k^2 slots or the
+ * budget, level 1 is redrawn; after PH_FKS_LEVEL1_TRIES draws the build
+ * fails. Every stage is bounded, so the worst case build time is too. A
+ * loosened PH_FKS_MINIMAL bucket is no longer minimal.
+ */
+typedef struct {
+    int num_threads; // see ph_build_parallel(), <= 1 builds serially
+    int fingerprint_bits; // 0 (off), 8 or 16 bits of the key hash checked per slot
+    int own_keys; // copy the keys into the table (see ph_key_ref_t)
+    uint64_t seed; // every seed the build draws comes from it, 0 picks a fresh one
+    double level1_load; // FKS keys per level 1 bucket, 0 for 1
+    int max_bucket_attempts; // 0 for PH_FKS_BUCKET_ATTEMPTS, < 0 never loosens
+    double bits_per_key; // FKS budget for params and slots, 0 for none
+    ph_phase_hook_t phase_hook; // NULL for none
+    void *phase_ctx;
+    const ph_allocator_t *allocator; // storage of the finished (and updated) table, NULL for malloc()
+} ph_build_opts_t;
+
+/**
+ * @brief ph_build() with the settings in opts.
+ *
+ * @return The table, or NULL on failure or invalid opts
+ */
+ph_table *ph_build_opts(char **keys, size_t n, int hash_type, const ph_build_opts_t *opts,
+    build_metrics_t *metrics);
+
+/**
+ * @brief ph_build_opts() over keys given as byte strings: keys[i] is
+ *        lens[i] bytes long and may contain NULs. The NUL terminated
+ *        builds are wrappers that take lens from strlen(). Keys are at most
+ *        UINT32_MAX - 1 bytes.
+ *
+ * @return The table, or NULL on failure or invalid opts
+ */
+ph_table *ph_build_n(char **keys, const size_t *lens, size_t n, int hash_type, const ph_build_opts_t *opts,
+    build_metrics_t *metrics);
+
 /** 
  * @brief Look up a key in the hash table t in the index... 
  */
 int ph_lookup(ph_table *t, const char *key);
 
+/**
+ * @brief ph_lookup() for the len bytes at key, which need not be NUL
+ *        terminated. ph_lookup() is this with strlen(key).
+ */
+int ph_lookup_n(ph_table *t, const char *key, size_t len);
+
+#define PH_NO_SLOT ((size_t)-1)
+
+/**
+ * @brief The slot key occupies in t, in [0, t->num_slots), or PH_NO_SLOT if
+ *        key is not in the table. Slots are fixed once the table is built,
+ *        so they can index arrays kept alongside it (see ph_map.h).
+ */
+size_t ph_lookup_slot(ph_table *t, const char *key);
+
+/**
+ * @brief ph_lookup_slot() for the len bytes at key.
+ */
+size_t ph_lookup_slot_n(ph_table *t, const char *key, size_t len);
+
+#define PH_BATCH_GROUP 16 // keys in flight per stage of ph_lookup_batch
+
+/**
+ * @brief ph_lookup() for n keys at once, results[i] receives the result for
+ *        keys[i]. The lookup stages of a group of keys are interleaved with
+ *        software prefetches so their cache misses overlap.
+ */
+void ph_lookup_batch(ph_table *t, char **keys, size_t n, int *results);
+
+/**
+ * @brief Adds key to an FKS table. Like ph_build(), the table points at the
+ *        caller's string, which must outlive it. Only key's bucket is
+ *        rebuilt; the whole table is rebuilt once its size has doubled or
+ *        fallen to a quarter, or its slots outgrow their space bound. Keys
+ *        can change slots, so arrays indexed by slot (ph_map) don't survive
+ *        an update.
+ *
+ * @return 0 if key was added, 1 if it was already in t, -1 on allocation
+ *         failure, if key shares its key hash with a key of t, or if t
+ *         can't be updated (PH_HASH_DISPLACE, owned keys or a mapped table).
+ *         t is unchanged when it returns -1.
+ */
+int ph_insert(ph_table *t, const char *key);
+
+/**
+ * @brief ph_insert() for the len bytes at key, which must outlive t.
+ */
+int ph_insert_n(ph_table *t, const char *key, size_t len);
+
+/**
+ * @brief Removes key from an FKS table; see ph_insert().
+ *
+ * @return 0 if key was removed, -1 if it was not in t or t can't be updated
+ */
+int ph_delete(ph_table *t, const char *key);
+
+/**
+ * @brief ph_delete() for the len bytes at key.
+ */
+int ph_delete_n(ph_table *t, const char *key, size_t len);
+
+/**
+ * @brief Writes t to path in a versioned, position independent format (see
+ *        ph_io.c). Keys are always written owned, so the file is complete
+ *        even when t points at its caller's keys.
+ *
+ * @return 0 on success, -1 on failure (nothing is left at path)
+ */
+int ph_save(const ph_table *t, const char *path);
+
+/**
+ * @brief Maps a file written by ph_save() and returns a table that reads it
+ *        in place: no parsing, no per-bucket allocation, and the pages are
+ *        shared with every other process mapping the same file. The table
+ *        is read only and ph_free() unmaps it.
+ *
+ *        Opening checks everything a lookup reads through: section bounds,
+ *        bucket slot ranges, remap entries and pool references, so a corrupt
+ *        or truncated file is refused rather than read out of bounds. That
+ *        check reads the index arrays and key refs once, but not the pool.
+ *
+ * @return The table, or NULL if the file can't be mapped or is not a valid
+ *         table of this version
+ */
+ph_table *ph_open_mmap(const char *path);
+
 /* Frees all mem */
 void ph_free(ph_table *t); 
 
@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "ph_arena.h"
+
+#define PH_ARENA_ALIGN 64
+
+static size_t round_up(size_t x, size_t to) {
+    return (x + to - 1) / to * to;
+}
+
+/**
+ * @brief Maps bytes (a multiple of PH_ARENA_HUGE_PAGE) at a 2 MB boundary,
+ *        so that every 2 MB of it can become one transparent huge page.
+ */
+static char *map_aligned(size_t bytes) {
+    size_t padded = bytes + PH_ARENA_HUGE_PAGE;
+    char *raw = mmap(NULL, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(raw == MAP_FAILED) return NULL;
+
+    char *base = (char *)round_up((uintptr_t)raw, PH_ARENA_HUGE_PAGE);
+    if(base > raw) munmap(raw, (size_t)(base - raw));
+    if(base + bytes < raw + padded) munmap(base + bytes, (size_t)(raw + padded - (base + bytes)));
+    return base;
+}
+
+/**
+ * @brief A new region of bytes with a's backing, or the closest one the
+ *        system gives.
+ */
+static ph_arena_region_t *map_region(const ph_arena_t *a, size_t bytes) {
+    ph_arena_region_t *r = calloc(1, sizeof(ph_arena_region_t));
+    if(!r) return NULL;
+    r->bytes = round_up(bytes, PH_ARENA_HUGE_PAGE);
+
+#ifdef MAP_HUGETLB
+    if(a->backing == PH_ARENA_HUGETLB) {
+        char *base = mmap(NULL, r->bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(base != MAP_FAILED) {
+            r->base = base;
+            r->backing = PH_ARENA_HUGETLB;
+            return r;
+        }
+        // no reserved huge pages: fall back to transparent ones
+    }
+#endif
+
+    r->base = map_aligned(r->bytes);
+    if(!r->base) {
+        free(r);
+        return NULL;
+    }
+    r->backing = (a->backing == PH_ARENA_PAGES) ? PH_ARENA_PAGES : PH_ARENA_THP;
+#if defined(MADV_HUGEPAGE) && defined(MADV_NOHUGEPAGE)
+    madvise(r->base, r->bytes, (r->backing == PH_ARENA_THP) ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+#endif
+    return r;
+}
+
+ph_arena_t *ph_arena_create(int backing, size_t region_bytes) {
+    if(backing < PH_ARENA_PAGES || backing > PH_ARENA_HUGETLB) return NULL;
+    ph_arena_t *a = calloc(1, sizeof(ph_arena_t));
+    if(!a) return NULL;
+    a->backing = backing;
+    a->region_bytes = region_bytes;
+    return a;
+}
+
+static void *arena_alloc(size_t bytes, void *ctx) {
+    ph_arena_t *a = ctx;
+    ph_arena_region_t *r = a->regions;
+    size_t at = r ? round_up(r->used, PH_ARENA_ALIGN) : 0;
+
+    if(!r || at + bytes > r->bytes) {
+        r = map_region(a, (bytes > a->region_bytes) ? bytes : a->region_bytes);
+        if(!r) return NULL;
+        r->next = a->regions;
+        a->regions = r;
+        a->reserved += r->bytes;
+        at = 0;
+    }
+    a->last_at = at;
+    r->used = at + bytes;
+    return r->base + at;
+}
+
+static void arena_free(void *p, size_t bytes, void *ctx) {
+    ph_arena_t *a = ctx;
+    ph_arena_region_t *r = a->regions;
+    // only the newest allocation can be handed back
+    if(r && (char *)p == r->base + a->last_at && a->last_at + bytes == r->used) r->used = a->last_at;
+}
+
+ph_allocator_t ph_arena_allocator(ph_arena_t *a) {
+    return (ph_allocator_t){ arena_alloc, arena_free, a };
+}
+
+size_t ph_arena_huge_bytes(const ph_arena_t *a) {
+    size_t huge = 0;
+    int any_thp = 0;
+    for(const ph_arena_region_t *r = a->regions; r; r = r->next) {
+        if(r->backing == PH_ARENA_HUGETLB) huge += r->bytes;
+        else any_thp = 1;
+    }
+    if(!any_thp) return huge;
+
+    FILE *f = fopen("/proc/self/smaps", "r");
+    if(!f) return huge;
+    char line[256];
+    uintptr_t start = 0, end = 0;
+    while(fgets(line, sizeof(line), f)) {
+        unsigned long lo, hi, kb;
+        if(sscanf(line, "%lx-%lx ", &lo, &hi) == 2) {
+            start = lo;
+            end = hi;
+            continue;
+        }
+        if(sscanf(line, "AnonHugePages: %lu kB", &kb) != 1 || kb == 0) continue;
+
+        // a mapping counts once, under the region it lies in
+        for(const ph_arena_region_t *r = a->regions; r; r = r->next) {
+            uintptr_t base = (uintptr_t)r->base;
+            if(r->backing != PH_ARENA_HUGETLB && start >= base && end <= base + r->bytes) {
+                huge += (size_t)kb * 1024;
+                break;
+            }
+        }
+    }
+    fclose(f);
+    return huge;
+}
+
+void ph_arena_destroy(ph_arena_t *a) {
+    if(!a) return;
+    for(ph_arena_region_t *r = a->regions, *next; r; r = next) {
+        next = r->next;
+        munmap(r->base, r->bytes);
+        free(r);
+    }
+    free(a);
+}
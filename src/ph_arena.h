@@ -0,0 +1,68 @@
+#ifndef PH_ARENA_H
+#define PH_ARENA_H
+
+#include <stddef.h>
+
+#include "ph.h"
+
+/**
+ * A bump allocator for table storage, to pass to a build as
+ * ph_build_opts_t.allocator. Memory comes from a few large mmap() regions
+ * that can be backed by huge pages, so a finished table spans a handful of
+ * 2 MB TLB entries instead of one 4 KB entry per page it touches.
+ *
+ * Allocations are 64-byte aligned and bumped from the newest region. A new
+ * region is mapped when one doesn't fit: region_bytes, or the allocation
+ * rounded up to 2 MB if that is larger. Freeing the newest allocation hands
+ * its bytes back; any other free is a no-op, and everything is unmapped by
+ * ph_arena_destroy(), which must come after the last table using the
+ * arena is freed. An arena is not thread safe: builds allocate from it
+ * only on the building thread, but two concurrent builds need two arenas.
+ */
+
+#define PH_ARENA_HUGE_PAGE (2u << 20)
+
+enum {
+    PH_ARENA_PAGES, // regular pages, with transparent huge pages turned off (MADV_NOHUGEPAGE)
+    PH_ARENA_THP, // 2 MB aligned and advised MADV_HUGEPAGE; the kernel backs it with huge pages when it can
+    PH_ARENA_HUGETLB // MAP_HUGETLB from the reserved pool (vm.nr_hugepages), else as PH_ARENA_THP
+};
+
+typedef struct ph_arena_region {
+    struct ph_arena_region *next; // older region
+    char *base;
+    size_t bytes;
+    size_t used;
+    int backing; // what the region got: PH_ARENA_HUGETLB only if MAP_HUGETLB succeeded
+} ph_arena_region_t;
+
+typedef struct {
+    int backing; // asked for
+    size_t region_bytes;
+    ph_arena_region_t *regions; // newest first
+    size_t last_at; // offset of the newest allocation in regions
+    size_t reserved; // bytes mapped over all regions
+} ph_arena_t;
+
+/**
+ * @brief An empty arena whose regions have the given backing and are at
+ *        least region_bytes (0 to size each to what it first holds).
+ *
+ * @return The arena, or NULL on allocation failure or an unknown backing
+ */
+ph_arena_t *ph_arena_create(int backing, size_t region_bytes);
+
+// An allocator drawing from a, for ph_build_opts_t.allocator
+ph_allocator_t ph_arena_allocator(ph_arena_t *a);
+
+/**
+ * @brief Bytes of a's regions that the kernel backs with huge pages right
+ *        now: every MAP_HUGETLB region, plus the transparent huge pages of
+ *        the others as /proc/self/smaps reports them (0 where it can't be
+ *        read).
+ */
+size_t ph_arena_huge_bytes(const ph_arena_t *a);
+
+void ph_arena_destroy(ph_arena_t *a);
+
+#endif
@@ -0,0 +1,357 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ph.h"
+#include "hash.h"
+#include "ph_internal.h"
+
+/**
+ * Dynamic FKS, after Dietzfelbinger et al. A table is thawed by its first
+ * update: its slots move out of mem into an arena that grows by doubling,
+ * and mem keeps params only. Both come from the allocator the table was
+ * built with.
+ * Buckets keep the (seed, table_size) parameters of the static build, so
+ * the lookup is the same two probes and stays O(1) in the worst case.
+ *
+ * An insert whose slot is free just writes it. Otherwise the key's bucket
+ * is rebuilt with its k keys: in place with a new seed while its table has
+ * at least k^2 slots (a seed then succeeds with probability over 1/2),
+ * else in a fresh region of (2k)^2 slots at the end of the arena, which
+ * leaves room for the bucket to double before it moves again. A delete
+ * clears its slot.
+ *
+ * The whole table is rebuilt with ph_build_n(), under the settings of its
+ * own build and a new seed, once n has doubled or
+ * dropped to a quarter of what it was at the last rebuild, or once the
+ * arena (live buckets plus the regions buckets moved out of) passes
+ * PH_DYNAMIC_SLOT_BOUND slots per key. Each of those takes Omega(n) updates
+ * to reach, so the O(n) rebuild is amortized O(1) per update. A rebuild can
+ * fail (its space budget, say) and leave the table as it was; the next one
+ * is then put off for n updates, twice that after a second failure in a
+ * row and so on, which keeps failed rebuilds amortized O(1) too. Updates
+ * meanwhile go through the buckets as usual.
+ */
+
+#define PH_DYNAMIC_SLOT_BOUND 16 // arena slots per key before a global rebuild
+#define PH_DYNAMIC_MIN_KEYS 16 // floor of the rebuild thresholds
+
+struct ph_dynamic {
+    uint32_t *bucket_keys; // live keys per bucket
+    size_t slot_cap; // slots the arena has room for
+    size_t rebuild_n; // n at the last global rebuild, at least PH_DYNAMIC_MIN_KEYS
+    size_t rebuild_wait; // updates before a global rebuild is tried again, after a failed one
+    size_t rebuild_backoff; // rebuild_wait set by the last failure, 0 once a rebuild succeeds
+    ph_rng_t rng; // seeds of rebuilt buckets and tables, from the table's seed
+    ph_build_opts_t opts; // the table's build settings, for global rebuilds
+    ph_allocator_t allocator; // where mem and the arena come from, all zero for malloc()
+};
+
+static int can_update(const ph_table *t) {
+    return t->hash_type != PH_HASH_DISPLACE && !t->own_keys && !t->map;
+}
+
+static size_t max_size(size_t a, size_t b) {
+    return (a > b) ? a : b;
+}
+
+/**
+ * @brief Zeroed memory of bytes from a, or from malloc() when a is all zero.
+ */
+static void *storage_alloc(const ph_allocator_t *a, size_t bytes) {
+    void *p = a->alloc ? a->alloc(bytes ? bytes : 1, a->ctx) : malloc(bytes ? bytes : 1);
+    if(p) memset(p, 0, bytes);
+    return p;
+}
+
+static void storage_free(const ph_allocator_t *a, void *p, size_t bytes) {
+    if(!a->alloc) free(p);
+    else if(p && a->free) a->free(p, bytes ? bytes : 1, a->ctx);
+}
+
+void release_dynamic(ph_table *t) {
+    struct ph_dynamic *dyn = t->dyn;
+    storage_free(&dyn->allocator, t->slots, dyn->slot_cap * sizeof(ph_slot_t));
+    free(t->dyn->bucket_keys);
+    free(t->dyn);
+    t->slots = NULL;
+    t->dyn = NULL;
+}
+
+/**
+ * @brief Moves t's slots into a growable arena and counts the keys of every
+ *        bucket. Slot indices don't change.
+ *
+ * @return 0 on success, -1 on allocation failure (t is untouched)
+ */
+static int thaw(ph_table *t) {
+    size_t cap = max_size(2 * t->num_slots, PH_DYNAMIC_MIN_KEYS);
+    size_t meta_bytes = t->m * sizeof(ph_bucket_params_t);
+
+    const ph_allocator_t a = t->allocator;
+    struct ph_dynamic *dyn = calloc(1, sizeof(struct ph_dynamic));
+    ph_bucket_params_t *params = storage_alloc(&a, meta_bytes);
+    ph_slot_t *slots = storage_alloc(&a, cap * sizeof(ph_slot_t));
+    uint32_t *bucket_keys = calloc(t->m ? t->m : 1, sizeof(uint32_t));
+    if(!dyn || !params || !slots || !bucket_keys) {
+        free(dyn);
+        storage_free(&a, params, meta_bytes);
+        storage_free(&a, slots, cap * sizeof(ph_slot_t));
+        free(bucket_keys);
+        return -1;
+    }
+
+    memcpy(params, t->params, meta_bytes);
+    if(t->num_slots) memcpy(slots, t->slots, t->num_slots * sizeof(ph_slot_t));
+    for(size_t b = 0; b < t->m; b++) {
+        for(size_t s = params[b].offset; s < params[b].offset + params[b].table_size; s++) {
+            bucket_keys[b] += (slots[s].key != NULL);
+        }
+    }
+
+    release_table_mem(t);
+    t->mem = params;
+    t->allocator = a;
+    t->mem_bytes = meta_bytes;
+    t->params = params;
+    t->slots = slots;
+
+    dyn->bucket_keys = bucket_keys;
+    dyn->slot_cap = cap;
+    dyn->rebuild_n = max_size(t->n, PH_DYNAMIC_MIN_KEYS);
+    dyn->rng = ph_rng_stream(t->seed, PH_STREAM_UPDATES);
+    dyn->opts = (ph_build_opts_t){ .num_threads = t->num_threads, .fingerprint_bits = t->fingerprint_bits,
+        .level1_load = t->level1_load, .max_bucket_attempts = t->max_bucket_attempts,
+        .bits_per_key = t->bits_per_key };
+    dyn->allocator = a;
+    t->dyn = dyn;
+    return 0;
+}
+
+/**
+ * @brief Makes room for extra more slots at the end of the arena.
+ */
+static int reserve_slots(ph_table *t, size_t extra) {
+    struct ph_dynamic *dyn = t->dyn;
+    if(t->num_slots + extra <= dyn->slot_cap) return 0;
+
+    const ph_allocator_t *a = &dyn->allocator;
+    size_t cap = max_size(2 * dyn->slot_cap, t->num_slots + extra);
+    ph_slot_t *slots = storage_alloc(a, cap * sizeof(ph_slot_t));
+    if(!slots) return -1;
+
+    memcpy(slots, t->slots, dyn->slot_cap * sizeof(ph_slot_t));
+    storage_free(a, t->slots, dyn->slot_cap * sizeof(ph_slot_t));
+    t->slots = slots;
+    dyn->slot_cap = cap;
+    return 0;
+}
+
+/**
+ * @brief Writes key (len bytes, key hash kh) into its slot record.
+ */
+static void set_slot(ph_table *t, size_t slot, const char *key, uint32_t len, uint64_t kh) {
+    t->slots[slot] = (ph_slot_t){ .key = key, .len = len, .fingerprint = table_fingerprint(t, kh) };
+}
+
+/**
+ * @brief Writes the k keys of bucket b into the slots its params send them
+ *        to, with their lengths and fingerprints.
+ */
+static void place_bucket(ph_table *t, size_t b, char **keys, const uint32_t *lens, const uint64_t *hashes,
+    size_t k) {
+
+    for(size_t i = 0; i < k; i++) set_slot(t, slot_in_bucket(t, hashes[i], b), keys[i], lens[i], hashes[i]);
+}
+
+/**
+ * @brief Rebuilds bucket b with its keys plus key (len bytes), moving it to
+ *        a larger region when its table has fewer than k^2 slots.
+ *
+ * @return 0 on success, -1 on allocation failure, when key shares its key
+ *         hash with a key of b, or when PH_FKS_BUCKET_ATTEMPTS seeds all
+ *         fail (b is untouched)
+ */
+static int rebuild_bucket(ph_table *t, size_t b, const char *key, size_t len, uint64_t kh) {
+    ph_bucket_params_t *p = &t->params[b];
+    size_t k = (size_t)t->dyn->bucket_keys[b] + 1;
+    size_t size = (k == 1) ? 1 : 4 * k * k;
+    int move = (k == 1) ? p->table_size != 1 : p->table_size < k * k;
+    if(move && t->num_slots + size > UINT32_MAX) return -1; // offsets are 32-bit
+
+    char **keys = malloc(sizeof(char *) * k);
+    uint32_t *lens = malloc(sizeof(uint32_t) * k);
+    uint64_t *hashes = malloc(sizeof(uint64_t) * k);
+    int rc = -1;
+    if(!keys || !lens || !hashes) goto done;
+
+    size_t i = 0;
+    for(size_t s = p->offset; s < p->offset + p->table_size; s++) {
+        if(!t->slots[s].key) continue;
+        keys[i] = (char *)t->slots[s].key;
+        lens[i] = t->slots[s].len;
+        hashes[i] = ph_key_hash(keys[i], lens[i]);
+        // no seed separates two keys with one key hash
+        if(hashes[i] == kh) goto done;
+        i++;
+    }
+    keys[i] = (char *)key;
+    lens[i] = (uint32_t)len;
+    hashes[i] = kh;
+    if(move && reserve_slots(t, size) != 0) goto done;
+
+    ph_bucket_params_t old = *p;
+    memset(&t->slots[old.offset], 0, old.table_size * sizeof(ph_slot_t));
+    if(move) { // the old region is dead until the next global rebuild
+        p->offset = (uint32_t)t->num_slots;
+        p->table_size = (uint32_t)size;
+        t->num_slots += size;
+    }
+
+    if(build_second_level_bucketing(t, b, keys, hashes, k, &t->dyn->rng, PH_FKS_BUCKET_ATTEMPTS, NULL) != 0) {
+        // put the old keys back where the old seed had them
+        memset(&t->slots[p->offset], 0, p->table_size * sizeof(ph_slot_t));
+        if(move) t->num_slots -= size;
+        *p = old;
+        place_bucket(t, b, keys, lens, hashes, k - 1);
+        goto done;
+    }
+    place_bucket(t, b, keys, lens, hashes, k);
+    rc = 0;
+
+done:
+    free(keys);
+    free(lens);
+    free(hashes);
+    return rc;
+}
+
+/**
+ * @brief Rebuilds t from its live keys plus extra (extra_len bytes, when not
+ *        NULL) with a fresh level 1 sized for them, and thaws the result.
+ *        The rebuild keeps t's build settings and allocator.
+ *
+ * @return 0 on success, -1 on allocation failure or when the build fails
+ *         under those settings, e.g. its space budget (t is untouched)
+ */
+static int rebuild_table(ph_table *t, const char *extra, size_t extra_len) {
+    size_t n = t->n + (extra != NULL);
+    char **keys = malloc(sizeof(char *) * (n ? n : 1));
+    size_t *lens = malloc(sizeof(size_t) * (n ? n : 1));
+    if(!keys || !lens) {
+        free(keys);
+        free(lens);
+        return -1;
+    }
+
+    size_t i = 0;
+    for(size_t s = 0; s < t->num_slots; s++) {
+        if(!t->slots[s].key) continue;
+        keys[i] = (char *)t->slots[s].key;
+        lens[i++] = t->slots[s].len;
+    }
+    if(extra) {
+        keys[i] = (char *)extra;
+        lens[i] = extra_len;
+    }
+
+    ph_build_opts_t opts = t->dyn->opts;
+    opts.seed = ph_rng_next(&t->dyn->rng) | 1;
+    opts.allocator = t->dyn->allocator.alloc ? &t->dyn->allocator : NULL;
+    ph_table *fresh = ph_build_n(keys, lens, n, t->hash_type, &opts, NULL);
+    free(keys);
+    free(lens);
+    if(!fresh || thaw(fresh) != 0) {
+        ph_free(fresh);
+        return -1;
+    }
+
+    if(t->dyn) release_dynamic(t);
+    release_table_mem(t);
+    *t = *fresh;
+    free(fresh);
+    return 0;
+}
+
+/**
+ * @brief rebuild_table() for an update that found a global rebuild due,
+ *        unless t is backing off from a failed one.
+ *
+ * @return 0 if t was rebuilt, -1 if the rebuild failed or was put off
+ */
+static int try_rebuild_table(ph_table *t, const char *extra, size_t extra_len) {
+    struct ph_dynamic *dyn = t->dyn;
+    if(dyn->rebuild_wait) return -1;
+
+    size_t n = t->n;
+    if(rebuild_table(t, extra, extra_len) == 0) return 0; // t->dyn starts afresh
+    dyn->rebuild_backoff = max_size(2 * dyn->rebuild_backoff, max_size(n, PH_DYNAMIC_MIN_KEYS));
+    dyn->rebuild_wait = dyn->rebuild_backoff;
+    return -1;
+}
+
+/**
+ * @brief Thaws t on its first update and counts the update against a
+ *        rebuild that is being put off.
+ *
+ * @return 0 on success, -1 on allocation failure
+ */
+static int begin_update(ph_table *t) {
+    if(!t->dyn && thaw(t) != 0) return -1;
+    if(t->dyn->rebuild_wait) t->dyn->rebuild_wait--;
+    return 0;
+}
+
+/**
+ * @brief Whether the arena has outgrown its bound for the current n.
+ */
+static int over_slot_bound(const ph_table *t) {
+    return t->num_slots > PH_DYNAMIC_SLOT_BOUND * max_size(t->n, PH_DYNAMIC_MIN_KEYS);
+}
+
+int ph_insert_n(ph_table *t, const char *key, size_t len) {
+    if(!can_update(t) || len > UINT32_MAX - 1) return -1;
+
+    uint64_t kh = ph_key_hash(key, len);
+    if(lookup_slot_hashed(t, key, len, kh) != PH_NO_SLOT) return 1;
+    if(begin_update(t) != 0) return -1;
+    if(t->m == 0) return rebuild_table(t, key, len); // no bucket to put it in
+    if(t->n + 1 > 2 * t->dyn->rebuild_n && try_rebuild_table(t, key, len) == 0) return 0;
+
+    size_t b = bucket_of(t, kh);
+    size_t slot = slot_in_bucket(t, kh, b);
+    if(slot != PH_NO_SLOT && !t->slots[slot].key) {
+        set_slot(t, slot, key, (uint32_t)len, kh);
+    } else if(rebuild_bucket(t, b, key, len, kh) != 0) {
+        return -1;
+    }
+    t->dyn->bucket_keys[b]++;
+    t->n++;
+
+    // the key is in either way
+    if(over_slot_bound(t)) try_rebuild_table(t, NULL, 0);
+    return 0;
+}
+
+int ph_insert(ph_table *t, const char *key) {
+    return ph_insert_n(t, key, strlen(key));
+}
+
+int ph_delete_n(ph_table *t, const char *key, size_t len) {
+    if(!can_update(t)) return -1;
+
+    uint64_t kh = ph_key_hash(key, len);
+    size_t slot = lookup_slot_hashed(t, key, len, kh);
+    if(slot == PH_NO_SLOT || begin_update(t) != 0) return -1;
+
+    t->slots[slot] = (ph_slot_t){ 0 };
+    t->dyn->bucket_keys[bucket_of(t, kh)]--;
+    t->n--;
+
+    int shrunk = t->dyn->rebuild_n > PH_DYNAMIC_MIN_KEYS && 4 * t->n < t->dyn->rebuild_n;
+    if(shrunk || over_slot_bound(t)) try_rebuild_table(t, NULL, 0);
+    return 0;
+}
+
+int ph_delete(ph_table *t, const char *key) {
+    return ph_delete_n(t, key, strlen(key));
+}
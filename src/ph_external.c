@@ -0,0 +1,522 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "ph.h"
+#include "ph_external.h"
+#include "ph_internal.h"
+#include "hash.h"
+
+/**
+ * Output file, native endianness:
+ *      - header
+ *      - one ph_save() image per shard, each PH_FILE_ALIGN aligned
+ *      - dir[2^depth] (uint32_t shard index)
+ *      - shards[num_shards] (shard_entry_t: where each image lies)
+ *
+ * Spill files hold records of a uint32_t length followed by the key bytes.
+ */
+
+#define PH_SHARD_MAGIC 0x3144524148534850ull // "PHSHARD1" read as a little endian u64
+#define PH_SHARD_VERSION 1
+#define FANOUT (1 << PH_EXTERNAL_FANOUT_BITS)
+
+/*
+ * Rough working set of a shard's build per key, on top of the key's bytes
+ * (read in, then copied into the table's pool): the loaded key pointers
+ * and hashes, the build's hash and grouping arrays, and the slot storage.
+ */
+#define BUILD_BYTES_PER_KEY 128
+
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t depth;
+    uint64_t n;
+    uint64_t num_shards;
+    uint64_t dir_at;
+    uint64_t shards_at;
+} shard_file_header_t;
+
+typedef struct {
+    uint64_t at;
+    uint64_t bytes;
+} shard_entry_t;
+
+typedef struct {
+    char *path;
+    FILE *f; // open while being written only
+    size_t keys;
+    size_t bytes;
+} partition_t;
+
+typedef struct {
+    shard_entry_t entry;
+    uint64_t prefix; // the shard owns the shard hashes starting with these depth bits
+    int depth;
+} shard_rec_t;
+
+typedef struct {
+    const char *out_path;
+    FILE *out;
+    size_t out_at;
+    size_t budget;
+    int hash_type;
+    ph_build_opts_t build_opts;
+    unsigned int next_spill; // numbers the spill files
+    shard_rec_t *shards;
+    size_t num_shards;
+    size_t shards_cap;
+    size_t n;
+    ph_external_stats_t stats;
+} ext_build_t;
+
+static size_t align_file(size_t x) {
+    return (x + PH_FILE_ALIGN - 1) & ~(size_t)(PH_FILE_ALIGN - 1);
+}
+
+/**
+ * @brief The depth bits of the shard hash after the first skip.
+ */
+static unsigned int hash_bits(uint64_t shard_hash, int skip, int depth) {
+    if(depth == 0) return 0;
+    return (unsigned int)((shard_hash << skip) >> (64 - depth));
+}
+
+static void remove_partitions(partition_t *parts, int from, int to) {
+    for(int c = from; c < to; c++) {
+        if(parts[c].f) fclose(parts[c].f);
+        if(parts[c].path) remove(parts[c].path);
+        free(parts[c].path);
+        parts[c].f = NULL;
+        parts[c].path = NULL;
+    }
+}
+
+/**
+ * @brief Creates FANOUT empty spill files next to the output.
+ */
+static int open_partitions(ext_build_t *eb, partition_t *parts) {
+    memset(parts, 0, sizeof(partition_t) * FANOUT);
+    size_t path_len = strlen(eb->out_path) + 32;
+
+    for(int c = 0; c < FANOUT; c++) {
+        parts[c].path = malloc(path_len);
+        if(!parts[c].path) break;
+        snprintf(parts[c].path, path_len, "%s.spill%u", eb->out_path, eb->next_spill++);
+        if(!(parts[c].f = fopen(parts[c].path, "wb"))) break;
+        if(c == FANOUT - 1) return 0;
+    }
+    remove_partitions(parts, 0, FANOUT);
+    return -1;
+}
+
+/**
+ * @brief Closes the spill files once written; they are reopened one at a
+ *        time to be read back.
+ */
+static int close_partitions(partition_t *parts) {
+    int rc = 0;
+    for(int c = 0; c < FANOUT; c++) {
+        if(fclose(parts[c].f) != 0) rc = -1;
+        parts[c].f = NULL;
+    }
+    return rc;
+}
+
+static int spill_key(partition_t *p, const char *key, uint32_t len) {
+    if(fwrite(&len, sizeof(len), 1, p->f) != 1) return -1;
+    if(len && fwrite(key, 1, len, p->f) != len) return -1;
+    p->keys++;
+    p->bytes += len;
+    return 0;
+}
+
+/**
+ * @brief Reads the next spill record into *buf (grown as needed, NUL
+ *        terminated).
+ *
+ * @return 1 for a record, 0 at the end of the file, -1 on error
+ */
+static int read_key(FILE *f, char **buf, size_t *cap, uint32_t *len) {
+    if(fread(len, sizeof(*len), 1, f) != 1) return feof(f) ? 0 : -1;
+    if(*len + (size_t)1 > *cap) {
+        size_t new_cap = (*len + (size_t)1) * 2;
+        char *grown = realloc(*buf, new_cap);
+        if(!grown) return -1;
+        *buf = grown;
+        *cap = new_cap;
+    }
+    if(*len && fread(*buf, 1, *len, f) != *len) return -1;
+    (*buf)[*len] = '\0';
+    return 1;
+}
+
+typedef struct {
+    uint64_t kh;
+    const char *key;
+    uint32_t len;
+} shard_key_t;
+
+static int compare_shard_keys(const void *a, const void *b) {
+    const shard_key_t *x = a, *y = b;
+    if(x->kh != y->kh) return (x->kh < y->kh) ? -1 : 1;
+    if(x->len != y->len) return (x->len < y->len) ? -1 : 1;
+    return memcmp(x->key, y->key, x->len);
+}
+
+static int add_shard(ext_build_t *eb, const shard_rec_t *rec) {
+    if(eb->num_shards == eb->shards_cap) {
+        size_t cap = eb->shards_cap ? eb->shards_cap * 2 : FANOUT;
+        shard_rec_t *grown = realloc(eb->shards, sizeof(shard_rec_t) * cap);
+        if(!grown) return -1;
+        eb->shards = grown;
+        eb->shards_cap = cap;
+    }
+    eb->shards[eb->num_shards++] = *rec;
+    return 0;
+}
+
+/**
+ * @brief Copies the len bytes of key into a report field of stats.
+ */
+static void report_key(char *out, const char *key, uint32_t len) {
+    size_t kept = (len < PH_EXTERNAL_REPORT_LEN - 1) ? len : PH_EXTERNAL_REPORT_LEN - 1;
+    memcpy(out, key, kept);
+    out[kept] = '\0';
+}
+
+/**
+ * @brief Loads a partition, drops its duplicate keys (sorting by key hash
+ *        brings them together), builds it with owned keys and appends its
+ *        image to the output. A shard that can't be built is reported in
+ *        eb->stats; distinct keys that share a key hash meet in the sort,
+ *        so they are reported without a build being tried.
+ */
+static int build_shard(ext_build_t *eb, partition_t *part, uint64_t prefix, int depth) {
+    int rc = -1;
+    FILE *in = fopen(part->path, "rb");
+    char *bytes = malloc(part->bytes + part->keys + 1);
+    shard_key_t *entries = malloc(sizeof(shard_key_t) * (part->keys ? part->keys : 1));
+    char **keys = malloc(sizeof(char *) * (part->keys ? part->keys : 1));
+    ph_table *t = NULL;
+    if(!in || !bytes || !entries || !keys) goto out;
+
+    size_t used = 0;
+    for(size_t i = 0; i < part->keys; i++) {
+        uint32_t len;
+        if(fread(&len, sizeof(len), 1, in) != 1) goto out;
+        if(len > part->bytes - (used - i) || (len && fread(bytes + used, 1, len, in) != len)) goto out;
+        bytes[used + len] = '\0';
+        entries[i].key = bytes + used;
+        entries[i].len = len;
+        entries[i].kh = ph_key_hash(bytes + used, len);
+        used += len + 1;
+    }
+
+    qsort(entries, part->keys, sizeof(shard_key_t), compare_shard_keys);
+    size_t k = 0;
+    int colliding = 0;
+    for(size_t i = 0; i < part->keys; i++) {
+        if(i > 0 && compare_shard_keys(&entries[i - 1], &entries[i]) == 0) {
+            eb->stats.duplicates++;
+            continue;
+        }
+        if(i > 0 && entries[i - 1].kh == entries[i].kh && !colliding) {
+            report_key(eb->stats.colliding[0], entries[i - 1].key, entries[i - 1].len);
+            report_key(eb->stats.colliding[1], entries[i].key, entries[i].len);
+            colliding = 1;
+        }
+        keys[k++] = (char *)entries[i].key;
+    }
+
+    if(!colliding) t = ph_build_opts(keys, k, eb->hash_type, &eb->build_opts, NULL);
+    if(!t) {
+        eb->stats.failed = 1;
+        eb->stats.failed_prefix = prefix;
+        eb->stats.failed_depth = depth;
+        eb->stats.failed_keys = k;
+        goto out;
+    }
+
+    shard_rec_t rec = { { align_file(eb->out_at), 0 }, prefix, depth };
+    size_t img;
+    if(write_at(eb->out, &eb->out_at, rec.entry.at, NULL, 0) != 0) goto out;
+    if(save_table_image(t, eb->out, &img) != 0) goto out;
+    eb->out_at += img;
+    rec.entry.bytes = img;
+    if(add_shard(eb, &rec) != 0) goto out;
+
+    eb->n += k;
+    if(k > eb->stats.max_shard_keys) eb->stats.max_shard_keys = k;
+    if(depth > eb->stats.depth) eb->stats.depth = depth;
+    rc = 0;
+
+out:
+    ph_free(t);
+    free(keys);
+    free(entries);
+    free(bytes);
+    if(in) fclose(in);
+    remove_partitions(part, 0, 1);
+    return rc;
+}
+
+/**
+ * @brief Builds the partition as one shard if it fits the budget, otherwise
+ *        splits it FANOUT ways on the next bits of the shard hash and
+ *        recurses. The partition's spill file is gone when this returns.
+ */
+static int process_partition(ext_build_t *eb, partition_t *part, uint64_t prefix, int depth) {
+    size_t estimate = 2 * part->bytes + part->keys * (size_t)BUILD_BYTES_PER_KEY;
+    if(estimate <= eb->budget || depth + PH_EXTERNAL_FANOUT_BITS > PH_EXTERNAL_MAX_DEPTH) {
+        return build_shard(eb, part, prefix, depth);
+    }
+
+    partition_t children[FANOUT];
+    FILE *in = fopen(part->path, "rb");
+    if(!in || open_partitions(eb, children) != 0) {
+        if(in) fclose(in);
+        remove_partitions(part, 0, 1);
+        return -1;
+    }
+
+    char *buf = NULL;
+    size_t cap = 0;
+    uint32_t len;
+    int got;
+    while((got = read_key(in, &buf, &cap, &len)) == 1) {
+        uint64_t sh = ph_shard_hash(ph_key_hash(buf, len));
+        if(spill_key(&children[hash_bits(sh, depth, PH_EXTERNAL_FANOUT_BITS)], buf, len) != 0) {
+            got = -1;
+            break;
+        }
+    }
+    free(buf);
+    fclose(in);
+    remove_partitions(part, 0, 1);
+    if(close_partitions(children) != 0) got = -1;
+
+    for(int c = 0; c < FANOUT; c++) {
+        uint64_t child_prefix = (prefix << PH_EXTERNAL_FANOUT_BITS) | (uint64_t)c;
+        if(got != 0 || process_partition(eb, &children[c], child_prefix, depth + PH_EXTERNAL_FANOUT_BITS) != 0) {
+            remove_partitions(children, c, FANOUT);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Writes the directory and the shard table after the shard images,
+ *        then the header at the start of the file.
+ */
+static int write_directory(ext_build_t *eb) {
+    int depth = eb->stats.depth;
+    size_t dir_len = (size_t)1 << depth;
+    uint32_t *dir = malloc(sizeof(uint32_t) * dir_len);
+    shard_entry_t *entries = malloc(sizeof(shard_entry_t) * (eb->num_shards ? eb->num_shards : 1));
+    if(!dir || !entries) {
+        free(dir);
+        free(entries);
+        return -1;
+    }
+
+    for(size_t i = 0; i < eb->num_shards; i++) {
+        const shard_rec_t *rec = &eb->shards[i];
+        size_t span = (size_t)1 << (depth - rec->depth);
+        for(size_t e = 0; e < span; e++) dir[(rec->prefix << (depth - rec->depth)) + e] = (uint32_t)i;
+        entries[i] = rec->entry;
+    }
+
+    shard_file_header_t h;
+    memset(&h, 0, sizeof(h));
+    h.magic = PH_SHARD_MAGIC;
+    h.version = PH_SHARD_VERSION;
+    h.depth = (uint32_t)depth;
+    h.n = eb->n;
+    h.num_shards = eb->num_shards;
+    h.dir_at = align_file(eb->out_at);
+    h.shards_at = align_file(h.dir_at + sizeof(uint32_t) * dir_len);
+
+    int rc = write_at(eb->out, &eb->out_at, h.dir_at, dir, sizeof(uint32_t) * dir_len);
+    if(rc == 0) rc = write_at(eb->out, &eb->out_at, h.shards_at, entries, sizeof(shard_entry_t) * eb->num_shards);
+    if(rc == 0 && (fseek(eb->out, 0, SEEK_SET) != 0 || fwrite(&h, sizeof(h), 1, eb->out) != 1)) rc = -1;
+
+    free(dir);
+    free(entries);
+    return rc;
+}
+
+int ph_build_external(ph_key_iter_t next_key, void *ctx, const char *out_path,
+    const ph_external_opts_t *opts, ph_external_stats_t *stats) {
+
+    ph_external_opts_t defaults = { 0 };
+    if(!opts) opts = &defaults;
+
+    ext_build_t eb;
+    memset(&eb, 0, sizeof(eb));
+    eb.out_path = out_path;
+    eb.budget = opts->memory_budget ? opts->memory_budget : PH_EXTERNAL_DEFAULT_BUDGET;
+    eb.hash_type = opts->hash_type;
+    eb.build_opts.fingerprint_bits = opts->fingerprint_bits;
+    eb.build_opts.own_keys = 1;
+    eb.stats.depth = PH_EXTERNAL_FANOUT_BITS;
+
+    if(!(eb.out = fopen(out_path, "wb"))) return -1;
+
+    // the header is written last, once the directory is known
+    partition_t parts[FANOUT];
+    shard_file_header_t blank = { 0 };
+    int rc = write_at(eb.out, &eb.out_at, 0, &blank, sizeof(blank));
+    int opened = (rc == 0 && open_partitions(&eb, parts) == 0);
+    if(!opened) rc = -1;
+
+    const char *key;
+    while(rc == 0 && (key = next_key(ctx)) != NULL) {
+        size_t len = strlen(key);
+        if(len > UINT32_MAX - 1) {
+            rc = -1;
+            break;
+        }
+        uint64_t sh = ph_shard_hash(ph_key_hash(key, len));
+        rc = spill_key(&parts[hash_bits(sh, 0, PH_EXTERNAL_FANOUT_BITS)], key, (uint32_t)len);
+        eb.stats.keys_read++;
+    }
+
+    if(opened) {
+        if(close_partitions(parts) != 0) rc = -1;
+        for(int c = 0; c < FANOUT; c++) {
+            if(rc != 0 || process_partition(&eb, &parts[c], (uint64_t)c, PH_EXTERNAL_FANOUT_BITS) != 0) {
+                remove_partitions(parts, c, FANOUT);
+                rc = -1;
+                break;
+            }
+        }
+    }
+
+    if(rc == 0) rc = write_directory(&eb);
+    if(fclose(eb.out) != 0) rc = -1;
+    if(rc != 0) remove(out_path);
+
+    eb.stats.num_shards = eb.num_shards;
+    if(stats) *stats = eb.stats;
+    free(eb.shards);
+    return rc;
+}
+
+typedef struct {
+    FILE *f;
+    char *line;
+    size_t cap;
+} line_reader_t;
+
+/**
+ * @brief ph_key_iter_t over the lines of a file, without their line ends;
+ *        empty lines are skipped.
+ */
+static const char *next_line(void *ctx) {
+    line_reader_t *r = ctx;
+    ssize_t len;
+    while((len = getline(&r->line, &r->cap, r->f)) != -1) {
+        while(len > 0 && (r->line[len - 1] == '\n' || r->line[len - 1] == '\r')) r->line[--len] = '\0';
+        if(len > 0) return r->line;
+    }
+    return NULL;
+}
+
+int ph_build_external_file(const char *keys_path, const char *out_path,
+    const ph_external_opts_t *opts, ph_external_stats_t *stats) {
+
+    line_reader_t r = { fopen(keys_path, "r"), NULL, 0 };
+    if(!r.f) return -1;
+
+    int rc = ph_build_external(next_line, &r, out_path, opts, stats);
+    if(ferror(r.f)) { // the iterator can't report a read error, so check once it stops
+        remove(out_path);
+        rc = -1;
+    }
+    free(r.line);
+    fclose(r.f);
+    return rc;
+}
+
+/**
+ * @brief Checks the header, directory and shard table against the file;
+ *        the shard images are checked as they are opened.
+ */
+static int sharded_header_is_valid(const char *base, size_t bytes) {
+    if(bytes < sizeof(shard_file_header_t)) return 0;
+
+    const shard_file_header_t *h = (const shard_file_header_t *)base;
+    if(h->magic != PH_SHARD_MAGIC || h->version != PH_SHARD_VERSION) return 0;
+    if(h->depth > PH_EXTERNAL_MAX_DEPTH || h->num_shards == 0 || h->num_shards > UINT32_MAX) return 0;
+    if(h->dir_at % PH_FILE_ALIGN != 0 || h->shards_at % PH_FILE_ALIGN != 0) return 0;
+
+    uint64_t dir_bytes = sizeof(uint32_t) << h->depth;
+    if(h->dir_at > bytes || dir_bytes > bytes - h->dir_at) return 0;
+    if(h->shards_at > bytes || h->num_shards > (bytes - h->shards_at) / sizeof(shard_entry_t)) return 0;
+
+    const uint32_t *dir = (const uint32_t *)(base + h->dir_at);
+    for(uint64_t e = 0; e < ((uint64_t)1 << h->depth); e++) {
+        if(dir[e] >= h->num_shards) return 0;
+    }
+
+    const shard_entry_t *entries = (const shard_entry_t *)(base + h->shards_at);
+    for(uint64_t i = 0; i < h->num_shards; i++) {
+        if(entries[i].at % PH_FILE_ALIGN != 0) return 0;
+        if(entries[i].at > bytes || entries[i].bytes > bytes - entries[i].at) return 0;
+    }
+    return 1;
+}
+
+ph_sharded_table *ph_open_sharded(const char *path) {
+    size_t bytes;
+    char *base = map_file(path, &bytes);
+    if(!base) return NULL;
+
+    ph_sharded_table *st = calloc(1, sizeof(ph_sharded_table));
+    if(!st || !sharded_header_is_valid(base, bytes)) {
+        free(st);
+        munmap(base, bytes);
+        return NULL;
+    }
+
+    const shard_file_header_t *h = (const shard_file_header_t *)base;
+    st->map = base;
+    st->map_bytes = bytes;
+    st->depth = (int)h->depth;
+    st->dir = (uint32_t *)(base + h->dir_at);
+    st->num_shards = h->num_shards;
+    st->shards = calloc(st->num_shards, sizeof(ph_table *));
+    if(!st->shards) goto fail;
+
+    const shard_entry_t *entries = (const shard_entry_t *)(base + h->shards_at);
+    for(size_t i = 0; i < st->num_shards; i++) {
+        st->shards[i] = table_from_image(base + entries[i].at, entries[i].bytes);
+        if(!st->shards[i]) goto fail;
+        st->n += st->shards[i]->n;
+    }
+    return st;
+
+fail:
+    ph_sharded_free(st);
+    return NULL;
+}
+
+int ph_sharded_lookup(const ph_sharded_table *st, const char *key) {
+    size_t len = strlen(key);
+    uint64_t kh = ph_key_hash(key, len);
+    uint32_t shard = st->dir[hash_bits(ph_shard_hash(kh), 0, st->depth)];
+    return (lookup_slot_hashed(st->shards[shard], key, len, kh) == PH_NO_SLOT) ? -1 : 0;
+}
+
+void ph_sharded_free(ph_sharded_table *st) {
+    if(!st) return;
+
+    for(size_t i = 0; st->shards && i < st->num_shards; i++) ph_free(st->shards[i]);
+    free(st->shards);
+    if(st->map) munmap(st->map, st->map_bytes);
+    free(st);
+}
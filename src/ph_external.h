@@ -0,0 +1,111 @@
+#ifndef PH_EXTERNAL_H
+#define PH_EXTERNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ph.h"
+
+/**
+ * External memory build for key sets that don't fit in RAM. Keys are read
+ * once, as a stream, and hash-partitioned into spill files next to the
+ * output. A partition whose build would not fit in the memory budget is
+ * split again on the next bits of the shard hash, so every shard is built
+ * in memory on its own, saved (ph_save() format) into the output file and
+ * freed before the next one is loaded. Peak RAM is one shard's build plus
+ * the spill buffers, whatever the number of keys.
+ *
+ * The output file holds a directory of 2^depth entries indexed by the top
+ * depth bits of ph_shard_hash(); a shard split d times owns 2^(depth - d)
+ * consecutive entries. A lookup hashes the key once, reads one directory
+ * entry and probes that shard with the same key hash.
+ *
+ * Duplicate keys in the input are dropped (they always meet in one shard),
+ * as are empty lines of a keys file.
+ */
+
+#define PH_EXTERNAL_DEFAULT_BUDGET ((size_t)256 << 20)
+#define PH_EXTERNAL_FANOUT_BITS 6 // a partition is split 2^6 ways
+#define PH_EXTERNAL_MAX_DEPTH 18 // 2^18 directory entries at most
+#define PH_EXTERNAL_REPORT_LEN 64 // bytes kept of each key reported in ph_external_stats_t
+
+/**
+ * @brief Next key of the input, or NULL at its end. The string only has to
+ *        stay valid until the next call.
+ */
+typedef const char *(*ph_key_iter_t)(void *ctx);
+
+typedef struct {
+    size_t memory_budget; // bytes one shard's build may use, 0 for the default
+    int hash_type; // of every shard
+    int fingerprint_bits; // of every shard
+} ph_external_opts_t;
+
+/**
+ * Every shard's build is bounded (see ph_build_opts_t and
+ * PH_HD_LEVEL1_TRIES), so a shard that can't be built fails the whole
+ * build rather than stalling it. The failed_* fields then say which one:
+ * the shard hashes starting with failed_prefix (failed_depth bits) and its
+ * number of keys. Two distinct keys with one key hash can't be separated
+ * by any seed; when that is the cause, the first such pair is copied into
+ * colliding (NUL terminated, cut to PH_EXTERNAL_REPORT_LEN - 1 bytes).
+ */
+typedef struct {
+    size_t keys_read;
+    size_t duplicates; // dropped
+    size_t num_shards;
+    size_t max_shard_keys;
+    int depth;
+    int failed; // 1 when a shard's build failed
+    uint64_t failed_prefix;
+    int failed_depth;
+    size_t failed_keys;
+    char colliding[2][PH_EXTERNAL_REPORT_LEN]; // empty unless a key hash collision failed the shard
+} ph_external_stats_t;
+
+/**
+ * A table written by ph_build_external(), mapped read only. Each shard is
+ * a ph_table over its part of the mapping.
+ */
+typedef struct {
+    size_t n;
+    int depth;
+    uint32_t *dir; // 2^depth shard indices
+    size_t num_shards;
+    ph_table **shards;
+    void *map;
+    size_t map_bytes;
+} ph_sharded_table;
+
+/**
+ * @brief Builds a sharded table from the keys next_key() returns and writes
+ *        it to out_path. opts may be NULL for the defaults (PH_FKS_QUADRATIC,
+ *        no fingerprints); stats may be NULL.
+ *
+ * @return 0 on success, -1 on failure (nothing is left at out_path, and
+ *         stats reports the shard if one failed to build)
+ */
+int ph_build_external(ph_key_iter_t next_key, void *ctx, const char *out_path,
+    const ph_external_opts_t *opts, ph_external_stats_t *stats);
+
+/**
+ * @brief ph_build_external() over a file with one key per line.
+ */
+int ph_build_external_file(const char *keys_path, const char *out_path,
+    const ph_external_opts_t *opts, ph_external_stats_t *stats);
+
+/**
+ * @brief Maps a file written by ph_build_external().
+ *
+ * @return The table, or NULL if the file can't be mapped or is not valid
+ */
+ph_sharded_table *ph_open_sharded(const char *path);
+
+/**
+ * @brief ph_lookup() across every shard: 0 if key is in the table, -1 if not.
+ */
+int ph_sharded_lookup(const ph_sharded_table *st, const char *key);
+
+void ph_sharded_free(ph_sharded_table *st);
+
+#endif
@@ -0,0 +1,103 @@
+#include <stdlib.h>
+#include <sched.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <linux/membarrier.h>
+#endif
+
+#include "ph.h"
+#include "ph_handle.h"
+
+/**
+ * @brief Registers the process for expedited membarrier(), which the swap
+ *        uses in place of a fence in every reader.
+ *
+ * @return 1 if readers can skip their fence, 0 otherwise
+ */
+static int register_membarrier(void) {
+#if defined(__linux__) && defined(__NR_membarrier)
+    return syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * @brief A full memory barrier on every running thread of the process: a
+ *        reader's sequence store is then either visible to the swap, or the
+ *        reader's next pointer load sees the new table.
+ */
+static void barrier_readers(const ph_handle *h) {
+#if defined(__linux__) && defined(__NR_membarrier)
+    if(h->use_membarrier) {
+        syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+        return;
+    }
+#endif
+    (void)h;
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+ph_handle *ph_handle_create(ph_table *initial, int max_readers) {
+    if(max_readers <= 0) return NULL;
+
+    ph_handle *h = calloc(1, sizeof(ph_handle));
+    ph_reader_slot_t *readers = aligned_alloc(64, sizeof(ph_reader_slot_t) * (size_t)max_readers);
+    if(!h || !readers || pthread_mutex_init(&h->swap_lock, NULL) != 0) {
+        free(h);
+        free(readers);
+        return NULL;
+    }
+
+    for(int i = 0; i < max_readers; i++) {
+        atomic_init(&readers[i].seq, 0);
+        atomic_init(&readers[i].in_use, 0);
+    }
+    atomic_init(&h->current, initial);
+    h->readers = readers;
+    h->max_readers = max_readers;
+    h->use_membarrier = register_membarrier();
+    return h;
+}
+
+int ph_handle_register(ph_handle *h) {
+    for(int i = 0; i < h->max_readers; i++) {
+        int expected = 0;
+        if(atomic_compare_exchange_strong(&h->readers[i].in_use, &expected, 1)) return i;
+    }
+    return -1;
+}
+
+void ph_handle_unregister(ph_handle *h, int reader) {
+    atomic_store(&h->readers[reader].in_use, 0);
+}
+
+void ph_handle_swap(ph_handle *h, ph_table *fresh) {
+    pthread_mutex_lock(&h->swap_lock);
+    ph_table *old = atomic_exchange(&h->current, fresh);
+    barrier_readers(h);
+
+    // wait for every reader seen inside a read section to leave it; later
+    // sections can only have loaded the fresh table
+    for(int i = 0; i < h->max_readers; i++) {
+        unsigned long seq = atomic_load_explicit(&h->readers[i].seq, memory_order_acquire);
+        if(!(seq & 1)) continue;
+        for(int spins = 0; atomic_load_explicit(&h->readers[i].seq, memory_order_acquire) == seq; spins++) {
+            if(spins >= 64) sched_yield();
+        }
+    }
+
+    pthread_mutex_unlock(&h->swap_lock);
+    ph_free(old);
+}
+
+void ph_handle_free(ph_handle *h) {
+    if(!h) return;
+
+    ph_free(atomic_load(&h->current));
+    pthread_mutex_destroy(&h->swap_lock);
+    free(h->readers);
+    free(h);
+}
@@ -0,0 +1,96 @@
+#ifndef PH_HANDLE_H
+#define PH_HANDLE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "ph.h"
+
+/**
+ * A published table that readers use while a writer swaps in rebuilds.
+ * Reclamation is RCU style: every reader owns a cache line with a sequence
+ * number that is odd while it is inside ph_handle_enter() / ph_handle_exit().
+ * A swap exchanges the table pointer, then waits until every reader that was
+ * inside when it looked has moved on (its sequence changed), and only then
+ * frees the old table. That is the grace period: nobody can still hold the
+ * old pointer.
+ *
+ * The read side is a plain load and store to the reader's own line, with no
+ * lock and no atomic read-modify-write. The store of the sequence must be
+ * ordered before the load of the table pointer, which normally takes a full
+ * fence; on Linux the writer forces that barrier onto the readers with
+ * membarrier() instead, so readers only need a compiler barrier. Readers
+ * never wait for writers; swaps wait for readers.
+ */
+
+typedef struct {
+    _Atomic unsigned long seq; // odd while the reader is inside a read section
+    atomic_int in_use;
+} __attribute__((aligned(64))) ph_reader_slot_t;
+
+typedef struct {
+    _Atomic(ph_table *) current;
+    ph_reader_slot_t *readers;
+    int max_readers;
+    int use_membarrier; // else readers fence themselves
+    pthread_mutex_t swap_lock; // one swap at a time
+} ph_handle;
+
+/**
+ * @brief A handle publishing initial (which may be NULL), with room for
+ *        max_readers registered reader threads.
+ *
+ * @return The handle, or NULL on failure
+ */
+ph_handle *ph_handle_create(ph_table *initial, int max_readers);
+
+/**
+ * @brief Claims a reader slot for the calling thread.
+ *
+ * @return The reader id to pass to ph_handle_enter(), or -1 if every slot is
+ *         taken
+ */
+int ph_handle_register(ph_handle *h);
+
+void ph_handle_unregister(ph_handle *h, int reader);
+
+/**
+ * @brief Starts a read section and returns the current table, which stays
+ *        valid until the matching ph_handle_exit(). Sections don't nest.
+ */
+static inline ph_table *ph_handle_enter(ph_handle *h, int reader) {
+    ph_reader_slot_t *r = &h->readers[reader];
+    unsigned long seq = atomic_load_explicit(&r->seq, memory_order_relaxed);
+    atomic_store_explicit(&r->seq, seq + 1, memory_order_relaxed);
+    if(h->use_membarrier) atomic_signal_fence(memory_order_seq_cst);
+    else atomic_thread_fence(memory_order_seq_cst);
+    return atomic_load_explicit(&h->current, memory_order_acquire);
+}
+
+static inline void ph_handle_exit(ph_handle *h, int reader) {
+    ph_reader_slot_t *r = &h->readers[reader];
+    unsigned long seq = atomic_load_explicit(&r->seq, memory_order_relaxed);
+    atomic_store_explicit(&r->seq, seq + 1, memory_order_release);
+}
+
+/**
+ * @brief ph_lookup() on the current table, in its own read section.
+ */
+static inline int ph_handle_lookup(ph_handle *h, int reader, const char *key) {
+    ph_table *t = ph_handle_enter(h, reader);
+    int found = t ? ph_lookup(t, key) : -1;
+    ph_handle_exit(h, reader);
+    return found;
+}
+
+/**
+ * @brief Publishes fresh, waits out the grace period and frees the table it
+ *        replaced. Readers keep running throughout; only the caller waits.
+ *        Must not be called from inside a read section.
+ */
+void ph_handle_swap(ph_handle *h, ph_table *fresh);
+
+/* Frees the handle and its current table; no reader may be inside */
+void ph_handle_free(ph_handle *h);
+
+#endif
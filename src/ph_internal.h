@@ -0,0 +1,114 @@
+#ifndef PH_INTERNAL_H
+#define PH_INTERNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ph.h"
+#include "hash.h"
+
+/**
+ * Build stages shared between the library's translation units. None of this
+ * is part of the public API in ph.h.
+ */
+
+/* hash.c */
+uint64_t fresh_seed(void);
+size_t first_level_size(size_t n, int hash_type, double load);
+int build_first_level_bucketing(ph_table *t, char **keys, const uint64_t *hashes, size_t n,
+    ph_rng_t *rng, char ***grouped, uint64_t **grouped_hashes, size_t **key_start);
+int build_second_level_bucketing(ph_table *t, size_t b, char **keys, const uint64_t *hashes,
+    size_t k, ph_rng_t *rng, int max_attempts, build_metrics_t *metrics);
+int build_hash_displace(ph_table *t, char **keys, const uint64_t *hashes, ph_rng_t *rng,
+    const ph_build_opts_t *opts, build_metrics_t *metrics);
+ph_table *build_hashed(char **keys, const size_t *lens, const uint64_t *hashes, size_t n, int hash_type,
+    const ph_build_opts_t *opts, build_metrics_t *metrics);
+size_t make_key_ref(ph_key_ref_t *ref, const char *key, size_t len, uint64_t pool_offset);
+size_t lookup_slot_hashed(ph_table *t, const char *key, size_t len, uint64_t kh);
+// Frees t->mem through the allocator it came from
+void release_table_mem(ph_table *t);
+
+/*
+ * Lookup steps, shared by the lookups in hash.c and the updates in
+ * ph_dynamic.c.
+ */
+
+/**
+ * @brief Level 1 bucket of a key hash.
+ */
+static inline size_t bucket_of(const ph_table *t, uint64_t kh) {
+    if(t->hash_type == PH_HASH_DISPLACE) return ph_skew_bucket(kh, t->level1_seed, (unsigned int)t->m);
+    return ph_reduce(ph_mix(kh, t->level1_seed), (unsigned int)t->m);
+}
+
+/**
+ * @brief A PH_HASH_DISPLACE key hash's position given its bucket b: its slot
+ *        when below n, else n past the remap entry that holds its slot.
+ */
+static inline size_t displaced_position(const ph_table *t, uint64_t kh, size_t b) {
+    return ph_displace(kh, ph_pilot_hash(t->pilots[b], t->level1_seed), t->pilot_range);
+}
+
+/**
+ * @brief The one slot a key hash can occupy given its bucket b, or PH_NO_SLOT
+ *        when b is an empty FKS bucket.
+ */
+static inline size_t slot_in_bucket(const ph_table *t, uint64_t kh, size_t b) {
+    if(t->hash_type == PH_HASH_DISPLACE) {
+        size_t slot = displaced_position(t, kh, b);
+        return (slot >= t->n) ? t->remap[slot - t->n] : slot;
+    }
+
+    ph_bucket_params_t p = t->params[b];
+    if(p.table_size == 0) return PH_NO_SLOT;
+
+    size_t slot = p.offset;
+    if(p.table_size > 1) slot += ph_reduce(ph_mix(kh, p.seed), p.table_size);
+    return slot;
+}
+
+/**
+ * @brief The fingerprint t stores for key hash kh: its top fingerprint_bits
+ *        bits (0 without fingerprints).
+ */
+static inline uint16_t table_fingerprint(const ph_table *t, uint64_t kh) {
+    return t->fingerprint_bits ? (uint16_t)(ph_fingerprint(kh) >> (16 - t->fingerprint_bits)) : 0;
+}
+
+/**
+ * @brief Whether slot may hold the key with key hash kh: a slot's stored
+ *        fingerprint must match before its key string is worth loading. It
+ *        shares the slot's record, so checking it costs no extra miss.
+ */
+static inline int fingerprint_matches(const ph_table *t, size_t slot, uint64_t kh) {
+    if(!t->fingerprint_bits) return 1;
+    uint16_t stored = t->own_keys ? t->keys[slot].fingerprint : t->slots[slot].fingerprint;
+    return stored == table_fingerprint(t, kh);
+}
+
+/**
+ * @brief Reports the start (begin = 1) or end of phase to opts' hook.
+ */
+static inline void ph_phase(const ph_build_opts_t *opts, int phase, int begin) {
+    if(opts->phase_hook) opts->phase_hook(phase, begin, opts->phase_ctx);
+}
+
+/* ph_dynamic.c */
+void release_dynamic(ph_table *t);
+
+/* ph_io.c */
+#define PH_FILE_ALIGN 64 // every table image and section starts at a multiple of this
+
+int write_at(FILE *f, size_t *at, size_t to, const void *data, size_t bytes);
+int save_table_image(const ph_table *t, FILE *f, size_t *bytes);
+ph_table *table_from_image(char *base, size_t bytes);
+void *map_file(const char *path, size_t *bytes);
+
+/* ph_parallel.c */
+int hash_keys_parallel(char **keys, const size_t *lens, size_t n, uint64_t *hashes, int num_threads);
+int build_second_level_parallel(ph_table *t, char **grouped, const uint64_t *grouped_hashes,
+    const size_t *key_start, int num_threads, int max_attempts, unsigned char *gave_up,
+    build_metrics_t *metrics);
+
+#endif
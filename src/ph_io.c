@@ -0,0 +1,304 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ph.h"
+#include "ph_internal.h"
+
+/**
+ * On-disk format, native endianness. A fixed header is followed by the
+ * table's arrays, each at a PH_FILE_ALIGN aligned offset from the start of
+ * the file:
+ *      - FKS:  params[m]
+ *      - HD:   pilots[m], remap[pilot_range - n]
+ *      - both: keys[num_slots] (ph_key_ref_t, fingerprints included), pool
+ *
+ * Keys are always stored owned (ph_key_ref_t plus pool), whatever the table
+ * being saved used, so nothing in the file is a pointer: ph_open_mmap()
+ * points a ph_table at the mapping and the lookup runs on it as is.
+ */
+
+#define PH_FILE_MAGIC 0x31454c4241544850ull // "PHTABLE1" read as a little endian u64
+#define PH_FILE_VERSION 2
+
+enum { SEC_PARAMS, SEC_PILOTS, SEC_REMAP, SEC_KEYS, SEC_POOL, SEC_COUNT };
+
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t header_bytes;
+    uint64_t n;
+    uint64_t m;
+    uint64_t num_slots;
+    uint64_t pilot_range;
+    uint32_t level1_seed;
+    int32_t hash_type;
+    int32_t fingerprint_bits;
+    uint32_t key_ref_bytes; // sizeof(ph_key_ref_t), guards against layout changes
+    uint64_t section_at[SEC_COUNT];
+    uint64_t section_bytes[SEC_COUNT];
+} ph_file_header_t;
+
+static size_t align_file(size_t x) {
+    return (x + PH_FILE_ALIGN - 1) & ~(size_t)(PH_FILE_ALIGN - 1);
+}
+
+/**
+ * @brief Pool bytes of t's keys once stored owned.
+ */
+static size_t owned_pool_bytes(const ph_table *t) {
+    if(t->own_keys) return t->pool_bytes;
+
+    size_t bytes = 0;
+    for(size_t s = 0; s < t->num_slots; s++) {
+        size_t len = t->slots[s].key ? t->slots[s].len : 0;
+        if(len > PH_INLINE_KEY_LEN) bytes += len + 1;
+    }
+    return bytes;
+}
+
+/**
+ * @brief Zero fills f from *at up to offset to, then writes bytes of data;
+ *        *at (where f stands) moves past them.
+ */
+int write_at(FILE *f, size_t *at, size_t to, const void *data, size_t bytes) {
+    static const char zeros[PH_FILE_ALIGN];
+    if(to < *at || fwrite(zeros, 1, to - *at, f) != to - *at) return -1;
+    if(bytes && fwrite(data, 1, bytes, f) != bytes) return -1;
+    *at = to + bytes;
+    return 0;
+}
+
+/**
+ * @brief Writes the key refs of a table that points at its caller's keys,
+ *        then the keys themselves into the pool section.
+ */
+static int write_pointer_keys(FILE *f, size_t *at, const ph_file_header_t *h, const ph_table *t) {
+    if(write_at(f, at, h->section_at[SEC_KEYS], NULL, 0) != 0) return -1;
+
+    uint64_t next = 0;
+    for(size_t s = 0; s < t->num_slots; s++) {
+        ph_key_ref_t ref;
+        next += make_key_ref(&ref, t->slots[s].key, t->slots[s].len, next);
+        ref.fingerprint = t->slots[s].fingerprint;
+        if(write_at(f, at, *at, &ref, sizeof(ref)) != 0) return -1;
+    }
+
+    if(write_at(f, at, h->section_at[SEC_POOL], NULL, 0) != 0) return -1;
+    for(size_t s = 0; s < t->num_slots; s++) {
+        size_t len = t->slots[s].key ? t->slots[s].len : 0;
+        if(len <= PH_INLINE_KEY_LEN) continue;
+        if(write_at(f, at, *at, t->slots[s].key, len) != 0 || write_at(f, at, *at, "", 1) != 0) return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Writes the image of t (header and sections) to f from its current
+ *        position; offsets in the image are relative to where it starts.
+ *
+ * @param bytes Receives the image size (a multiple of PH_FILE_ALIGN)
+ *
+ * @return 0 on success, -1 on a write error
+ */
+int save_table_image(const ph_table *t, FILE *f, size_t *bytes) {
+    ph_file_header_t h;
+    memset(&h, 0, sizeof(h));
+    h.magic = PH_FILE_MAGIC;
+    h.version = PH_FILE_VERSION;
+    h.header_bytes = sizeof(h);
+    h.n = t->n;
+    h.m = t->m;
+    h.num_slots = t->num_slots;
+    h.pilot_range = t->pilot_range;
+    h.level1_seed = t->level1_seed;
+    h.hash_type = t->hash_type;
+    h.fingerprint_bits = t->fingerprint_bits;
+    h.key_ref_bytes = sizeof(ph_key_ref_t);
+
+    const void *data[SEC_COUNT] = { 0 };
+    if(t->hash_type == PH_HASH_DISPLACE) {
+        h.section_bytes[SEC_PILOTS] = t->m * sizeof(uint16_t);
+        h.section_bytes[SEC_REMAP] = (t->m ? t->pilot_range - t->n : 0) * sizeof(uint32_t);
+        data[SEC_PILOTS] = t->pilots;
+        data[SEC_REMAP] = t->remap;
+    } else {
+        h.section_bytes[SEC_PARAMS] = t->m * sizeof(ph_bucket_params_t);
+        data[SEC_PARAMS] = t->params;
+    }
+    h.section_bytes[SEC_KEYS] = t->num_slots * sizeof(ph_key_ref_t);
+    h.section_bytes[SEC_POOL] = owned_pool_bytes(t);
+    data[SEC_KEYS] = t->keys;
+    data[SEC_POOL] = t->pool;
+
+    size_t end = align_file(sizeof(h));
+    for(int sec = 0; sec < SEC_COUNT; sec++) {
+        h.section_at[sec] = end;
+        end = align_file(end + h.section_bytes[sec]);
+    }
+
+    size_t at = 0;
+    int rc = write_at(f, &at, 0, &h, sizeof(h));
+    for(int sec = 0; rc == 0 && sec < SEC_KEYS; sec++) {
+        rc = write_at(f, &at, h.section_at[sec], data[sec], h.section_bytes[sec]);
+    }
+    if(rc == 0 && t->own_keys) {
+        for(int sec = SEC_KEYS; rc == 0 && sec < SEC_COUNT; sec++) {
+            rc = write_at(f, &at, h.section_at[sec], data[sec], h.section_bytes[sec]);
+        }
+    } else if(rc == 0) {
+        rc = write_pointer_keys(f, &at, &h, t);
+    }
+    if(rc == 0) rc = write_at(f, &at, end, NULL, 0); // pad the image to its full size
+    *bytes = end;
+    return rc;
+}
+
+int ph_save(const ph_table *t, const char *path) {
+    FILE *f = fopen(path, "wb");
+    if(!f) return -1;
+
+    size_t bytes;
+    int rc = save_table_image(t, f, &bytes);
+    if(fclose(f) != 0) rc = -1;
+    if(rc != 0) remove(path);
+    return rc;
+}
+
+/**
+ * @brief Maps the whole of path read only and shared.
+ *
+ * @return The mapping (its size in bytes), or NULL on failure
+ */
+void *map_file(const char *path, size_t *bytes) {
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return NULL;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    *bytes = (size_t)st.st_size;
+    void *base = mmap(NULL, *bytes, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps the file open
+    return (base == MAP_FAILED) ? NULL : base;
+}
+
+/**
+ * @brief Checks the header against the file it came from: every section
+ *        must lie inside the file and have the size the counts imply.
+ */
+static int header_is_valid(const ph_file_header_t *h, size_t file_bytes) {
+    if(h->magic != PH_FILE_MAGIC || h->version != PH_FILE_VERSION) return 0;
+    if(h->header_bytes != sizeof(*h) || h->key_ref_bytes != sizeof(ph_key_ref_t)) return 0;
+    if(h->hash_type < PH_FKS_QUADRATIC || h->hash_type > PH_HASH_DISPLACE) return 0;
+    if(h->fingerprint_bits != 0 && h->fingerprint_bits != 8 && h->fingerprint_bits != 16) return 0;
+
+    // every count is bounded by the file, so the sizes below can't overflow
+    if(h->m > file_bytes || h->num_slots > file_bytes || h->n > file_bytes) return 0;
+    uint64_t expect[SEC_COUNT] = { 0 };
+    if(h->hash_type == PH_HASH_DISPLACE) {
+        if(h->num_slots != h->n) return 0;
+        if(h->m && (h->pilot_range < h->n || h->pilot_range - h->n > file_bytes)) return 0;
+        expect[SEC_PILOTS] = h->m * sizeof(uint16_t);
+        expect[SEC_REMAP] = (h->m ? h->pilot_range - h->n : 0) * sizeof(uint32_t);
+    } else {
+        expect[SEC_PARAMS] = h->m * sizeof(ph_bucket_params_t);
+    }
+    expect[SEC_KEYS] = h->num_slots * sizeof(ph_key_ref_t);
+    expect[SEC_POOL] = h->section_bytes[SEC_POOL];
+
+    for(int sec = 0; sec < SEC_COUNT; sec++) {
+        if(h->section_bytes[sec] != expect[sec]) return 0;
+        if(h->section_at[sec] % PH_FILE_ALIGN != 0) return 0;
+        if(h->section_at[sec] > file_bytes || h->section_bytes[sec] > file_bytes - h->section_at[sec]) return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Checks what a lookup reads from the sections of a valid header:
+ *        every FKS bucket's slots lie below num_slots, every remap entry
+ *        is a slot, and every pooled key lies inside the pool. One pass over
+ *        the index arrays and key refs, the pool itself is not read.
+ */
+static int sections_are_valid(const ph_file_header_t *h, const char *base) {
+    if(h->hash_type == PH_HASH_DISPLACE) {
+        const uint32_t *remap = (const uint32_t *)(base + h->section_at[SEC_REMAP]);
+        size_t entries = h->section_bytes[SEC_REMAP] / sizeof(uint32_t);
+        for(size_t i = 0; i < entries; i++) {
+            if(remap[i] >= h->num_slots) return 0;
+        }
+    } else {
+        const ph_bucket_params_t *params = (const ph_bucket_params_t *)(base + h->section_at[SEC_PARAMS]);
+        for(size_t b = 0; b < h->m; b++) {
+            if((uint64_t)params[b].offset + params[b].table_size > h->num_slots) return 0;
+        }
+    }
+
+    const ph_key_ref_t *refs = (const ph_key_ref_t *)(base + h->section_at[SEC_KEYS]);
+    uint64_t pool_bytes = h->section_bytes[SEC_POOL];
+    for(size_t s = 0; s < h->num_slots; s++) {
+        if(refs[s].len == PH_EMPTY_SLOT || refs[s].len <= PH_INLINE_KEY_LEN) continue;
+        uint64_t offset;
+        memcpy(&offset, refs[s].bytes + PH_KEY_PREFIX_LEN, sizeof(offset));
+        if(offset > pool_bytes || refs[s].len > pool_bytes - offset) return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief A read only table over the image at base (from save_table_image()),
+ *        or NULL if the image is not valid. Only the ph_table itself is
+ *        allocated; its arrays all point into the image.
+ */
+ph_table *table_from_image(char *base, size_t bytes) {
+    if(bytes < sizeof(ph_file_header_t)) return NULL;
+
+    const ph_file_header_t *h = (const ph_file_header_t *)base;
+    if(!header_is_valid(h, bytes) || !sections_are_valid(h, base)) return NULL;
+    ph_table *t = calloc(1, sizeof(ph_table));
+    if(!t) return NULL;
+
+    t->n = h->n;
+    t->m = h->m;
+    t->num_slots = h->num_slots;
+    t->level1_seed = h->level1_seed;
+    t->hash_type = h->hash_type;
+    t->pilot_range = h->pilot_range;
+    t->fingerprint_bits = h->fingerprint_bits;
+    t->own_keys = 1;
+    t->pool_bytes = h->section_bytes[SEC_POOL];
+
+    // the sections are read only: nothing in a built table is written by a lookup
+    if(t->hash_type == PH_HASH_DISPLACE) {
+        t->pilots = (uint16_t *)(base + h->section_at[SEC_PILOTS]);
+        t->remap = (uint32_t *)(base + h->section_at[SEC_REMAP]);
+    } else {
+        t->params = (ph_bucket_params_t *)(base + h->section_at[SEC_PARAMS]);
+    }
+    t->keys = (ph_key_ref_t *)(base + h->section_at[SEC_KEYS]);
+    t->pool = base + h->section_at[SEC_POOL];
+    return t;
+}
+
+ph_table *ph_open_mmap(const char *path) {
+    size_t bytes;
+    char *base = map_file(path, &bytes);
+    if(!base) return NULL;
+
+    ph_table *t = table_from_image(base, bytes);
+    if(!t) {
+        munmap(base, bytes);
+        return NULL;
+    }
+    t->map = base;
+    t->map_bytes = bytes;
+    return t;
+}
@@ -0,0 +1,104 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ph.h"
+#include "ph_map.h"
+
+/**
+ * @brief Builds the index over keys and fills slot_of[i] with keys[i]'s slot.
+ */
+static ph_table *build_index(char **keys, size_t n, int hash_type, size_t **slot_of) {
+    ph_table *t = ph_build(keys, n, 0, hash_type, NULL);
+    *slot_of = malloc(sizeof(size_t) * (n ? n : 1));
+    if(!t || !*slot_of) {
+        ph_free(t);
+        free(*slot_of);
+        return NULL;
+    }
+
+    for(size_t i = 0; i < n; i++) (*slot_of)[i] = ph_lookup_slot(t, keys[i]);
+    return t;
+}
+
+ph_map *ph_map_build(char **keys, size_t n, const void *values, size_t value_size, int hash_type) {
+    if(value_size == 0) return NULL; // variable size values go through ph_map_build_var
+
+    size_t *slot_of = NULL;
+    ph_map *map = calloc(1, sizeof(ph_map));
+    if(!map || !(map->index = build_index(keys, n, hash_type, &slot_of))) {
+        free(map);
+        return NULL;
+    }
+
+    map->value_size = value_size;
+    map->values = calloc(map->index->num_slots ? map->index->num_slots : 1, value_size);
+    if(!map->values) {
+        free(slot_of);
+        ph_map_free(map);
+        return NULL;
+    }
+
+    const unsigned char *src = values;
+    for(size_t i = 0; i < n; i++) {
+        memcpy(map->values + slot_of[i] * value_size, src + i * value_size, value_size);
+    }
+
+    free(slot_of);
+    return map;
+}
+
+ph_map *ph_map_build_var(char **keys, size_t n, const void *const *values, const size_t *value_lens,
+    int hash_type) {
+
+    size_t *slot_of = NULL;
+    ph_map *map = calloc(1, sizeof(ph_map));
+    if(!map || !(map->index = build_index(keys, n, hash_type, &slot_of))) {
+        free(map);
+        return NULL;
+    }
+
+    // lengths by slot, then an exclusive prefix sum turns them into offsets
+    size_t num_slots = map->index->num_slots;
+    map->value_offsets = calloc(num_slots + 1, sizeof(size_t));
+    if(!map->value_offsets) goto fail;
+
+    for(size_t i = 0; i < n; i++) map->value_offsets[slot_of[i] + 1] = value_lens[i];
+    for(size_t s = 0; s < num_slots; s++) map->value_offsets[s + 1] += map->value_offsets[s];
+
+    map->values = malloc(map->value_offsets[num_slots] ? map->value_offsets[num_slots] : 1);
+    if(!map->values) goto fail;
+
+    for(size_t i = 0; i < n; i++) {
+        memcpy(map->values + map->value_offsets[slot_of[i]], values[i], value_lens[i]);
+    }
+
+    free(slot_of);
+    return map;
+
+fail:
+    free(slot_of);
+    ph_map_free(map);
+    return NULL;
+}
+
+const void *ph_map_get(const ph_map *map, const char *key, size_t *value_len) {
+    size_t slot = ph_lookup_slot(map->index, key);
+    if(slot == PH_NO_SLOT) return NULL;
+
+    if(map->value_size) {
+        if(value_len) *value_len = map->value_size;
+        return map->values + slot * map->value_size;
+    }
+
+    if(value_len) *value_len = map->value_offsets[slot + 1] - map->value_offsets[slot];
+    return map->values + map->value_offsets[slot];
+}
+
+void ph_map_free(ph_map *map) {
+    if(!map) return;
+
+    ph_free(map->index);
+    free(map->values);
+    free(map->value_offsets);
+    free(map);
+}
@@ -0,0 +1,53 @@
+#ifndef PH_MAP_H
+#define PH_MAP_H
+
+#include <stddef.h>
+
+#include "ph.h"
+
+/**
+ * A key -> value map on top of a perfect hash table. Values live in a dense
+ * array indexed by the key's slot, so ph_map_get() is the two-level probe of
+ * ph_lookup() plus one more load; there is no second hash map to consult.
+ *      - fixed size values (value_size > 0) are stored inline, value_size
+ *        bytes per slot
+ *      - variable size values (value_size == 0) are packed back to back in
+ *        one blob, in slot order; slot s owns the bytes
+ *        [value_offsets[s], value_offsets[s + 1])
+ *
+ * The value array has num_slots entries, so PH_FKS_MINIMAL and
+ * PH_HASH_DISPLACE tables (one slot per key) keep it dense.
+ */
+typedef struct {
+    ph_table *index;
+    size_t value_size; // bytes per value, 0 for variable size values
+    unsigned char *values; // inline values, or the blob
+    size_t *value_offsets; // variable size only, num_slots + 1 entries
+} ph_map;
+
+/**
+ * @brief Builds a map from keys[i] to the value_size bytes at
+ *        values + i * value_size.
+ *
+ * @return The map, or NULL on failure
+ */
+ph_map *ph_map_build(char **keys, size_t n, const void *values, size_t value_size, int hash_type);
+
+/**
+ * @brief Builds a map from keys[i] to the value_lens[i] bytes at values[i].
+ *
+ * @return The map, or NULL on failure
+ */
+ph_map *ph_map_build_var(char **keys, size_t n, const void *const *values, const size_t *value_lens,
+    int hash_type);
+
+/**
+ * @brief The value stored for key, or NULL if key is not in the map. The
+ *        value's length is written to value_len when it is not NULL. The
+ *        pointer stays valid until the map is freed.
+ */
+const void *ph_map_get(const ph_map *map, const char *key, size_t *value_len);
+
+void ph_map_free(ph_map *map);
+
+#endif
@@ -0,0 +1,220 @@
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "ph.h"
+#include "hash.h"
+#include "ph_internal.h"
+
+/**
+ * Once keys are grouped by bucket, every FKS bucket is independent: it owns
+ * its params entry and its slot range. The second level is therefore spread
+ * over a small work stealing pool:
+ *      - non-trivial buckets are sorted by size, largest first, and dealt
+ *        round robin onto one deque per worker, so every worker starts on
+ *        its heaviest buckets and no single heavy bucket is left for last
+ *      - a worker pops from the front (heaviest) of its own deque and, once
+ *        it runs dry, steals from the back (lightest) of the others
+ * Each bucket draws its seeds from its own stream of the table's seed, so
+ * the table is the same whichever worker builds which bucket. Each worker
+ * keeps its own build_metrics_t, merged once every worker has joined.
+ */
+
+typedef struct {
+    size_t *tasks; // bucket ids, heaviest first
+    size_t head;
+    size_t tail;
+    pthread_mutex_t lock;
+} task_deque_t;
+
+typedef struct {
+    ph_table *t;
+    char **grouped;
+    const uint64_t *grouped_hashes;
+    const size_t *key_start;
+    task_deque_t *deques;
+    int num_threads;
+    int max_attempts;
+    unsigned char *gave_up;
+} build_pool_t;
+
+typedef struct {
+    build_pool_t *pool;
+    int id;
+    build_metrics_t metrics;
+} build_worker_t;
+
+static int pop_front(task_deque_t *d, size_t *b) {
+    int ok = 0;
+    pthread_mutex_lock(&d->lock);
+    if(d->head < d->tail) {
+        *b = d->tasks[d->head++];
+        ok = 1;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return ok;
+}
+
+static int steal_back(task_deque_t *d, size_t *b) {
+    int ok = 0;
+    pthread_mutex_lock(&d->lock);
+    if(d->head < d->tail) {
+        *b = d->tasks[--d->tail];
+        ok = 1;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return ok;
+}
+
+static void *build_worker(void *arg) {
+    build_worker_t *w = arg;
+    build_pool_t *pool = w->pool;
+    size_t b;
+
+    while(1) {
+        int found = pop_front(&pool->deques[w->id], &b);
+        for(int i = 1; !found && i < pool->num_threads; i++) {
+            found = steal_back(&pool->deques[(w->id + i) % pool->num_threads], &b);
+        }
+        if(!found) break; // nothing is ever pushed back, so every deque is drained
+
+        size_t at = pool->key_start[b];
+        ph_rng_t rng = ph_rng_stream(pool->t->seed, PH_STREAM_BUCKET + b);
+        pool->gave_up[b] = (unsigned char)build_second_level_bucketing(pool->t, b, pool->grouped + at,
+            pool->grouped_hashes + at, pool->key_start[b + 1] - at, &rng, pool->max_attempts, &w->metrics);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Builds every second level bucket of t on num_threads threads.
+ *        Trivial buckets (0 or 1 key) are written by the calling thread.
+ *
+ * @param max_attempts See build_second_level_bucketing()
+ * @param gave_up Set for every bucket that ran out of attempts (m entries,
+ *                zeroed by the caller)
+ * @param metrics Receives the merged metrics of all workers (may be NULL)
+ *
+ * @return 0 on success, -1 if the pool could not be set up
+ */
+int build_second_level_parallel(ph_table *t, char **grouped, const uint64_t *grouped_hashes,
+    const size_t *key_start, int num_threads, int max_attempts, unsigned char *gave_up,
+    build_metrics_t *metrics) {
+
+    // bucket sort the non-trivial buckets by size, largest first
+    size_t max_k = 0, heavy = 0;
+    for(size_t b = 0; b < t->m; b++) {
+        size_t k = key_start[b + 1] - key_start[b];
+        if(k > max_k) max_k = k;
+        if(k > 1) heavy++;
+        else build_second_level_bucketing(t, b, grouped + key_start[b], grouped_hashes + key_start[b],
+            k, NULL, 0, metrics); // no seed to draw
+    }
+
+    int rc = -1;
+    int started = 0;
+    size_t *by_size = calloc(max_k + 2, sizeof(size_t));
+    size_t *order = malloc(sizeof(size_t) * (heavy ? heavy : 1));
+    size_t *tasks = malloc(sizeof(size_t) * (heavy ? heavy : 1));
+    task_deque_t *deques = calloc(num_threads, sizeof(task_deque_t));
+    build_worker_t *workers = calloc(num_threads, sizeof(build_worker_t));
+    pthread_t *threads = calloc(num_threads, sizeof(pthread_t));
+    if(!by_size || !order || !tasks || !deques || !workers || !threads) goto done;
+
+    for(size_t b = 0; b < t->m; b++) {
+        size_t k = key_start[b + 1] - key_start[b];
+        if(k > 1) by_size[max_k - k + 1]++;
+    }
+    for(size_t i = 0; i <= max_k; i++) by_size[i + 1] += by_size[i];
+    for(size_t b = 0; b < t->m; b++) {
+        size_t k = key_start[b + 1] - key_start[b];
+        if(k > 1) order[by_size[max_k - k]++] = b;
+    }
+
+    // deal round robin: worker w gets order[w], order[w + T], ... in one slice
+    build_pool_t pool = { t, grouped, grouped_hashes, key_start, deques, num_threads, max_attempts, gave_up };
+    size_t next = 0;
+    for(int w = 0; w < num_threads; w++) {
+        deques[w].tasks = tasks + next;
+        for(size_t i = (size_t)w; i < heavy; i += (size_t)num_threads) tasks[next++] = order[i];
+        deques[w].tail = (size_t)(tasks + next - deques[w].tasks);
+        pthread_mutex_init(&deques[w].lock, NULL);
+
+        workers[w].pool = &pool;
+        workers[w].id = w;
+    }
+
+    // a worker only exits once a scan of every deque comes up empty, so the
+    // deques of workers that failed to start are drained by the others
+    for(; started < num_threads; started++) {
+        if(pthread_create(&threads[started], NULL, build_worker, &workers[started]) != 0) break;
+    }
+    if(started == 0) build_worker(&workers[0]);
+    for(int w = 0; w < started; w++) pthread_join(threads[w], NULL);
+    rc = 0;
+
+    for(int w = 0; w < num_threads; w++) {
+        pthread_mutex_destroy(&deques[w].lock);
+        if(!metrics) continue;
+        metrics->total_attempts += workers[w].metrics.total_attempts;
+        metrics->total_buckets_processed += workers[w].metrics.total_buckets_processed;
+        metrics->total_collisions += workers[w].metrics.total_collisions;
+        if(workers[w].metrics.max_attemps_bucket > metrics->max_attemps_bucket) {
+            metrics->max_attemps_bucket = workers[w].metrics.max_attemps_bucket;
+        }
+    }
+
+done:
+    free(by_size);
+    free(order);
+    free(tasks);
+    free(deques);
+    free(workers);
+    free(threads);
+    return rc;
+}
+
+typedef struct {
+    char **keys;
+    const size_t *lens;
+    uint64_t *hashes;
+    size_t begin;
+    size_t end;
+} hash_range_t;
+
+static void *hash_range(void *arg) {
+    hash_range_t *r = arg;
+    for(size_t i = r->begin; i < r->end; i++) r->hashes[i] = ph_key_hash(r->keys[i], r->lens[i]);
+    return NULL;
+}
+
+/**
+ * @brief Computes the key hash of every key on num_threads threads,
+ *        each one taking a contiguous range of the key array.
+ *
+ * @return 0 on success, -1 on allocation failure
+ */
+int hash_keys_parallel(char **keys, const size_t *lens, size_t n, uint64_t *hashes, int num_threads) {
+    hash_range_t *ranges = calloc(num_threads, sizeof(hash_range_t));
+    pthread_t *threads = calloc(num_threads, sizeof(pthread_t));
+    int *started = calloc(num_threads, sizeof(int));
+    if(!ranges || !threads || !started) {
+        free(ranges);
+        free(threads);
+        free(started);
+        return -1;
+    }
+
+    for(int w = 0; w < num_threads; w++) {
+        ranges[w] = (hash_range_t){ keys, lens, hashes, n * w / num_threads, n * (w + 1) / num_threads };
+        started[w] = pthread_create(&threads[w], NULL, hash_range, &ranges[w]) == 0;
+        if(!started[w]) hash_range(&ranges[w]);
+    }
+    for(int w = 0; w < num_threads; w++) {
+        if(started[w]) pthread_join(threads[w], NULL);
+    }
+
+    free(ranges);
+    free(threads);
+    free(started);
+    return 0;
+}
@@ -0,0 +1,160 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ph_u64.h"
+#include "ph_internal.h"
+
+/**
+ * @brief Draws an odd multiplier for multiply-shift.
+ */
+static uint64_t draw_mult(ph_rng_t *rng) {
+    return ph_rng_next(rng) | 1;
+}
+
+/**
+ * @brief Finds a multiplier that sends bucket b's k keys to distinct slots
+ *        and writes them there. taken is scratch space of at least the
+ *        bucket's size, all clear, and is left clear.
+ */
+static void build_bucket(ph_u64_table *t, size_t b, const uint64_t *keys, size_t k, unsigned char *taken,
+    build_metrics_t *metrics) {
+
+    ph_u64_bucket_t *p = &t->buckets[b];
+    uint64_t *slots = t->slots + p->offset;
+    ph_rng_t rng = ph_rng_stream(t->seed, PH_STREAM_BUCKET + b);
+    int attempt = 0;
+
+    while(1) {
+        attempt++;
+        p->mult = draw_mult(&rng);
+        size_t i = 0;
+        for(; i < k; i++) {
+            size_t s = ph_mulshift(keys[i], p->mult, p->size);
+            if(taken[s]) break;
+            taken[s] = 1;
+        }
+        for(size_t j = 0; j < i; j++) taken[ph_mulshift(keys[j], p->mult, p->size)] = 0;
+        if(i == k) break;
+        if(metrics) metrics->total_collisions++;
+    }
+
+    for(size_t i = 0; i < k; i++) slots[ph_mulshift(keys[i], p->mult, p->size)] = keys[i];
+    if(metrics) {
+        metrics->total_attempts += attempt;
+        metrics->total_buckets_processed++;
+        if(attempt > metrics->max_attemps_bucket) metrics->max_attemps_bucket = attempt;
+    }
+}
+
+/**
+ * @brief Whether two of the k keys are equal; such a bucket has no
+ *        multiplier that separates them.
+ */
+static int has_duplicate(const uint64_t *keys, size_t k) {
+    for(size_t i = 1; i < k; i++) {
+        for(size_t j = 0; j < i; j++) {
+            if(keys[i] == keys[j]) return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Draws level 1 multipliers until the sum of k^2 over the buckets is
+ *        within PH_FKS_SKEW of its expectation (the last draw is kept
+ *        regardless), leaving the bucket sizes in start[b + 1].
+ */
+static void draw_level1(ph_u64_table *t, const uint64_t *keys, size_t *start, build_metrics_t *metrics) {
+    if(t->m == 0) return;
+
+    ph_rng_t rng = ph_rng_stream(t->seed, PH_STREAM_LEVEL1);
+    double n = (double)t->n;
+    double bound = PH_FKS_SKEW * (n + n * (n - 1) / (double)t->m);
+
+    for(int draw = 0; draw < PH_FKS_LEVEL1_TRIES; draw++) {
+        if(metrics) metrics->level1_draws++;
+        t->level1_mult = draw_mult(&rng);
+        memset(start, 0, (t->m + 1) * sizeof(size_t));
+        for(size_t i = 0; i < t->n; i++) start[ph_mulshift(keys[i], t->level1_mult, t->m) + 1]++;
+
+        double sum = 0;
+        for(size_t b = 0; b < t->m; b++) sum += (double)start[b + 1] * (double)start[b + 1];
+        if(sum <= bound) return;
+    }
+}
+
+ph_u64_table *ph_build_u64(const uint64_t *keys, size_t n, uint64_t seed, build_metrics_t *metrics) {
+    if(metrics) memset(metrics, 0, sizeof(*metrics));
+    if(n > UINT32_MAX) return NULL; // offsets are 32-bit
+
+    ph_u64_table *t = calloc(1, sizeof(ph_u64_table));
+    size_t *start = calloc(n + 1, sizeof(size_t));
+    uint64_t *grouped = malloc(sizeof(uint64_t) * (n ? n : 1));
+    unsigned char *taken = NULL;
+    if(!t || !start || !grouped) goto fail;
+
+    t->n = n;
+    t->m = n;
+    t->seed = seed ? seed : fresh_seed();
+    draw_level1(t, keys, start, metrics);
+
+    size_t num_slots = 0, max_size = 0;
+    for(size_t b = 0; b < t->m; b++) {
+        size_t k = start[b + 1];
+        size_t size = (k <= 1) ? k : k * k;
+        num_slots += size;
+        if(size > max_size) max_size = size;
+    }
+    if(num_slots > UINT32_MAX) goto fail;
+
+    // counting sort the keys into their buckets, as build_first_level_bucketing()
+    for(size_t b = 0; b < t->m; b++) start[b + 1] += start[b];
+    for(size_t i = 0; i < n; i++) grouped[start[ph_mulshift(keys[i], t->level1_mult, t->m)]++] = keys[i];
+    for(size_t b = t->m; b > 0; b--) start[b] = start[b - 1];
+    start[0] = 0;
+
+    size_t slots_at = t->m * sizeof(ph_u64_bucket_t);
+    t->mem_bytes = slots_at + num_slots * sizeof(uint64_t);
+    t->mem = malloc(t->mem_bytes ? t->mem_bytes : 1);
+    taken = calloc(max_size ? max_size : 1, 1);
+    if(!t->mem || !taken) goto fail;
+    t->buckets = (ph_u64_bucket_t *)t->mem;
+    t->slots = (uint64_t *)((char *)t->mem + slots_at);
+    t->num_slots = num_slots;
+
+    size_t next = 0;
+    for(size_t b = 0; b < t->m; b++) {
+        size_t k = start[b + 1] - start[b];
+        ph_u64_bucket_t *p = &t->buckets[b];
+        p->mult = 1;
+        p->offset = k ? (uint32_t)next : 0; // an empty bucket sends every key to slot 0
+        p->size = (uint32_t)((k <= 1) ? k : k * k);
+        next += p->size;
+    }
+    for(size_t s = 0; s < num_slots; s++) t->slots[s] = keys[0];
+
+    for(size_t b = 0; b < t->m; b++) {
+        size_t k = start[b + 1] - start[b];
+        if(has_duplicate(grouped + start[b], k)) goto fail;
+        if(k == 1) t->slots[t->buckets[b].offset] = grouped[start[b]];
+        else if(k > 1) build_bucket(t, b, grouped + start[b], k, taken, metrics);
+    }
+
+    free(start);
+    free(grouped);
+    free(taken);
+    return t;
+
+fail:
+    free(start);
+    free(grouped);
+    free(taken);
+    ph_free_u64(t);
+    return NULL;
+}
+
+void ph_free_u64(ph_u64_table *t) {
+    if(!t) return;
+    free(t->mem);
+    free(t);
+}
@@ -0,0 +1,70 @@
+#ifndef PH_U64_H
+#define PH_U64_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ph.h"
+#include "hash.h"
+
+/**
+ * Perfect hash tables over 64-bit integer keys. The scheme is the FKS one
+ * of PH_FKS_QUADRATIC, with multiply-shift (ph_mulshift()) at both levels
+ * in place of the string key hash: level 1 maps a key onto one of m = n
+ * buckets, and each bucket of k keys has k^2 slots and an odd multiplier
+ * of its own.
+ *
+ * Keys are stored inline in the slot array, so a lookup is two multiplies,
+ * a load of the bucket and a load and compare of the slot, with no strings
+ * and no pointers. Every slot holds a key of the set: empty slots repeat a
+ * key whose own slot is elsewhere, so a key that reaches a slot and equals
+ * its contents is in the table, and no slot needs an empty marker (0 and
+ * UINT64_MAX are ordinary keys).
+ */
+
+typedef struct {
+    uint64_t mult; // odd multiplier of the bucket's multiply-shift
+    uint32_t offset; // first slot
+    uint32_t size; // slots, k^2 for k keys
+} ph_u64_bucket_t;
+
+typedef struct {
+    size_t n;
+    size_t m;
+    size_t num_slots;
+    uint64_t level1_mult; // odd multiplier of level 1
+    uint64_t seed; // the build's seed, as in ph_table
+    ph_u64_bucket_t *buckets; // m entries
+    uint64_t *slots; // num_slots keys
+    void *mem; // backs buckets and slots
+    size_t mem_bytes;
+} ph_u64_table;
+
+/**
+ * @brief Builds a table over n distinct keys. seed works as in
+ *        ph_build_opts_t: every multiplier comes from it, and 0 picks a
+ *        fresh one.
+ *
+ * @return The table, or NULL on failure or duplicate keys
+ */
+ph_u64_table *ph_build_u64(const uint64_t *keys, size_t n, uint64_t seed, build_metrics_t *metrics);
+
+/**
+ * @brief The slot key would occupy, in [0, t->num_slots). Only meaningful
+ *        for a key that ph_lookup_u64() finds; t must not be empty.
+ */
+static inline size_t ph_u64_slot(const ph_u64_table *t, uint64_t key) {
+    const ph_u64_bucket_t *b = &t->buckets[ph_mulshift(key, t->level1_mult, t->m)];
+    return b->offset + ph_mulshift(key, b->mult, b->size);
+}
+
+/**
+ * @brief Same contract as ph_lookup(): 0 if key is in t, -1 otherwise.
+ */
+static inline int ph_lookup_u64(const ph_u64_table *t, uint64_t key) {
+    return (t->n && t->slots[ph_u64_slot(t, key)] == key) ? 0 : -1;
+}
+
+void ph_free_u64(ph_u64_table *t);
+
+#endif
@@ -3,8 +3,19 @@
 #include <string.h>
 #include <time.h>
 #include <assert.h> 
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include "../src/ph.h"
+#include "../src/ph_internal.h"
+#include "../src/hash.h"
+#include "../src/ph_map.h"
+#include "../src/ph_external.h"
+#include "../src/ph_handle.h"
+#include "../src/ph_u64.h"
+#include "../src/ph_arena.h"
+#include "codegen_keys.h" // generated by ph_codegen from tests/codegen_keys.txt
 
 void test_basic_correctness() { 
 
@@ -38,6 +49,18 @@ void test_basic_correctness() {
     assert(ph_lookup(t_mph, "notfound") == -1);
     
     ph_free(t_mph);
+
+    // Test hash-and-displace MPH
+    ph_table *t_hd = ph_build(keys, n, max_str_len, 2, NULL);
+
+    for(size_t i = 0; i < n; i++) { 
+        assert(ph_lookup(t_hd, keys[i]) == 0);
+    }
+
+    assert(ph_lookup(t_hd, "notfound") == -1);
+    assert(t_hd->num_slots == n); // minimal: one slot per key
+
+    ph_free(t_hd);
     printf("Basic Correctness Passed!\n\n"); 
 }
 
@@ -67,7 +90,7 @@ void test_collision_free() {
     size_t n = sizeof(keys)/sizeof(keys[0]); 
     size_t max_str_len = 10; 
 
-    for(int hash_type = 0; hash_type <= 1; hash_type++) {
+    for(int hash_type = 0; hash_type <= 2; hash_type++) {
         ph_table *t = ph_build(keys, n, max_str_len, hash_type, NULL);
         
         // Verify: each key appears exactly once in structure
@@ -98,7 +121,7 @@ void stress_test() {
         snprintf(keys[i], max_str_len, "key_%d", i); 
     }
 
-    for(int hash_type = 0; hash_type <= 1; hash_type++) {
+    for(int hash_type = 0; hash_type <= 2; hash_type++) {
         ph_table *t = ph_build(keys, n, max_str_len, hash_type, NULL);
         
         // Verify all keys can be found
@@ -141,6 +164,16 @@ void test_edge_cases() {
     assert(ph_lookup(t2, "third") == -1);
     ph_free(t2);
 
+    // hash-and-displace with a single key and with no keys at all 
+    ph_table *t4 = ph_build(single, 1, 10, 2, NULL);
+    assert(ph_lookup(t4, "only") == 0);
+    assert(ph_lookup(t4, "nope") == -1);
+    ph_free(t4);
+
+    ph_table *t5 = ph_build(NULL, 0, 10, 2, NULL);
+    assert(ph_lookup(t5, "only") == -1);
+    ph_free(t5);
+
     // keys w/ common prefix 
     char *prefixes[] = {"test", "testing", "tester", "test123"};
     ph_table *t3 = ph_build(prefixes, 4, 10, 1, NULL);
@@ -152,6 +185,1178 @@ void test_edge_cases() {
     printf("Edge Cases Passed!\n\n"); 
 }
 
+/** 
+ * @brief Keys are no longer bounded by max_str_len; make sure keys far longer 
+ *        than it (and differing only at the tail) still hash apart. 
+ */
+void test_long_keys() { 
+    printf("Running long key test... \n"); 
+
+    int n = 200; 
+    int len = 300; 
+
+    char **keys = malloc(n * sizeof(char *)); 
+    for(int i = 0; i < n; i++) { 
+        keys[i] = malloc(len + 1); 
+        memset(keys[i], 'x', len); 
+        snprintf(keys[i] + len - 8, 9, "%08d", i); 
+    }
+
+    for(int hash_type = 0; hash_type <= 2; hash_type++) { 
+        ph_table *t = ph_build(keys, n, 4, hash_type, NULL); 
+        for(int i = 0; i < n; i++) { 
+            assert(ph_lookup(t, keys[i]) == 0); 
+        }
+        // a copy: the table points at keys[0], so editing it in place would edit the stored key too 
+        char probe[301]; 
+        memcpy(probe, keys[0], len + 1); 
+        probe[len - 1] = '#'; 
+        assert(ph_lookup(t, probe) == -1); 
+        ph_free(t); 
+    }
+
+    for(int i = 0; i < n; i++) free(keys[i]); 
+    free(keys); 
+
+    printf("Long Keys Passed!\n\n"); 
+}
+
+/** 
+ * @brief The threaded build must give a correct table and merged metrics: 
+ *        every non-trivial bucket is processed exactly once, whichever 
+ *        worker ends up building it. 
+ */
+void test_parallel_build() { 
+    printf("Running parallel build test... \n"); 
+
+    int n = 5000; 
+    int max_str_len = 20; 
+
+    char **keys = malloc(n * sizeof(char *)); 
+    for(int i = 0; i < n; i++) { 
+        keys[i] = malloc(max_str_len); 
+        snprintf(keys[i], max_str_len, "pkey_%d", i); 
+    }
+
+    for(int hash_type = 0; hash_type <= 2; hash_type++) { 
+        for(int threads = 1; threads <= 4; threads++) { 
+            build_metrics_t metrics; 
+            ph_table *t = ph_build_parallel(keys, n, max_str_len, hash_type, threads, &metrics); 
+            assert(t != NULL); 
+
+            for(int i = 0; i < n; i++) { 
+                assert(ph_lookup(t, keys[i]) == 0); 
+            }
+            assert(ph_lookup(t, "pkey_-1") == -1); 
+
+            if(hash_type != 2) { 
+                int heavy = 0; 
+                for(size_t b = 0; b < t->m; b++) { 
+                    if(t->params[b].table_size > 1) heavy++; 
+                }
+                assert(metrics.total_buckets_processed == heavy); 
+                assert(metrics.total_attempts >= heavy); 
+            }
+            ph_free(t); 
+        }
+    }
+
+    for(int i = 0; i < n; i++) free(keys[i]); 
+    free(keys); 
+
+    printf("Parallel Build Passed!\n\n"); 
+}
+
+/** 
+ * @brief ph_lookup_batch must agree with ph_lookup key for key, including 
+ *        misses and a final group shorter than PH_BATCH_GROUP. 
+ */
+void test_lookup_batch() { 
+    printf("Running batch lookup test... \n"); 
+
+    int n = 1000; 
+    int probes = 2 * n + 7; 
+    int max_str_len = 20; 
+
+    char **keys = malloc(probes * sizeof(char *)); 
+    for(int i = 0; i < probes; i++) { 
+        keys[i] = malloc(max_str_len); 
+        snprintf(keys[i], max_str_len, "bkey_%d", i); 
+    }
+    int *results = malloc(probes * sizeof(int)); 
+
+    for(int hash_type = 0; hash_type <= 2; hash_type++) { 
+        // only the first n keys go in, the rest are misses
+        ph_table *t = ph_build(keys, n, max_str_len, hash_type, NULL); 
+
+        ph_lookup_batch(t, keys, probes, results); 
+        for(int i = 0; i < probes; i++) { 
+            assert(results[i] == ph_lookup(t, keys[i])); 
+            assert(results[i] == (i < n ? 0 : -1)); 
+        }
+        ph_free(t); 
+    }
+
+    free(results); 
+    for(int i = 0; i < probes; i++) free(keys[i]); 
+    free(keys); 
+
+    printf("Batch Lookup Passed!\n\n"); 
+}
+
+/** 
+ * @brief Every key hash kernel the CPU supports must agree with the scalar 
+ *        kernel bit for bit, for every length from 0 to 300 (so across the 
+ *        16 and 32 byte block boundaries) and for bytes the string API can't 
+ *        express (embedded zeros, 0xff). 
+ */
+void test_hash_kernels() { 
+    printf("Running hash kernel test... \n"); 
+
+    unsigned char buf[300]; 
+    for(size_t i = 0; i < sizeof(buf); i++) buf[i] = (unsigned char)rand(); 
+    buf[3] = 0; 
+    buf[17] = 0xff; 
+
+    for(int kernel = 0; kernel < PH_KERNEL_COUNT; kernel++) { 
+        if(!ph_key_hash_kernel_supported(kernel)) { 
+            printf("  %s: not supported, skipped\n", ph_key_hash_kernel_name(kernel)); 
+            continue; 
+        }
+        for(size_t len = 0; len <= sizeof(buf); len++) { 
+            for(size_t off = 0; off < 4 && off + len <= sizeof(buf); off++) { 
+                assert(ph_key_hash_with(kernel, buf + off, len) == 
+                    ph_key_hash_with(PH_KERNEL_SCALAR, buf + off, len)); 
+            }
+        }
+        // keys that end right at a page boundary take the copying tail path
+        unsigned char *page = aligned_alloc(4096, 2 * 4096); 
+        for(size_t i = 0; i < 2 * 4096; i++) page[i] = (unsigned char)rand(); 
+        for(size_t len = 0; len <= 40; len++) { 
+            unsigned char *key = page + 4096 - len; 
+            assert(ph_key_hash_with(kernel, key, len) == ph_key_hash_with(PH_KERNEL_SCALAR, key, len)); 
+        }
+        free(page); 
+
+        printf("  %s: matches scalar\n", ph_key_hash_kernel_name(kernel)); 
+    }
+
+    // the dispatched kernel and the string entry point agree too
+    assert(first_level_hashing("kernel") == ph_key_hash_with(PH_KERNEL_SCALAR, "kernel", 6)); 
+
+    // zero padding of the last block must not hide the length
+    unsigned char zeros[16] = { 0 }; 
+    for(size_t len = 1; len < sizeof(zeros); len++) { 
+        assert(ph_key_hash(zeros, len) != ph_key_hash(zeros, len - 1)); 
+    }
+
+    // a pair that shared a key hash when the lanes were combined linearly; 
+    // no build seed can separate such keys, so every hash type must build 
+    char *pair[2] = { "mierjxdsnuafgccd", "kjgqufmckfssvljz" }; 
+    for(int kernel = 0; kernel < PH_KERNEL_COUNT; kernel++) { 
+        if(!ph_key_hash_kernel_supported(kernel)) continue; 
+        assert(ph_key_hash_with(kernel, pair[0], 16) != ph_key_hash_with(kernel, pair[1], 16)); 
+    }
+    for(int hash_type = 0; hash_type <= 2; hash_type++) { 
+        ph_table *t = ph_build(pair, 2, 16, hash_type, NULL); 
+        assert(t); 
+        assert(ph_lookup(t, pair[0]) == 0 && ph_lookup(t, pair[1]) == 0); 
+        ph_free(t); 
+    }
+
+    printf("Hash Kernels Passed!\n\n"); 
+}
+
+/** 
+ * @brief ph_map must hand back each key's own value, inline or from the blob, 
+ *        and NULL for keys it was not built from. 
+ */
+void test_map() { 
+    printf("Running map test... \n"); 
+
+    int n = 500; 
+    int max_str_len = 20; 
+    char **keys = malloc(n * sizeof(char *)); 
+    uint64_t *fixed = malloc(n * sizeof(uint64_t)); 
+    char **var = malloc(n * sizeof(char *)); 
+    size_t *var_lens = malloc(n * sizeof(size_t)); 
+    for(int i = 0; i < n; i++) { 
+        keys[i] = malloc(max_str_len); 
+        snprintf(keys[i], max_str_len, "mkey_%d", i); 
+        fixed[i] = (uint64_t)i * 2654435761u; 
+        var_lens[i] = i % 7; // includes empty values
+        var[i] = malloc(8); 
+        memset(var[i], 'a' + i % 26, 8); 
+    }
+
+    for(int hash_type = 0; hash_type <= 2; hash_type++) { 
+        ph_map *m = ph_map_build(keys, n, fixed, sizeof(uint64_t), hash_type); 
+        ph_map *mv = ph_map_build_var(keys, n, (const void *const *)var, var_lens, hash_type); 
+        assert(m && mv); 
+
+        for(int i = 0; i < n; i++) { 
+            size_t len = 0; 
+            const uint64_t *v = ph_map_get(m, keys[i], &len); 
+            assert(v && len == sizeof(uint64_t) && *v == fixed[i]); 
+
+            const char *bytes = ph_map_get(mv, keys[i], &len); 
+            assert(bytes && len == var_lens[i]); 
+            assert(memcmp(bytes, var[i], len) == 0); 
+        }
+        assert(ph_map_get(m, "notfound", NULL) == NULL); 
+        assert(ph_map_get(mv, "mkey_", NULL) == NULL); 
+
+        ph_map_free(m); 
+        ph_map_free(mv); 
+    }
+
+    for(int i = 0; i < n; i++) { 
+        free(keys[i]); 
+        free(var[i]); 
+    }
+    free(keys); 
+    free(fixed); 
+    free(var); 
+    free(var_lens); 
+
+    printf("Map Passed!\n\n"); 
+}
+
+/** 
+ * @brief Tables built with fingerprints must answer exactly like tables 
+ *        without them, through both ph_lookup and ph_lookup_batch. 
+ */
+void test_fingerprints() { 
+    printf("Running fingerprint test... \n"); 
+
+    int n = 2000; 
+    int probes = 3 * n; 
+    int max_str_len = 20; 
+    char **keys = malloc(probes * sizeof(char *)); 
+    for(int i = 0; i < probes; i++) { 
+        keys[i] = malloc(max_str_len); 
+        snprintf(keys[i], max_str_len, "fkey_%d", i); 
+    }
+    int *results = malloc(probes * sizeof(int)); 
+
+    ph_build_opts_t bad = { .fingerprint_bits = 12 }; 
+    assert(ph_build_opts(keys, n, 0, &bad, NULL) == NULL); 
+
+    for(int hash_type = 0; hash_type <= 2; hash_type++) { 
+        for(int bits = 8; bits <= 16; bits += 8) { 
+            ph_build_opts_t opts = { .fingerprint_bits = bits }; 
+            ph_table *t = ph_build_opts(keys, n, hash_type, &opts, NULL); 
+            assert(t && t->fingerprint_bits == bits); 
+
+            ph_lookup_batch(t, keys, probes, results); 
+            for(int i = 0; i < probes; i++) { 
+                int expected = (i < n) ? 0 : -1; 
+                assert(ph_lookup(t, keys[i]) == expected); 
+                assert(results[i] == expected); 
+            }
+            ph_free(t); 
+        }
+    }
+
+    free(results); 
+    for(int i = 0; i < probes; i++) free(keys[i]); 
+    free(keys); 
+
+    printf("Fingerprints Passed!\n\n"); 
+}
+
+/** 
+ * @brief A table built with own_keys must keep answering after the caller's 
+ *        keys are scribbled over and freed, for inline (<= 12 chars), pooled 
+ *        and empty keys, and must reject keys that share a length or prefix. 
+ */
+void test_owned_keys() { 
+    printf("Running owned keys test... \n"); 
+
+    int n = 1000; 
+    int max_str_len = 40; 
+    char **keys = malloc(n * sizeof(char *)); 
+    char **probes = malloc(n * sizeof(char *)); 
+    for(int i = 0; i < n; i++) { 
+        keys[i] = malloc(max_str_len); 
+        probes[i] = malloc(max_str_len); 
+        if(i == 0) snprintf(keys[i], max_str_len, "%s", ""); 
+        else if(i % 2) snprintf(keys[i], max_str_len, "k%d", i); // inline
+        else snprintf(keys[i], max_str_len, "owned_long_key_%d_%s", i, "xxxxxxxx"); // pooled
+        strcpy(probes[i], keys[i]); 
+    }
+    int *results = malloc(n * sizeof(int)); 
+
+    for(int hash_type = 0; hash_type <= 2; hash_type++) { 
+        for(int bits = 0; bits <= 8; bits += 8) { 
+            char **copy = malloc(n * sizeof(char *)); 
+            for(int i = 0; i < n; i++) copy[i] = strdup(keys[i]); 
+
+            ph_build_opts_t opts = { .own_keys = 1, .fingerprint_bits = bits }; 
+            ph_table *t = ph_build_opts(copy, n, hash_type, &opts, NULL); 
+            assert(t && t->slots == NULL); 
+
+            for(int i = 0; i < n; i++) { 
+                memset(copy[i], '#', strlen(copy[i])); 
+                free(copy[i]); 
+            }
+            free(copy); 
+
+            ph_lookup_batch(t, probes, n, results); 
+            for(int i = 0; i < n; i++) { 
+                assert(ph_lookup(t, probes[i]) == 0); 
+                assert(results[i] == 0); 
+            }
+            assert(ph_lookup(t, "k2") == -1); // same length as k1..k9, never inserted
+            assert(ph_lookup(t, "owned_long_key_1_xxxxxxxx") == -1); // shares the prefix
+            assert(ph_lookup(t, "zz") == -1); 
+            ph_free(t); 
+        }
+    }
+
+    free(results); 
+    for(int i = 0; i < n; i++) { 
+        free(keys[i]); 
+        free(probes[i]); 
+    }
+    free(keys); 
+    free(probes); 
+
+    printf("Owned Keys Passed!\n\n"); 
+}
+
+/** 
+ * @brief A table saved with ph_save and mapped back with ph_open_mmap must 
+ *        put every key in the same slot, for pointer and owned tables, and 
+ *        files that are cut short or not tables must be refused. 
+ */
+void test_save_mmap() { 
+    printf("Running save / mmap test... \n"); 
+
+    int n = 3000; 
+    int probes = 2 * n; 
+    int max_str_len = 40; 
+    char path[64]; 
+    snprintf(path, sizeof(path), "/tmp/ph_test_%d.phm", (int)getpid()); 
+
+    char **keys = malloc(probes * sizeof(char *)); 
+    for(int i = 0; i < probes; i++) { 
+        keys[i] = malloc(max_str_len); 
+        if(i % 3) snprintf(keys[i], max_str_len, "s%d", i); 
+        else snprintf(keys[i], max_str_len, "a_rather_long_saved_key_%d", i); 
+    }
+    int *results = malloc(probes * sizeof(int)); 
+
+    for(int hash_type = 0; hash_type <= 2; hash_type++) { 
+        for(int variant = 0; variant < 4; variant++) { 
+            ph_build_opts_t opts = { .own_keys = variant & 1, .fingerprint_bits = (variant & 2) ? 16 : 0 }; 
+            ph_table *t = ph_build_opts(keys, n, hash_type, &opts, NULL); 
+            assert(t && ph_save(t, path) == 0); 
+
+            ph_table *mapped = ph_open_mmap(path); 
+            assert(mapped && mapped->map && mapped->own_keys); 
+            ph_lookup_batch(mapped, keys, probes, results); 
+            for(int i = 0; i < probes; i++) { 
+                assert(ph_lookup_slot(mapped, keys[i]) == ph_lookup_slot(t, keys[i])); 
+                assert(results[i] == (i < n ? 0 : -1)); 
+            }
+            ph_free(mapped); 
+            ph_free(t); 
+        }
+    }
+
+    // an empty table round trips too
+    ph_table *empty = ph_build(NULL, 0, 0, 2, NULL); 
+    assert(ph_save(empty, path) == 0); 
+    ph_table *mapped_empty = ph_open_mmap(path); 
+    assert(mapped_empty && ph_lookup(mapped_empty, "x") == -1); 
+    ph_free(mapped_empty); 
+    ph_free(empty); 
+
+    // a section pointing out of bounds is refused: a bucket past the slots, 
+    // a remap entry past n, a pooled key past the pool 
+    for(int hash_type = 0; hash_type <= 2; hash_type += 2) { 
+        ph_table *t = ph_build(keys, n, max_str_len, hash_type, NULL); 
+        assert(ph_save(t, path) == 0); 
+        ph_table *mapped = ph_open_mmap(path); 
+        char *base = mapped->map; 
+        long index_at = (hash_type == PH_HASH_DISPLACE) ? (char *)mapped->remap - base : (char *)mapped->params - base; 
+        uint32_t bad_index[2] = { (uint32_t)mapped->num_slots, UINT32_MAX }; // remap[0], or params[0] (seed, size) 
+        size_t pooled = 0; 
+        while(mapped->keys[pooled].len == PH_EMPTY_SLOT || mapped->keys[pooled].len <= PH_INLINE_KEY_LEN) pooled++; 
+        long offset_at = (char *)&mapped->keys[pooled].bytes[PH_KEY_PREFIX_LEN] - base; 
+        uint64_t bad_offset = mapped->pool_bytes; 
+        ph_free(mapped); 
+
+        for(int patch = 0; patch < 2; patch++) { 
+            assert(ph_save(t, path) == 0); 
+            FILE *f = fopen(path, "r+b"); 
+            assert(fseek(f, patch ? offset_at : index_at, SEEK_SET) == 0); 
+            if(patch) fwrite(&bad_offset, sizeof(bad_offset), 1, f); 
+            else fwrite(bad_index, sizeof(uint32_t), (hash_type == PH_HASH_DISPLACE) ? 1 : 2, f); 
+            fclose(f); 
+            assert(ph_open_mmap(path) == NULL); 
+        }
+        ph_free(t); 
+    }
+
+    // truncated file and garbage are refused
+    ph_table *t = ph_build(keys, n, max_str_len, 1, NULL); 
+    assert(ph_save(t, path) == 0); 
+    assert(truncate(path, 200) == 0); 
+    assert(ph_open_mmap(path) == NULL); 
+    FILE *f = fopen(path, "wb"); 
+    for(int i = 0; i < 4096; i++) fputc(i, f); 
+    fclose(f); 
+    assert(ph_open_mmap(path) == NULL); 
+    assert(ph_open_mmap("/nonexistent/ph_table") == NULL); 
+    ph_free(t); 
+    remove(path); 
+
+    free(results); 
+    for(int i = 0; i < probes; i++) free(keys[i]); 
+    free(keys); 
+
+    printf("Save / mmap Passed!\n\n"); 
+}
+
+typedef struct { 
+    char **keys; 
+    int n; 
+    int next; 
+} key_array_iter_t; 
+
+static const char *next_array_key(void *ctx) { 
+    key_array_iter_t *it = ctx; 
+    return (it->next < it->n) ? it->keys[it->next++] : NULL; 
+}
+
+void test_external_build() { 
+    printf("Running external build test... \n"); 
+
+    int n = 20000; 
+    int probes = 2 * n; 
+    int max_str_len = 40; 
+    char keys_path[64], out_path[64], spill_path[80]; 
+    snprintf(keys_path, sizeof(keys_path), "/tmp/ph_test_%d.keys", (int)getpid()); 
+    snprintf(out_path, sizeof(out_path), "/tmp/ph_test_%d.phs", (int)getpid()); 
+    snprintf(spill_path, sizeof(spill_path), "%s.spill0", out_path); 
+
+    char **keys = malloc(probes * sizeof(char *)); 
+    for(int i = 0; i < probes; i++) { 
+        keys[i] = malloc(max_str_len); 
+        if(i % 2) snprintf(keys[i], max_str_len, "ext%d", i); 
+        else snprintf(keys[i], max_str_len, "a_long_external_key_%d", i); 
+    }
+
+    // every 10th key twice, plus blank lines, which are skipped
+    FILE *f = fopen(keys_path, "w"); 
+    for(int i = 0; i < n; i++) { 
+        fprintf(f, "%s\n", keys[i]); 
+        if(i % 10 == 0) fprintf(f, "%s\r\n\n", keys[i]); 
+    }
+    fclose(f); 
+
+    // a small budget forces a second level of partitions
+    ph_external_opts_t opts = { .memory_budget = 32 << 10, .hash_type = PH_FKS_QUADRATIC }; 
+    ph_external_stats_t stats; 
+    assert(ph_build_external_file(keys_path, out_path, &opts, &stats) == 0); 
+    assert(stats.keys_read == (size_t)n + n / 10 && stats.duplicates == (size_t)n / 10); 
+    assert(stats.depth == 2 * PH_EXTERNAL_FANOUT_BITS && stats.num_shards > (1 << PH_EXTERNAL_FANOUT_BITS)); 
+    assert(access(spill_path, F_OK) != 0); 
+
+    ph_sharded_table *st = ph_open_sharded(out_path); 
+    assert(st && st->n == (size_t)n && st->num_shards == stats.num_shards); 
+    for(int i = 0; i < probes; i++) assert(ph_sharded_lookup(st, keys[i]) == (i < n ? 0 : -1)); 
+    assert(ph_sharded_lookup(st, "") == -1); 
+    ph_sharded_free(st); 
+
+    // from an iterator, every hash type, default budget: one level of shards
+    for(int hash_type = 0; hash_type <= 2; hash_type++) { 
+        key_array_iter_t it = { keys, n, 0 }; 
+        ph_external_opts_t iter_opts = { .hash_type = hash_type, .fingerprint_bits = 8 }; 
+        assert(ph_build_external(next_array_key, &it, out_path, &iter_opts, &stats) == 0); 
+        assert(stats.depth == PH_EXTERNAL_FANOUT_BITS && stats.duplicates == 0 && !stats.failed); 
+
+        st = ph_open_sharded(out_path); 
+        assert(st && st->n == (size_t)n); 
+        for(int i = 0; i < probes; i++) assert(ph_sharded_lookup(st, keys[i]) == (i < n ? 0 : -1)); 
+        ph_sharded_free(st); 
+    }
+
+    // garbage and a plain table file are refused
+    assert(truncate(out_path, 100) == 0); 
+    assert(ph_open_sharded(out_path) == NULL); 
+    ph_table *t = ph_build(keys, 100, max_str_len, 0, NULL); 
+    assert(ph_save(t, out_path) == 0); 
+    assert(ph_open_sharded(out_path) == NULL); 
+    ph_free(t); 
+    assert(ph_build_external_file("/nonexistent/keys", out_path, NULL, NULL) == -1); 
+
+    remove(keys_path); 
+    remove(out_path); 
+    for(int i = 0; i < probes; i++) free(keys[i]); 
+    free(keys); 
+
+    printf("External build Passed!\n\n");
+}
+
+void test_dynamic_updates() { 
+    printf("Running dynamic insert / delete test... \n"); 
+
+    int n = 1000; 
+    int total = 8 * n; 
+    int max_str_len = 40; 
+
+    char **keys = malloc(total * sizeof(char *)); 
+    for(int i = 0; i < total; i++) { 
+        keys[i] = malloc(max_str_len); 
+        snprintf(keys[i], max_str_len, "dyn_key_%d", i); 
+    }
+    char *present = malloc(total); 
+
+    for(int hash_type = 0; hash_type <= 1; hash_type++) { 
+        for(int fp_bits = 0; fp_bits <= 16; fp_bits += 16) { 
+            ph_build_opts_t opts = { .fingerprint_bits = fp_bits }; 
+            ph_table *t = ph_build_opts(keys, n, hash_type, &opts, NULL); 
+            assert(t); 
+            memset(present, 0, total); 
+            memset(present, 1, n); 
+
+            // grow through several global rebuilds, deleting along the way
+            for(int i = n; i < total; i++) { 
+                assert(ph_insert(t, keys[i]) == 0); 
+                present[i] = 1; 
+                if(i % 3 == 0) { 
+                    assert(ph_delete(t, keys[i - n]) == 0); 
+                    present[i - n] = 0; 
+                }
+            }
+            assert(ph_insert(t, keys[total - 1]) == 1); 
+
+            size_t live = 0; 
+            for(int i = 0; i < total; i++) { 
+                assert(ph_lookup(t, keys[i]) == (present[i] ? 0 : -1)); 
+                live += present[i]; 
+            }
+            assert(t->n == live); 
+
+            // shrink far enough to trigger a rebuild downwards
+            for(int i = 0; i < total; i++) { 
+                if(present[i] && i % 10 != 0) { 
+                    assert(ph_delete(t, keys[i]) == 0); 
+                    present[i] = 0; 
+                }
+            }
+            assert(ph_delete(t, keys[1]) == -1); 
+            for(int i = 0; i < total; i++) assert(ph_lookup(t, keys[i]) == (present[i] ? 0 : -1)); 
+            ph_free(t); 
+        }
+    }
+
+    // an empty table grows from nothing
+    ph_table *empty = ph_build(NULL, 0, 0, 0, NULL); 
+    for(int i = 0; i < n; i++) assert(ph_insert(empty, keys[i]) == 0); 
+    for(int i = 0; i < 2 * n; i++) assert(ph_lookup(empty, keys[i]) == (i < n ? 0 : -1)); 
+    ph_free(empty); 
+
+    // tables that can't be updated in place say so
+    ph_table *hd = ph_build(keys, n, max_str_len, 2, NULL); 
+    assert(ph_insert(hd, keys[n]) == -1 && ph_delete(hd, keys[0]) == -1); 
+    ph_free(hd); 
+    ph_build_opts_t owned = { .own_keys = 1 }; 
+    ph_table *ot = ph_build_opts(keys, n, 0, &owned, NULL); 
+    assert(ph_insert(ot, keys[n]) == -1); 
+    ph_free(ot); 
+
+    free(present); 
+    for(int i = 0; i < total; i++) free(keys[i]); 
+    free(keys); 
+
+    printf("Dynamic insert / delete Passed!\n\n");
+}
+
+typedef struct { 
+    ph_handle *h; 
+    char **stable; 
+    int num_stable; 
+    size_t table_n; 
+    atomic_int *stop; 
+    long sections; 
+} swap_reader_t; 
+
+static void *swap_reader(void *arg) { 
+    swap_reader_t *r = arg; 
+    int id = ph_handle_register(r->h); 
+    assert(id >= 0); 
+
+    for(int i = 0; !atomic_load(r->stop); i++) { 
+        // the table must stay whole for the entire section, whatever the writer does
+        ph_table *t = ph_handle_enter(r->h, id); 
+        assert(t->n == r->table_n); 
+        for(int j = 0; j < 8; j++) assert(ph_lookup(t, r->stable[(i * 8 + j) % r->num_stable]) == 0); 
+        assert(t->n == r->table_n); 
+        ph_handle_exit(r->h, id); 
+
+        assert(ph_handle_lookup(r->h, id, r->stable[i % r->num_stable]) == 0); 
+        r->sections++; 
+    }
+
+    ph_handle_unregister(r->h, id); 
+    return NULL; 
+}
+
+void test_handle_swap() { 
+    printf("Running handle swap stress test... \n"); 
+
+    int num_stable = 2000; 
+    int per_gen = 500; 
+    int swaps = 60; 
+    int num_readers = 4; 
+    int max_str_len = 32; 
+
+    // every generation's table holds the stable keys plus keys of its own
+    int n = num_stable + per_gen; 
+    char **keys = malloc(n * sizeof(char *)); 
+    for(int i = 0; i < n; i++) keys[i] = malloc(max_str_len); 
+    for(int i = 0; i < num_stable; i++) snprintf(keys[i], max_str_len, "stable_%d", i); 
+    for(int i = 0; i < per_gen; i++) snprintf(keys[num_stable + i], max_str_len, "gen0_%d", i); 
+
+    ph_build_opts_t owned = { .own_keys = 1 }; 
+    ph_handle *h = ph_handle_create(ph_build_opts(keys, n, 0, &owned, NULL), num_readers); 
+    assert(h); 
+
+    atomic_int stop; 
+    atomic_init(&stop, 0); 
+    pthread_t threads[4]; 
+    swap_reader_t readers[4]; 
+    for(int r = 0; r < num_readers; r++) { 
+        readers[r] = (swap_reader_t){ h, keys, num_stable, (size_t)n, &stop, 0 }; 
+        assert(pthread_create(&threads[r], NULL, swap_reader, &readers[r]) == 0); 
+    }
+
+    // owned keys, so each generation's strings can be rewritten right after its build
+    for(int g = 1; g <= swaps; g++) { 
+        for(int i = 0; i < per_gen; i++) snprintf(keys[num_stable + i], max_str_len, "gen%d_%d", g, i); 
+        ph_table *fresh = ph_build_opts(keys, n, g % 3, &owned, NULL); 
+        assert(fresh); 
+        ph_handle_swap(h, fresh); 
+        assert(ph_lookup(atomic_load(&h->current), keys[num_stable]) == 0); 
+    }
+
+    atomic_store(&stop, 1); 
+    for(int r = 0; r < num_readers; r++) { 
+        pthread_join(threads[r], NULL); 
+        assert(readers[r].sections > 0); 
+    }
+
+    // every slot is free again and a full handle refuses new readers
+    ph_handle *tiny = ph_handle_create(NULL, 1); 
+    int only = ph_handle_register(tiny); 
+    assert(only == 0 && ph_handle_register(tiny) == -1); 
+    assert(ph_handle_lookup(tiny, only, "x") == -1); 
+    ph_handle_unregister(tiny, only); 
+    ph_handle_free(tiny); 
+    for(int r = 0; r < num_readers; r++) assert(ph_handle_register(h) == r); 
+
+    ph_handle_free(h); 
+    for(int i = 0; i < n; i++) free(keys[i]); 
+    free(keys); 
+
+    printf("Handle swap Passed!\n\n");
+}
+
+/** 
+ * @brief Whether a and b are the same table: same level 1 and the same key 
+ *        in every slot. 
+ */
+static int same_table(const ph_table *a, const ph_table *b) { 
+    if(a->level1_seed != b->level1_seed || a->m != b->m || a->num_slots != b->num_slots) return 0; 
+    if(a->hash_type == 2) { 
+        if(memcmp(a->pilots, b->pilots, a->m * sizeof(uint16_t)) != 0) return 0; 
+    } else if(memcmp(a->params, b->params, a->m * sizeof(ph_bucket_params_t)) != 0) { 
+        return 0; 
+    }
+    for(size_t s = 0; s < a->num_slots; s++) { 
+        if(a->slots[s].key != b->slots[s].key) return 0; 
+    }
+    return 1; 
+}
+
+/** 
+ * @brief A build is a function of its seed and keys: serial and parallel 
+ *        builds with one seed agree, t->seed replays a fresh-seeded build, 
+ *        and updates from the same table make the same choices. 
+ */
+void test_seeded_builds() { 
+    printf("Running seeded build test... \n"); 
+
+    int n = 4000; 
+    int max_str_len = 20; 
+
+    char **keys = malloc(n * sizeof(char *)); 
+    for(int i = 0; i < n; i++) { 
+        keys[i] = malloc(max_str_len); 
+        snprintf(keys[i], max_str_len, "skey_%d", i); 
+    }
+
+    for(int hash_type = 0; hash_type <= 2; hash_type++) { 
+        ph_build_opts_t opts = { .seed = 0x5eed0000u + hash_type }; 
+        ph_table *a = ph_build_opts(keys, n, hash_type, &opts, NULL); 
+        opts.num_threads = 4; 
+        ph_table *b = ph_build_opts(keys, n, hash_type, &opts, NULL); 
+        assert(a && b && a->seed == opts.seed); 
+        assert(same_table(a, b)); 
+
+        opts.seed++; 
+        ph_table *c = ph_build_opts(keys, n, hash_type, &opts, NULL); 
+        assert(c && !same_table(a, c)); 
+
+        ph_build_opts_t fresh = { 0 }; 
+        ph_table *d = ph_build_opts(keys, n, hash_type, &fresh, NULL); 
+        assert(d && d->seed != 0); 
+        ph_build_opts_t replay = { .seed = d->seed }; 
+        ph_table *e = ph_build_opts(keys, n, hash_type, &replay, NULL); 
+        assert(e && same_table(d, e)); 
+
+        if(hash_type != 2) { 
+            // colliding inserts rebuild buckets and, past 2n keys, the table 
+            char extra[32]; 
+            char **added = malloc(2 * n * sizeof(char *)); 
+            for(int i = 0; i < 2 * n; i++) { 
+                snprintf(extra, sizeof(extra), "skey_new_%d", i); 
+                added[i] = strdup(extra); 
+                assert(ph_insert(a, added[i]) == 0 && ph_insert(b, added[i]) == 0); 
+            }
+            assert(same_table(a, b)); 
+            for(int i = 0; i < 2 * n; i++) free(added[i]); 
+            free(added); 
+        }
+
+        ph_free(a); 
+        ph_free(b); 
+        ph_free(c); 
+        ph_free(d); 
+        ph_free(e); 
+    }
+
+    for(int i = 0; i < n; i++) free(keys[i]); 
+    free(keys); 
+
+    printf("Seeded Build Passed!\n\n"); 
+}
+
+/** 
+ * @brief The FKS build bounds: level 1 load, the bucket attempt cap with its 
+ *        looser fallback tables, the space budget, and duplicate keys or 
+ *        key hashes failing instead of retrying forever. 
+ */
+void test_build_bounds() { 
+    printf("Running build bounds test... \n"); 
+
+    int n = 4000; 
+    int max_str_len = 20; 
+
+    char **keys = malloc((n + 1) * sizeof(char *)); 
+    for(int i = 0; i < n; i++) { 
+        keys[i] = malloc(max_str_len); 
+        snprintf(keys[i], max_str_len, "bkey_%d", i); 
+    }
+
+    // large minimal buckets with a tiny cap: many buckets fall back 
+    for(int threads = 1; threads <= 4; threads += 3) { 
+        build_metrics_t metrics; 
+        ph_build_opts_t opts = { .num_threads = threads, .level1_load = 4, .max_bucket_attempts = 8, .seed = 42 }; 
+        ph_table *t = ph_build_opts(keys, n, 1, &opts, &metrics); 
+        assert(t != NULL && t->m == (size_t)n / 4); 
+        assert(metrics.loosened_buckets > 0 && t->num_slots > (size_t)n); 
+        for(int i = 0; i < n; i++) assert(ph_lookup(t, keys[i]) == 0); 
+        assert(ph_lookup(t, "bkey_-1") == -1); 
+        ph_free(t); 
+    }
+
+    // a never loosening cap keeps minimal tables minimal 
+    ph_build_opts_t strict = { .level1_load = 2, .max_bucket_attempts = -1 }; 
+    ph_table *minimal = ph_build_opts(keys, n, 1, &strict, NULL); 
+    assert(minimal && minimal->num_slots == (size_t)n); 
+    for(int i = 0; i < n; i++) assert(ph_lookup(minimal, keys[i]) == 0); 
+    ph_free(minimal); 
+
+    // space budget: met when feasible, the build fails when it isn't 
+    for(int hash_type = 0; hash_type <= 1; hash_type++) { 
+        double budget = hash_type ? 306 : 395; 
+        build_metrics_t metrics; 
+        ph_build_opts_t opts = { .bits_per_key = budget, .level1_load = 0.75 }; 
+        ph_table *t = ph_build_opts(keys, n, hash_type, &opts, &metrics); 
+        assert(t != NULL && metrics.level1_draws >= 1); 
+        double bits = 8.0 * (t->m * sizeof(ph_bucket_params_t) + t->num_slots * sizeof(ph_slot_t)) / n; 
+        assert(bits <= budget); 
+        for(int i = 0; i < n; i++) assert(ph_lookup(t, keys[i]) == 0); 
+        ph_free(t); 
+
+        opts.bits_per_key = 64; // not even the slots fit 
+        assert(ph_build_opts(keys, n, hash_type, &opts, NULL) == NULL); 
+    }
+
+    // duplicate keys, or distinct keys with one key hash, can never be 
+    // separated: every hash type fails on the first level 1 draw 
+    keys[n] = keys[0]; 
+    for(int hash_type = 0; hash_type <= 2; hash_type++) { 
+        build_metrics_t metrics; 
+        assert(ph_build_opts(keys, n + 1, hash_type, NULL, &metrics) == NULL); 
+        assert(metrics.level1_draws == 1); 
+
+        size_t lens[3] = { 6, 6, 6 }; 
+        uint64_t hashes[3] = { 1, 2, 1 }; 
+        char *distinct[3] = { keys[0], keys[1], keys[2] }; 
+        ph_build_opts_t opts = { 0 }; 
+        assert(build_hashed(distinct, lens, hashes, 3, hash_type, &opts, &metrics) == NULL); 
+        assert(metrics.level1_draws == 1); 
+    }
+
+    ph_build_opts_t bad = { .level1_load = -1 }; 
+    assert(ph_build_opts(keys, n, 0, &bad, NULL) == NULL); 
+
+    for(int i = 0; i < n; i++) free(keys[i]); 
+    free(keys); 
+
+    printf("Build Bounds Passed!\n\n"); 
+}
+
+/** 
+ * @brief The lookup ph_codegen generated from tests/codegen_keys.txt must 
+ *        agree with a runtime table over the same keys: every key maps to 
+ *        its line index, and near misses are rejected by both. 
+ */
+void test_codegen() { 
+    printf("Running code generator test... \n"); 
+
+    int n = CODEGEN_KEYS_NUM_KEYS; 
+    ph_table *t = ph_build((char **)codegen_keys_keys, n, 0, 0, NULL); 
+    assert(t != NULL); 
+
+    char probe[CODEGEN_KEYS_MAX_LEN + 2]; 
+    for(int i = 0; i < n; i++) { 
+        const char *key = codegen_keys_keys[i]; 
+        size_t len = strlen(key); 
+        assert(codegen_keys_lookup(key, len) == i); 
+        assert(ph_lookup(t, key) == 0); 
+
+        // a prefix, the key with its last byte changed and the key plus one 
+        // byte; some of them are keys too, and both sides must say so 
+        memcpy(probe, key, len); 
+        probe[len] = '\0'; 
+        probe[len - 1] ^= 0x20; 
+        assert((codegen_keys_lookup(probe, len) >= 0) == (ph_lookup(t, probe) == 0)); 
+        probe[len - 1] ^= 0x20; 
+        probe[len] = '_'; 
+        probe[len + 1] = '\0'; 
+        assert((codegen_keys_lookup(probe, len + 1) >= 0) == (ph_lookup(t, probe) == 0)); 
+        probe[len - 1] = '\0'; 
+        assert((codegen_keys_lookup(probe, len - 1) >= 0) == (ph_lookup(t, probe) == 0)); 
+    }
+
+    // no terminator needed: a key embedded in a longer buffer 
+    assert(codegen_keys_lookup("GETTER", 3) == 0); 
+    assert(codegen_keys_lookup("", 0) == -1 && ph_lookup(t, "") == -1); 
+    assert(codegen_keys_lookup("listen_address_and_then_some_more", 33) == -1); 
+
+    ph_free(t); 
+    printf("Code Generator Passed!\n\n"); 
+}
+
+/** 
+ * @brief ph_build_u64 over random, sequential and strided IDs (with 0 and 
+ *        UINT64_MAX): every key found, non-keys missed, duplicates 
+ *        rejected, and the same seed gives the same table. 
+ */
+void test_u64_keys() { 
+    printf("Running u64 key test... \n"); 
+
+    size_t n = 20000; 
+    uint64_t *keys = malloc(n * sizeof(uint64_t)); 
+    uint64_t salt = (uint64_t)rand(); 
+    for(int family = 0; family < 3; family++) { 
+        for(size_t i = 0; i < n; i++) { 
+            if(family == 0) keys[i] = ph_fmix64(i + salt); // distinct, fmix is a bijection 
+            else if(family == 1) keys[i] = 1000000 + 2 * i; 
+            else keys[i] = (uint64_t)i << 20; 
+            keys[i] &= ~(uint64_t)1; // even keys, odd probes miss 
+        }
+        keys[0] = 0; 
+        keys[1] = UINT64_MAX - 1; 
+
+        build_metrics_t metrics; 
+        ph_u64_table *t = ph_build_u64(keys, n, 7, &metrics); 
+        assert(t != NULL && t->n == n); 
+        assert(metrics.total_attempts >= metrics.total_buckets_processed); 
+        for(size_t i = 0; i < n; i++) { 
+            assert(ph_lookup_u64(t, keys[i]) == 0); 
+            assert(t->slots[ph_u64_slot(t, keys[i])] == keys[i]); 
+            assert(ph_lookup_u64(t, keys[i] | 1) == -1); 
+        }
+
+        ph_u64_table *again = ph_build_u64(keys, n, 7, NULL); 
+        assert(again->level1_mult == t->level1_mult && again->num_slots == t->num_slots); 
+        assert(memcmp(again->slots, t->slots, t->num_slots * sizeof(uint64_t)) == 0); 
+        ph_free_u64(again); 
+        ph_free_u64(t); 
+    }
+
+    keys[n / 2] = keys[3]; 
+    assert(ph_build_u64(keys, n, 0, NULL) == NULL); 
+
+    ph_u64_table *empty = ph_build_u64(keys, 0, 0, NULL); 
+    assert(empty != NULL && ph_lookup_u64(empty, 0) == -1); 
+    ph_free_u64(empty); 
+
+    free(keys); 
+    printf("U64 Keys Passed!\n\n"); 
+}
+
+/** 
+ * @brief Keys as byte strings: zero bytes inside keys, keys that differ only 
+ *        in length, and the empty key, through every build, the updates and 
+ *        a save / mmap round trip. 
+ */
+void test_binary_keys() { 
+    printf("Running binary keys test... \n"); 
+
+    int n = 3000; 
+    char **keys = malloc((n + 1) * sizeof(char *)); 
+    size_t *lens = malloc((n + 1) * sizeof(size_t)); 
+    for(int i = 0; i < n; i++) { 
+        uint32_t id = (uint32_t)(i / 2); 
+        keys[i] = calloc(1, 20); 
+        memcpy(keys[i], &id, sizeof(id)); 
+        lens[i] = (i % 2) ? 20 : 4; // the same id, zero padded: only the lengths differ 
+    }
+    keys[n] = calloc(1, 1); 
+    lens[n] = 0; 
+
+    char probe[20] = { 0 }; 
+    for(int hash_type = 0; hash_type <= 2; hash_type++) { 
+        for(int variant = 0; variant < 4; variant++) { 
+            ph_build_opts_t opts = { .own_keys = variant & 1, .fingerprint_bits = (variant & 2) ? 8 : 0, 
+                .num_threads = (variant & 2) ? 2 : 1 }; 
+            ph_table *t = ph_build_n(keys, lens, n + 1, hash_type, &opts, NULL); 
+            assert(t != NULL && t->n == (size_t)n + 1); 
+            for(int i = 0; i <= n; i++) assert(ph_lookup_n(t, keys[i], lens[i]) == 0); 
+            for(int i = 0; i < n; i += 2) { 
+                uint32_t id = (uint32_t)(i / 2); 
+                memcpy(probe, &id, sizeof(id)); 
+                assert(ph_lookup_n(t, probe, 12) == -1); // a length no key has 
+                id += n; 
+                memcpy(probe, &id, sizeof(id)); 
+                assert(ph_lookup_n(t, probe, 4) == -1); 
+            }
+            assert(ph_lookup(t, "") == 0); 
+            ph_free(t); 
+        }
+    }
+
+    // updates keep each key's length, across bucket and table rebuilds 
+    int extra = 2 * n; 
+    char **more = malloc(extra * sizeof(char *)); 
+    ph_table *t = ph_build_n(keys, lens, n, 0, NULL, NULL); 
+    assert(ph_insert_n(t, keys[n], 0) == 0 && ph_insert_n(t, keys[1], 20) == 1); 
+    assert(ph_delete_n(t, keys[0], 4) == 0 && ph_delete_n(t, keys[0], 4) == -1); 
+    for(int i = 0; i < extra; i++) { 
+        uint32_t id = (uint32_t)(n + i); 
+        more[i] = calloc(1, 8); 
+        memcpy(more[i], &id, sizeof(id)); 
+        assert(ph_insert_n(t, more[i], 8) == 0); 
+    }
+    assert(t->n == (size_t)n + extra); 
+    assert(ph_lookup_n(t, keys[0], 4) == -1 && ph_lookup_n(t, keys[n], 0) == 0); 
+    for(int i = 1; i < n; i++) assert(ph_lookup_n(t, keys[i], lens[i]) == 0); 
+    for(int i = 0; i < extra; i++) { 
+        assert(ph_lookup_n(t, more[i], 8) == 0 && ph_lookup_n(t, more[i], 4) == -1); 
+    }
+
+    // a saved table keeps the lengths too 
+    char path[64]; 
+    snprintf(path, sizeof(path), "/tmp/ph_binary_%d.phm", (int)getpid()); 
+    assert(ph_save(t, path) == 0); 
+    ph_table *mapped = ph_open_mmap(path); 
+    assert(mapped != NULL); 
+    for(int i = 1; i <= n; i++) assert(ph_lookup_n(mapped, keys[i], lens[i]) == 0); 
+    for(int i = 0; i < extra; i++) assert(ph_lookup_n(mapped, more[i], 8) == 0); 
+    assert(ph_lookup_n(mapped, keys[0], 4) == -1); 
+    ph_free(mapped); 
+    unlink(path); 
+    ph_free(t); 
+
+    for(int i = 0; i < extra; i++) free(more[i]); 
+    for(int i = 0; i <= n; i++) free(keys[i]); 
+    free(more); 
+    free(keys); 
+    free(lens); 
+    printf("Binary Keys Passed!\n\n"); 
+}
+
+typedef struct { 
+    int events[64]; // phase * 2 + begin, in call order 
+    int count; 
+} phase_log_t; 
+
+static void log_phase(int phase, int begin, void *ctx) { 
+    phase_log_t *log = ctx; 
+    if(log->count < 64) log->events[log->count] = phase * 2 + begin; 
+    log->count++; 
+}
+
+void test_phase_hook() { 
+    printf("Running phase hook test... \n"); 
+
+    int n = 5000; 
+    char **keys = malloc(n * sizeof(char *)); 
+    for(int i = 0; i < n; i++) { 
+        keys[i] = malloc(16); 
+        snprintf(keys[i], 16, "phase_%d", i); 
+    }
+
+    for(int hash_type = 0; hash_type <= 2; hash_type++) { 
+        for(int threads = 1; threads <= 2; threads++) { 
+            phase_log_t log = { 0 }; 
+            ph_build_opts_t opts = { .num_threads = threads, .own_keys = 1, .phase_hook = log_phase, .phase_ctx = &log }; 
+            ph_table *t = ph_build_opts(keys, n, hash_type, &opts, NULL); 
+            assert(t != NULL && log.count <= 64 && log.count % 2 == 0); 
+
+            // each phase begins and ends before the next, hashing first and finishing last 
+            assert(log.events[0] == PH_PHASE_HASH * 2 + 1); 
+            assert(log.events[log.count - 1] == PH_PHASE_FINISH * 2); 
+            for(int i = 0; i < log.count; i += 2) { 
+                assert(log.events[i] % 2 == 1 && log.events[i + 1] == log.events[i] - 1); 
+            }
+            int seen[PH_NUM_PHASES] = { 0 }; 
+            for(int i = 0; i < log.count; i += 2) seen[log.events[i] / 2]++; 
+            assert(seen[PH_PHASE_HASH] == 1 && seen[PH_PHASE_FINISH] == 1); 
+            assert(seen[PH_PHASE_LEVEL1] >= 1 && seen[PH_PHASE_LEVEL2] >= 1); 
+            ph_free(t); 
+        }
+    }
+
+    for(int i = 0; i < n; i++) free(keys[i]); 
+    free(keys); 
+    printf("Phase Hook Passed!\n\n"); 
+}
+
+typedef struct { 
+    int allocs; 
+    int frees; 
+    size_t live_bytes; 
+    int fail; // refuse every allocation 
+    int refused; 
+} counting_alloc_t; 
+
+static void *counting_alloc(size_t bytes, void *ctx) { 
+    counting_alloc_t *c = ctx; 
+    void *p = NULL; 
+    if(c->fail) { 
+        c->refused++; 
+        return NULL; 
+    }
+    if(posix_memalign(&p, 64, bytes) != 0) return NULL; 
+    c->allocs++; 
+    c->live_bytes += bytes; 
+    return p; 
+}
+
+static void counting_free(void *p, size_t bytes, void *ctx) { 
+    counting_alloc_t *c = ctx; 
+    c->frees++; 
+    c->live_bytes -= bytes; 
+    free(p); 
+}
+
+void test_allocator() { 
+    printf("Running allocator test... \n"); 
+
+    int n = 4000; 
+    char **keys = malloc(n * sizeof(char *)); 
+    for(int i = 0; i < n; i++) { 
+        keys[i] = malloc(24); 
+        snprintf(keys[i], 24, "allocated_key_%d", i); 
+    }
+
+    // every finished table's storage comes from the allocator and goes back to it 
+    counting_alloc_t counts = { 0 }; 
+    ph_allocator_t counting = { counting_alloc, counting_free, &counts }; 
+    for(int hash_type = 0; hash_type <= 2; hash_type++) { 
+        for(int variant = 0; variant < 4; variant++) { 
+            ph_build_opts_t opts = { .own_keys = variant & 1, .fingerprint_bits = (variant & 2) ? 16 : 0, 
+                .allocator = &counting }; 
+            ph_table *t = ph_build_opts(keys, n, hash_type, &opts, NULL); 
+            assert(t != NULL && counts.live_bytes == t->mem_bytes); 
+            for(int i = 0; i < n; i++) assert(ph_lookup(t, keys[i]) == 0); 
+            assert(ph_lookup(t, "allocated_key_x") == -1); 
+            ph_free(t); 
+            assert(counts.live_bytes == 0 && counts.allocs == counts.frees); 
+        }
+    }
+
+    // an updated table keeps its storage in the allocator, and a global 
+    // rebuild (at twice the keys it was built with) keeps its settings 
+    ph_build_opts_t updated = { .allocator = &counting, .level1_load = 2 }; 
+    ph_table *t = ph_build_opts(keys, n / 4, 0, &updated, NULL); 
+    for(int i = n / 4; i < n; i++) assert(ph_insert(t, keys[i]) == 0); 
+    assert(counts.live_bytes > 0 && t->allocator.ctx == &counts); 
+    assert(t->level1_load == 2 && t->m < (size_t)n / 2); 
+    for(int i = 0; i < n; i++) assert(ph_lookup(t, keys[i]) == 0); 
+    ph_free(t); 
+    assert(counts.live_bytes == 0 && counts.allocs == counts.frees); 
+
+    // a global rebuild that fails is put off rather than retried by every 
+    // update: deleting every key while the allocator refuses tries it twice 
+    t = ph_build_opts(keys, n, 0, &updated, NULL); 
+    assert(ph_delete(t, keys[0]) == 0); // thaws t 
+    counts.fail = 1; 
+    for(int i = 1; i < n; i++) assert(ph_delete(t, keys[i]) == 0); 
+    assert(counts.refused == 2 && t->n == 0); 
+    counts.fail = 0; 
+    for(int i = 0; i < n; i++) assert(ph_insert(t, keys[i]) == 0); 
+    for(int i = 0; i < n; i++) assert(ph_lookup(t, keys[i]) == 0); 
+    ph_free(t); 
+    assert(counts.live_bytes == 0 && counts.allocs == counts.frees); 
+
+    // arenas: the tables land inside their regions, whatever backing the system gives 
+    for(int backing = PH_ARENA_PAGES; backing <= PH_ARENA_HUGETLB; backing++) { 
+        ph_arena_t *arena = ph_arena_create(backing, 0); 
+        assert(arena != NULL); 
+        ph_allocator_t alloc = ph_arena_allocator(arena); 
+        ph_table *tables[3]; 
+        for(int hash_type = 0; hash_type <= 2; hash_type++) { 
+            ph_build_opts_t opts = { .own_keys = 1, .allocator = &alloc }; 
+            tables[hash_type] = ph_build_opts(keys, n, hash_type, &opts, NULL); 
+            assert(tables[hash_type] != NULL); 
+            assert((uintptr_t)tables[hash_type]->mem % 64 == 0); 
+        }
+        assert(arena->regions != NULL && arena->reserved % PH_ARENA_HUGE_PAGE == 0); 
+        for(int hash_type = 0; hash_type <= 2; hash_type++) { 
+            int inside = 0; 
+            for(ph_arena_region_t *r = arena->regions; r; r = r->next) { 
+                char *mem = tables[hash_type]->mem; 
+                inside |= mem >= r->base && mem + tables[hash_type]->mem_bytes <= r->base + r->used; 
+            }
+            assert(inside); 
+            for(int i = 0; i < n; i++) assert(ph_lookup(tables[hash_type], keys[i]) == 0); 
+        }
+        // freeing the newest allocation hands its bytes back 
+        size_t used = arena->regions->used; 
+        ph_free(tables[2]); 
+        assert(arena->regions->used < used); 
+        ph_free(tables[1]); 
+        ph_free(tables[0]); 
+        ph_arena_destroy(arena); 
+    }
+    assert(ph_arena_create(7, 0) == NULL); 
+
+    for(int i = 0; i < n; i++) free(keys[i]); 
+    free(keys); 
+    printf("Allocator Passed!\n\n"); 
+}
+
 int main()  { 
     srand(time(NULL));
     
@@ -163,6 +1368,24 @@ int main()  {
     test_collision_free();
     stress_test();
     test_edge_cases();
+    test_long_keys();
+    test_parallel_build();
+    test_lookup_batch();
+    test_hash_kernels();
+    test_map();
+    test_fingerprints();
+    test_owned_keys();
+    test_save_mmap();
+    test_external_build();
+    test_dynamic_updates();
+    test_handle_swap();
+    test_seeded_builds();
+    test_build_bounds();
+    test_codegen();
+    test_u64_keys();
+    test_binary_keys();
+    test_phase_hook();
+    test_allocator();
     
     printf("=================================\n");
     printf("All Tests Passed!\n");
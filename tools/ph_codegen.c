@@ -0,0 +1,428 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "../src/ph.h"
+#include "../src/hash.h"
+#include "../src/ph_internal.h"
+
+/**
+ * Offline generator for key sets that are fixed at compile time. It reads a
+ * key list (one key per line), builds a PH_HASH_DISPLACE table over it and
+ * writes <name>.h and <name>.c: static const tables and a lookup that needs
+ * no library, no heap and no startup work.
+ *
+ *      ph_codegen keys.txt out_dir name [seed]
+ *
+ * The generated lookup returns the key's line index (blank lines skipped),
+ * or -1. Against ph_lookup() it saves:
+ *      - the key hash: a word-at-a-time hash (below) instead of the
+ *        polynomial kernels, rejected up front when the length is outside
+ *        the key set's range, and unrolled to a constant when every key has
+ *        the same length
+ *      - every table field: m, pilot_range, the level 1 seed and the bucket
+ *        split are constants in the code
+ *      - the pilot hash: the tables store each bucket's ph_pilot_hash()
+ *        rather than its pilot, so the lookup runs one finaliser, not two
+ *      - strlen() and the pointer chase: key lengths are stored by index
+ *        and compared before the key bytes
+ *      - library calls: the last partial word is read with fixed size
+ *        loads and keys are compared a word at a time, with no variable
+ *        length memcpy() or memcmp()
+ * The output depends only on the key list and the seed.
+ */
+
+#define CODEGEN_DEFAULT_SEED 0x70685f636f646567ull // "ph_codeg"
+#define CODEGEN_HASH_TRIES 64 // hash seeds tried before giving up on the key set
+#define WORD_MUL 0x9e3779b97f4a7c15ull
+#define LEN_MUL 0xc2b2ae3d27d4eb4full
+
+/**
+ * @brief The last rem (1 to 7) bytes of a key as a zero padded little endian
+ *        word, from two overlapping fixed size loads (or three byte loads)
+ *        rather than a memcpy() of variable size, which is a library call.
+ *        emit_source() prints this same function.
+ */
+static inline uint64_t load_tail(const unsigned char *s, size_t rem) {
+    if(rem >= 4) {
+        uint32_t lo, hi;
+        memcpy(&lo, s, 4);
+        memcpy(&hi, s + rem - 4, 4);
+        return lo | (uint64_t)hi << (8 * (rem - 4));
+    }
+    return s[0] | (uint64_t)s[rem / 2] << (8 * (rem / 2)) | (uint64_t)s[rem - 1] << (8 * (rem - 1));
+}
+
+/**
+ * @brief The generated code's key hash. Each 8-byte word (the last one zero
+ *        padded) goes through h = (h ^ w) * WORD_MUL, h ^= h >> 32, a
+ *        bijection of h ^ w. That only keeps keys of at most 8 bytes and
+ *        equal length apart; longer keys, or keys of different lengths, can
+ *        share a hash, which is rare and costs a new seed (hash_keys()
+ *        tries CODEGEN_HASH_TRIES). emit_source() prints this same function,
+ *        the tests check the two agree.
+ */
+static uint64_t word_hash(const unsigned char *s, size_t len, uint64_t seed) {
+    uint64_t h = seed ^ ((uint64_t)len * LEN_MUL);
+    size_t i = 0;
+    for(; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, s + i, 8);
+        h = (h ^ w) * WORD_MUL;
+        h ^= h >> 32;
+    }
+    if(i < len) {
+        h = (h ^ load_tail(s + i, len - i)) * WORD_MUL;
+        h ^= h >> 32;
+    }
+    return ph_fmix64(h);
+}
+
+typedef struct {
+    char **keys;
+    size_t *lens;
+    size_t n;
+    char *text; // backs keys
+} key_list_t;
+
+/**
+ * @brief Reads one key per line ('\n' or "\r\n"), skipping blank lines.
+ *
+ * @return 0 on success, -1 if the file can't be read
+ */
+static int read_keys(const char *path, key_list_t *list) {
+    FILE *f = fopen(path, "rb");
+    if(!f) return -1;
+
+    size_t cap = 4096, bytes = 0, got;
+    char *text = malloc(cap + 1);
+    while(text && (got = fread(text + bytes, 1, cap - bytes, f)) > 0) {
+        bytes += got;
+        if(bytes < cap) continue;
+        char *grown = realloc(text, 2 * cap + 1);
+        if(!grown) free(text);
+        text = grown;
+        cap *= 2;
+    }
+    int failed = ferror(f);
+    fclose(f);
+    if(!text || failed) {
+        free(text);
+        return -1;
+    }
+    text[bytes] = '\n';
+
+    size_t lines = 0;
+    for(size_t i = 0; i <= bytes; i++) lines += (text[i] == '\n');
+    list->keys = malloc(sizeof(char *) * lines);
+    list->lens = malloc(sizeof(size_t) * lines);
+    if(!list->keys || !list->lens) {
+        free(text);
+        free(list->keys);
+        free(list->lens);
+        return -1;
+    }
+
+    list->n = 0;
+    list->text = text;
+    for(size_t at = 0; at <= bytes;) {
+        char *line = text + at;
+        size_t len = strcspn(line, "\n"); // stops at the sentinel at the latest
+        at += len + 1;
+        line[len] = '\0';
+        if(len && line[len - 1] == '\r') line[--len] = '\0';
+        if(!len) continue;
+        list->keys[list->n] = line;
+        list->lens[list->n++] = len;
+    }
+    return 0;
+}
+
+typedef struct {
+    uint64_t hash;
+    size_t index;
+} hashed_key_t;
+
+static int compare_hashed(const void *a, const void *b) {
+    uint64_t x = ((const hashed_key_t *)a)->hash, y = ((const hashed_key_t *)b)->hash;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Finds a seed under which every key's word_hash() is distinct and
+ *        fills hashes.
+ *
+ * @return The seed's try (0 for seed itself), -1 on a duplicate key (named
+ *         in *dup), -2 if no seed worked or on allocation failure
+ */
+static int hash_keys(const key_list_t *list, uint64_t seed, uint64_t *hashes, uint64_t *hash_seed,
+    size_t *dup) {
+
+    hashed_key_t *sorted = malloc(sizeof(hashed_key_t) * list->n);
+    if(!sorted) return -2;
+
+    int rc = -2;
+    for(int attempt = 0; attempt < CODEGEN_HASH_TRIES; attempt++) {
+        *hash_seed = ph_fmix64(seed + (uint64_t)attempt * WORD_MUL);
+        for(size_t i = 0; i < list->n; i++) {
+            hashes[i] = word_hash((const unsigned char *)list->keys[i], list->lens[i], *hash_seed);
+            sorted[i] = (hashed_key_t){ hashes[i], i };
+        }
+        qsort(sorted, list->n, sizeof(hashed_key_t), compare_hashed);
+
+        int collided = 0;
+        for(size_t i = 1; i < list->n && rc == -2; i++) {
+            if(sorted[i].hash != sorted[i - 1].hash) continue;
+            size_t a = sorted[i - 1].index, b = sorted[i].index;
+            if(list->lens[a] == list->lens[b] && memcmp(list->keys[a], list->keys[b], list->lens[a]) == 0) {
+                *dup = (a > b) ? a : b;
+                rc = -1;
+            }
+            collided = 1;
+        }
+        if(rc == -1) break;
+        if(!collided) {
+            rc = attempt;
+            break;
+        }
+    }
+    free(sorted);
+    return rc;
+}
+
+/**
+ * @brief Smallest unsigned type that holds max.
+ */
+static const char *index_type(uint64_t max) {
+    if(max <= UINT8_MAX) return "uint8_t";
+    if(max <= UINT16_MAX) return "uint16_t";
+    return "uint32_t";
+}
+
+/**
+ * @brief Writes key as a C string literal. Bytes outside printable ASCII,
+ *        quotes, backslashes and '?' (trigraphs) become 3-digit octal
+ *        escapes, which can't run into the next character.
+ */
+static void emit_string(FILE *f, const char *key, size_t len) {
+    fputc('"', f);
+    for(size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)key[i];
+        if(isprint(c) && c != '"' && c != '\\' && c != '?') fputc(c, f);
+        else fprintf(f, "\\%03o", c);
+    }
+    fputc('"', f);
+}
+
+static void emit_header(FILE *f, const char *name, const char *upper, const key_list_t *list,
+    size_t min_len, size_t max_len) {
+
+    fprintf(f, "/* Generated by ph_codegen, do not edit. */\n");
+    fprintf(f, "#ifndef %s_H\n#define %s_H\n\n", upper, upper);
+    fprintf(f, "#include <stddef.h>\n\n");
+    fprintf(f, "#define %s_NUM_KEYS %zu\n", upper, list->n);
+    fprintf(f, "#define %s_MIN_LEN %zu\n", upper, min_len);
+    fprintf(f, "#define %s_MAX_LEN %zu\n\n", upper, max_len);
+    fprintf(f, "/**\n * @brief Index of key (len bytes, no terminator needed) in the key list,\n");
+    fprintf(f, " *        or -1 if it isn't one of the keys.\n */\n");
+    fprintf(f, "int %s_lookup(const char *key, size_t len);\n\n", name);
+    fprintf(f, "/* The keys by index, NUL terminated */\n");
+    fprintf(f, "extern const char *const %s_keys[%s_NUM_KEYS];\n\n", name, upper);
+    fprintf(f, "#endif\n");
+}
+
+static void emit_source(FILE *f, const char *name, const char *upper, const key_list_t *list,
+    const ph_table *t, const uint32_t *slot_key, uint64_t hash_seed) {
+
+    size_t n = t->n, m = t->m, remap_len = t->pilot_range - n;
+    size_t max_len = 0;
+    for(size_t i = 0; i < n; i++) if(list->lens[i] > max_len) max_len = list->lens[i];
+
+    fprintf(f, "/* Generated by ph_codegen, do not edit. */\n");
+    fprintf(f, "#include <stdint.h>\n#include <string.h>\n\n#include \"%s.h\"\n\n", name);
+    fprintf(f, "#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__\n");
+    fprintf(f, "#error \"%s.c was generated for a little endian target\"\n#endif\n\n", name);
+
+    fprintf(f, "const char *const %s_keys[%s_NUM_KEYS] = {\n", name, upper);
+    for(size_t i = 0; i < n; i++) {
+        fprintf(f, "    ");
+        emit_string(f, list->keys[i], list->lens[i]);
+        fprintf(f, ",\n");
+    }
+    fprintf(f, "};\n\n");
+
+    fprintf(f, "static const %s %s_lens[%s_NUM_KEYS] = {", index_type(max_len), name, upper);
+    for(size_t i = 0; i < n; i++) fprintf(f, "%s%zu,", (i % 16) ? " " : "\n    ", list->lens[i]);
+    fprintf(f, "\n};\n\n");
+
+    fprintf(f, "/* key index of every slot */\n");
+    fprintf(f, "static const %s %s_slot_key[%s_NUM_KEYS] = {", index_type(n - 1), name, upper);
+    for(size_t s = 0; s < n; s++) fprintf(f, "%s%u,", (s % 16) ? " " : "\n    ", slot_key[s]);
+    fprintf(f, "\n};\n\n");
+
+    fprintf(f, "/* ph_pilot_hash() of every bucket's pilot */\n");
+    fprintf(f, "static const uint64_t %s_pilot_hash[%zu] = {", name, m);
+    for(size_t b = 0; b < m; b++) {
+        fprintf(f, "%s0x%016llxull,", (b % 4) ? " " : "\n    ",
+            (unsigned long long)ph_pilot_hash(t->pilots[b], t->level1_seed));
+    }
+    fprintf(f, "\n};\n\n");
+
+    if(remap_len) {
+        fprintf(f, "/* slot of each position past %zu */\n", n);
+        fprintf(f, "static const %s %s_remap[%zu] = {", index_type(n - 1), name, remap_len);
+        for(size_t i = 0; i < remap_len; i++) fprintf(f, "%s%u,", (i % 16) ? " " : "\n    ", t->remap[i]);
+        fprintf(f, "\n};\n\n");
+    }
+
+    // must stay load_tail() and word_hash()
+    fprintf(f, "static inline uint64_t %s_tail(const unsigned char *s, size_t rem) {\n", name);
+    fprintf(f, "    if(rem >= 4) {\n        uint32_t lo, hi;\n        memcpy(&lo, s, 4);\n");
+    fprintf(f, "        memcpy(&hi, s + rem - 4, 4);\n        return lo | (uint64_t)hi << (8 * (rem - 4));\n    }\n");
+    fprintf(f, "    return s[0] | (uint64_t)s[rem / 2] << (8 * (rem / 2)) | (uint64_t)s[rem - 1] << (8 * (rem - 1));\n}\n\n");
+
+    fprintf(f, "static inline uint64_t %s_hash(const unsigned char *s, size_t len) {\n", name);
+    fprintf(f, "    uint64_t h = 0x%016llxull ^ ((uint64_t)len * 0x%016llxull);\n",
+        (unsigned long long)hash_seed, (unsigned long long)LEN_MUL);
+    fprintf(f, "    size_t i = 0;\n");
+    fprintf(f, "    for(; i + 8 <= len; i += 8) {\n");
+    fprintf(f, "        uint64_t w;\n        memcpy(&w, s + i, 8);\n");
+    fprintf(f, "        h = (h ^ w) * 0x%016llxull;\n        h ^= h >> 32;\n    }\n", (unsigned long long)WORD_MUL);
+    fprintf(f, "    if(i < len) {\n        h = (h ^ %s_tail(s + i, len - i)) * 0x%016llxull;\n", name,
+        (unsigned long long)WORD_MUL);
+    fprintf(f, "        h ^= h >> 32;\n    }\n");
+    fprintf(f, "    h ^= h >> 33;\n    h *= 0xff51afd7ed558ccdull;\n    h ^= h >> 33;\n");
+    fprintf(f, "    h *= 0xc4ceb9fe1a85ec53ull;\n    h ^= h >> 33;\n    return h;\n}\n\n");
+
+    // memcmp() of a variable length is a call too
+    fprintf(f, "static inline int %s_equals(const unsigned char *a, const unsigned char *b, size_t len) {\n", name);
+    fprintf(f, "    uint64_t diff = 0;\n    size_t i = 0;\n");
+    fprintf(f, "    for(; i + 8 <= len; i += 8) {\n        uint64_t x, y;\n");
+    fprintf(f, "        memcpy(&x, a + i, 8);\n        memcpy(&y, b + i, 8);\n        diff |= x ^ y;\n    }\n");
+    fprintf(f, "    if(i < len) diff |= %s_tail(a + i, len - i) ^ %s_tail(b + i, len - i);\n", name, name);
+    fprintf(f, "    return diff == 0;\n}\n\n");
+
+    // ph_skew_bucket() with the seed and bucket split folded in
+    unsigned int dense = (unsigned int)(m * 3 / 10) + 1;
+    fprintf(f, "int %s_lookup(const char *key, size_t len) {\n", name);
+    fprintf(f, "    if(len < %s_MIN_LEN || len > %s_MAX_LEN) return -1;\n", upper, upper);
+    fprintf(f, "    uint64_t h = %s_hash((const unsigned char *)key, (%s_MIN_LEN == %s_MAX_LEN) ? %s_MAX_LEN : len);\n\n",
+        name, upper, upper, upper);
+    fprintf(f, "    uint64_t x = h ^ 0x%016llxull;\n",
+        (unsigned long long)((uint64_t)t->level1_seed * 0x9e3779b97f4a7c15ull));
+    fprintf(f, "    x ^= x >> 33;\n    x *= 0xff51afd7ed558ccdull;\n    x ^= x >> 33;\n");
+    fprintf(f, "    x *= 0xc4ceb9fe1a85ec53ull;\n    x ^= x >> 33;\n");
+    if(dense >= m) {
+        fprintf(f, "    size_t b = (size_t)(((uint64_t)(uint32_t)x * %zuu) >> 32);\n\n", m);
+    } else {
+        fprintf(f, "    size_t b = ((uint32_t)(x >> 32) < 2576980378u)\n");
+        fprintf(f, "        ? (size_t)(((uint64_t)(uint32_t)x * %uu) >> 32)\n", dense);
+        fprintf(f, "        : %uu + (size_t)(((uint64_t)(uint32_t)x * %zuu) >> 32);\n\n", dense, m - dense);
+    }
+    fprintf(f, "    uint64_t d = (h ^ %s_pilot_hash[b]) * 0x9e3779b97f4a7c15ull;\n", name);
+    fprintf(f, "    size_t slot = (size_t)(((unsigned __int128)d * %zuu) >> 64);\n", t->pilot_range);
+    if(remap_len) fprintf(f, "    if(slot >= %s_NUM_KEYS) slot = %s_remap[slot - %s_NUM_KEYS];\n", upper, name, upper);
+    fprintf(f, "\n    size_t i = %s_slot_key[slot];\n", name);
+    fprintf(f, "    if(%s_lens[i] != len) return -1;\n", name);
+    fprintf(f, "    if(!%s_equals((const unsigned char *)%s_keys[i], (const unsigned char *)key, len)) return -1;\n",
+        name, name);
+    fprintf(f, "    return (int)i;\n}\n");
+}
+
+/**
+ * @brief Opens dir/name + suffix for writing.
+ */
+static FILE *open_output(const char *dir, const char *name, const char *suffix) {
+    size_t bytes = strlen(dir) + strlen(name) + strlen(suffix) + 2;
+    char *path = malloc(bytes);
+    if(!path) return NULL;
+    snprintf(path, bytes, "%s/%s%s", dir, name, suffix);
+    FILE *f = fopen(path, "w");
+    if(!f) fprintf(stderr, "ph_codegen: can't write %s\n", path);
+    free(path);
+    return f;
+}
+
+static int valid_name(const char *name) {
+    if(!isalpha((unsigned char)name[0]) && name[0] != '_') return 0;
+    for(const char *c = name; *c; c++) {
+        if(!isalnum((unsigned char)*c) && *c != '_') return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    if(argc < 4 || argc > 5 || !valid_name(argv[3])) {
+        fprintf(stderr, "Usage: %s keys_file out_dir name [seed]\n", argv[0]);
+        fprintf(stderr, "Writes out_dir/name.h and out_dir/name.c; name must be a C identifier.\n");
+        return 2;
+    }
+    const char *name = argv[3];
+    uint64_t seed = (argc == 5) ? strtoull(argv[4], NULL, 0) : CODEGEN_DEFAULT_SEED;
+
+    key_list_t list = { 0 };
+    if(read_keys(argv[1], &list) != 0) {
+        fprintf(stderr, "ph_codegen: can't read %s\n", argv[1]);
+        return 1;
+    }
+    if(list.n == 0 || list.n > INT32_MAX) {
+        fprintf(stderr, "ph_codegen: %s has %zu keys\n", argv[1], list.n);
+        return 1;
+    }
+
+    size_t min_len = list.lens[0], max_len = list.lens[0];
+    for(size_t i = 1; i < list.n; i++) {
+        if(list.lens[i] < min_len) min_len = list.lens[i];
+        if(list.lens[i] > max_len) max_len = list.lens[i];
+    }
+
+    uint64_t *hashes = malloc(sizeof(uint64_t) * list.n);
+    uint64_t hash_seed = 0;
+    size_t dup = 0;
+    int found = hashes ? hash_keys(&list, seed, hashes, &hash_seed, &dup) : -2;
+    if(found == -1) {
+        fprintf(stderr, "ph_codegen: duplicate key on line %zu: %s\n", dup + 1, list.keys[dup]);
+        return 1;
+    }
+    if(found < 0) {
+        fprintf(stderr, "ph_codegen: no distinct hashes after %d seeds\n", CODEGEN_HASH_TRIES);
+        return 1;
+    }
+
+    // the table's slots point at list.keys, which turn back into indices below
+    ph_build_opts_t opts = { .seed = seed };
+    ph_table *t = build_hashed(list.keys, list.lens, hashes, list.n, PH_HASH_DISPLACE, &opts, NULL);
+    uint32_t *slot_key = malloc(sizeof(uint32_t) * list.n);
+    if(!t || !slot_key) {
+        fprintf(stderr, "ph_codegen: build failed\n");
+        return 1;
+    }
+    for(size_t i = 0; i < list.n; i++) slot_key[slot_in_bucket(t, hashes[i], bucket_of(t, hashes[i]))] = (uint32_t)i;
+
+    char *upper = strdup(name);
+    for(char *c = upper; *c; c++) *c = (char)toupper((unsigned char)*c);
+
+    FILE *h = open_output(argv[2], name, ".h");
+    FILE *c = h ? open_output(argv[2], name, ".c") : NULL;
+    if(!c) return 1;
+    emit_header(h, name, upper, &list, min_len, max_len);
+    emit_source(c, name, upper, &list, t, slot_key, hash_seed);
+    int failed = ferror(h) | ferror(c);
+    failed |= fclose(h) | fclose(c);
+    if(failed) {
+        fprintf(stderr, "ph_codegen: write error\n");
+        return 1;
+    }
+
+    printf("ph_codegen: %zu keys (%zu-%zu bytes), %zu buckets -> %s/%s.{h,c}\n",
+        list.n, min_len, max_len, t->m, argv[2], name);
+    ph_free(t);
+    free(slot_key);
+    free(hashes);
+    free(upper);
+    free(list.keys);
+    free(list.lens);
+    free(list.text);
+    return 0;
+}
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../benchmarks/results.h"
+
+/**
+ * Compares two benchmark result files (./benchmark ... --out file, JSON or
+ * CSV) and gates on regressions.
+ *
+ *      ph_compare baseline candidate [alpha] [min_change]
+ *
+ * Each metric of the candidate is matched with the same benchmark,
+ * configuration and metric in the baseline. The trial samples of the two
+ * are compared with a two-sided Mann-Whitney U test: it ranks the samples
+ * instead of assuming they are normal, so the one slow trial that a timing
+ * run often has does not decide the result. A metric where lower is better
+ * (times, memory) has regressed when its median rose by more than
+ * min_change (default 0.10, 10%) and the test gives p < alpha (default
+ * 0.01). With 10 trials per side the smallest p possible is about 2e-4.
+ * Whole runs of unchanged code on one VM already differ by 5-7%, hence
+ * the 10% default.
+ *
+ * Exit status: 0 without regressions, 1 with at least one, 2 when a file
+ * can't be read.
+ */
+
+#define DEFAULT_ALPHA 0.01
+#define DEFAULT_MIN_CHANGE 0.10
+
+typedef struct {
+    double value;
+    int group; // 0 baseline, 1 candidate
+} ranked_t;
+
+static int compare_ranked(const void *a, const void *b) {
+    double diff = ((const ranked_t *)a)->value - ((const ranked_t *)b)->value;
+    return (diff > 0) - (diff < 0);
+}
+
+/**
+ * @brief Two-sided p-value of the Mann-Whitney U test of a against b,
+ *        from the normal approximation with tie and continuity corrections.
+ *        1 when every sample is tied.
+ */
+static double mann_whitney_p(const double *a, size_t na, const double *b, size_t nb) {
+    size_t total = na + nb;
+    ranked_t *all = malloc(total * sizeof(ranked_t));
+    if(!all) return 1;
+    for(size_t i = 0; i < na; i++) all[i] = (ranked_t){ a[i], 0 };
+    for(size_t i = 0; i < nb; i++) all[na + i] = (ranked_t){ b[i], 1 };
+    qsort(all, total, sizeof(ranked_t), compare_ranked);
+
+    // ties share the average of their ranks
+    double rank_sum_a = 0, tie_term = 0;
+    for(size_t i = 0; i < total; ) {
+        size_t j = i;
+        while(j < total && all[j].value == all[i].value) j++;
+        double rank = (double)(i + j + 1) / 2.0; // ranks i + 1 .. j
+        for(size_t k = i; k < j; k++) {
+            if(all[k].group == 0) rank_sum_a += rank;
+        }
+        double t = (double)(j - i);
+        tie_term += t * t * t - t;
+        i = j;
+    }
+    free(all);
+
+    double u = rank_sum_a - (double)na * (double)(na + 1) / 2.0;
+    double mean = (double)na * (double)nb / 2.0;
+    double var = (double)na * (double)nb / 12.0 * ((double)(total + 1) - tie_term / ((double)total * (double)(total - 1)));
+    if(var <= 0) return 1;
+    double z = (fabs(u - mean) - 0.5) / sqrt(var);
+    if(z <= 0) return 1;
+    return erfc(z / sqrt(2.0));
+}
+
+int main(int argc, char *argv[]) {
+    if(argc < 3 || argc > 5) {
+        fprintf(stderr, "Usage: %s baseline candidate [alpha] [min_change]\n", argv[0]);
+        fprintf(stderr, "Exits 1 when a metric regressed: median up by more than min_change (default %.2f)\n"
+            "with Mann-Whitney p < alpha (default %.2f). Files are ./benchmark --out output, JSON or CSV.\n",
+            DEFAULT_MIN_CHANGE, DEFAULT_ALPHA);
+        return 2;
+    }
+    double alpha = (argc > 3) ? atof(argv[3]) : DEFAULT_ALPHA;
+    double min_change = (argc > 4) ? atof(argv[4]) : DEFAULT_MIN_CHANGE;
+
+    result_file_t *base = results_read(argv[1]);
+    result_file_t *cand = results_read(argv[2]);
+    if(!base || !cand) {
+        fprintf(stderr, "ph_compare: can't read %s\n", base ? argv[2] : argv[1]);
+        results_free(base);
+        results_free(cand);
+        return 2;
+    }
+
+    printf("baseline:  %s, %s, %d CPUs, %s\n", base->host.cpu, base->host.os, base->host.cpus, base->host.timestamp);
+    printf("candidate: %s, %s, %d CPUs, %s\n", cand->host.cpu, cand->host.os, cand->host.cpus, cand->host.timestamp);
+    if(strcmp(base->host.cpu, cand->host.cpu) != 0 || base->host.cpus != cand->host.cpus) {
+        printf("Warning: the files come from different hosts, differences may not be the code's\n");
+    }
+    printf("\n%-32s %-20s %14s %14s %9s %9s  %s\n", "benchmark", "metric", "baseline", "candidate", "change", "p", "verdict");
+
+    int regressions = 0, improvements = 0, unmatched = 0;
+    for(size_t i = 0; i < cand->n; i++) {
+        const result_record_t *c = &cand->records[i];
+        const result_record_t *b = results_find(base, c);
+        if(!b) {
+            unmatched++;
+            continue;
+        }
+        double old_median = b->stats.median, new_median = c->stats.median;
+        double change = (old_median != 0) ? (new_median - old_median) / fabs(old_median) : 0;
+        double p = mann_whitney_p(b->samples, b->num_samples, c->samples, c->num_samples);
+
+        const char *verdict = "";
+        if(c->lower_is_better && p < alpha && change > min_change) {
+            verdict = "REGRESSION";
+            regressions++;
+        } else if(c->lower_is_better && p < alpha && change < -min_change) {
+            verdict = "improved";
+            improvements++;
+        } else if(c->lower_is_better) {
+            verdict = "ok";
+        }
+
+        char name[64];
+        snprintf(name, sizeof(name), "%s type=%d n=%d len=%d", c->bench, c->hash_type, c->n, c->key_len);
+        printf("%-32s %-20s %14.6g %14.6g %+8.1f%% %9.2g  %s\n", name, c->metric, old_median, new_median,
+            100.0 * change, p, verdict);
+    }
+
+    printf("\n%d regression(s), %d improvement(s)", regressions, improvements);
+    if(unmatched) printf(", %d metric(s) not in the baseline", unmatched);
+    printf("\n");
+
+    results_free(base);
+    results_free(cand);
+    return regressions ? 1 : 0;
+}